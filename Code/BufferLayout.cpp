@@ -0,0 +1,17 @@
+#include "BufferLayout.h"
+
+void CheckReflectedMember(BlockCheck& check, const std::string& name, GLenum property, i32 expected)
+{
+	const GLuint index = glGetProgramResourceIndex(check.program, check.memberInterface, name.c_str());
+	if (index == GL_INVALID_INDEX)
+		return;
+
+	GLint value = 0;
+	glGetProgramResourceiv(check.program, check.memberInterface, index, 1, &property, 1, NULL, &value);
+	if (value == expected)
+		return;
+
+	const char* propertyName = property == GL_OFFSET ? "offset" : property == GL_ARRAY_STRIDE ? "array stride" : "top level array stride";
+	ELOG("Block %s of program %s doesn't match its descriptor: %s has %s %d instead of %d", check.blockName, check.programName, name.c_str(), propertyName, value, expected);
+	check.matches = false;
+}
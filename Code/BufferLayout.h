@@ -0,0 +1,256 @@
+#pragma once
+
+#include "platform.h"
+#include <string.h>
+#include <array>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Compile time layouts of the blocks the shaders share with the engine. A block
+// lists the GLSL types of its members in declaration order and the std140/std430
+// rules give the offsets, the size and the alignment, so what the engine writes
+// can't drift from the descriptor. BlockWriter fills a block in local memory and
+// it goes to the mapped buffer in one copy (PushBlock in buffermanagement.h).
+// CheckBlockLayout compares a descriptor with what the driver reports for a
+// program, which catches shaders that declare the block differently.
+
+enum class BlockPacking { STD140, STD430 };
+
+constexpr u32 AlignOffset(u32 offset, u32 alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Scalars, vectors and matrices, the same in both packings
+template <typename T> struct GLSLType;
+template <> struct GLSLType<i32>       { static constexpr u32 size = 4;  static constexpr u32 alignment = 4;  };
+template <> struct GLSLType<u32>       { static constexpr u32 size = 4;  static constexpr u32 alignment = 4;  };
+template <> struct GLSLType<f32>       { static constexpr u32 size = 4;  static constexpr u32 alignment = 4;  };
+template <> struct GLSLType<vec2>      { static constexpr u32 size = 8;  static constexpr u32 alignment = 8;  };
+template <> struct GLSLType<vec3>      { static constexpr u32 size = 12; static constexpr u32 alignment = 16; };
+template <> struct GLSLType<vec4>      { static constexpr u32 size = 16; static constexpr u32 alignment = 16; };
+template <> struct GLSLType<glm::mat4> { static constexpr u32 size = 64; static constexpr u32 alignment = 16; };
+
+// T[N], N = 0 is a runtime sized array, only valid as the last member of a storage block
+template <typename T, u32 N>
+struct Array
+{
+	using Element = T;
+	static constexpr u32 count = N;
+};
+
+template <BlockPacking P, typename T, typename = void>
+struct MemberLayout
+{
+	static_assert(sizeof(T) == GLSLType<T>::size, "The C++ type has to match the GLSL one byte for byte");
+	static constexpr u32 alignment = GLSLType<T>::alignment;
+	static constexpr u32 size = GLSLType<T>::size;
+};
+
+template <typename T, typename = void>
+struct IsBlock : std::false_type {};
+
+template <typename T>
+struct IsBlock<T, std::enable_if_t<T::isBlock>> : std::true_type {};
+
+template <typename A, typename B>
+constexpr bool SameLayout()
+{
+	if (A::size != B::size || A::alignment != B::alignment)
+		return false;
+	for (u32 i = 0; i < A::memberCount; ++i)
+	{
+		if (A::offsets[i] != B::offsets[i])
+			return false;
+	}
+	return true;
+}
+
+// Structs, written with their own layout so they have to keep it in the enclosing packing
+template <BlockPacking P, typename T>
+struct MemberLayout<P, T, std::enable_if_t<T::isBlock>>
+{
+	static_assert(SameLayout<typename T::template Repack<P>, T>(), "The struct's layout changes in this packing");
+	static constexpr u32 alignment = T::alignment;
+	static constexpr u32 size = T::size;
+};
+
+// std140 rounds the alignment and the stride of every array up to a vec4
+template <BlockPacking P, typename T, u32 N>
+struct MemberLayout<P, Array<T, N>>
+{
+	static constexpr u32 alignment = P == BlockPacking::STD140 ? AlignOffset(MemberLayout<P, T>::alignment, 16) : MemberLayout<P, T>::alignment;
+	static constexpr u32 stride = AlignOffset(MemberLayout<P, T>::size, alignment);
+	static constexpr u32 size = stride * N;
+};
+
+template <u32 N>
+constexpr std::array<u32, N> ComputeMemberOffsets(const u32 (&alignments)[N], const u32 (&sizes)[N])
+{
+	std::array<u32, N> offsets = {};
+	u32 offset = 0;
+	for (u32 i = 0; i < N; ++i)
+	{
+		offset = AlignOffset(offset, alignments[i]);
+		offsets[i] = offset;
+		offset += sizes[i];
+	}
+	return offsets;
+}
+
+template <u32 N>
+constexpr u32 MaxAlignment(const u32 (&alignments)[N])
+{
+	u32 alignment = 1;
+	for (u32 i = 0; i < N; ++i)
+		alignment = alignments[i] > alignment ? alignments[i] : alignment;
+	return alignment;
+}
+
+// Descriptors derive from it and add the names of the members as the shaders declare them, and
+// blockName / blockInterface if they are a whole uniform or storage block
+template <BlockPacking P, typename... Members>
+struct Block
+{
+	static constexpr bool isBlock = true;
+	static constexpr BlockPacking packing = P;
+	static constexpr u32 memberCount = sizeof...(Members);
+
+	template <u32 I>
+	using Member = std::tuple_element_t<I, std::tuple<Members...>>;
+
+	template <BlockPacking Q>
+	using Repack = Block<Q, Members...>;
+
+	static constexpr u32 memberAlignments[] = { MemberLayout<P, Members>::alignment... };
+	static constexpr u32 memberSizes[] = { MemberLayout<P, Members>::size... };
+	static constexpr std::array<u32, memberCount> offsets = ComputeMemberOffsets(memberAlignments, memberSizes);
+
+	static constexpr u32 alignment = P == BlockPacking::STD140 ? AlignOffset(MaxAlignment(memberAlignments), 16) : MaxAlignment(memberAlignments);
+	static constexpr u32 size = AlignOffset(offsets[memberCount - 1] + memberSizes[memberCount - 1], alignment);
+};
+
+template <typename B> struct BlockWriter;
+
+// What a value of T writes into a block: a member of that type, or a struct if it's a BlockWriter
+template <typename T>
+struct WrittenType
+{
+	using Type = T;
+	static constexpr u32 size = sizeof(T);
+};
+
+template <typename B>
+struct WrittenType<BlockWriter<B>>
+{
+	using Type = B;
+	static constexpr u32 size = B::size;
+};
+
+// A block in local memory. The members are checked against the descriptor at compile
+// time, arrays whose stride is the size of the values go in a single copy.
+template <typename B>
+struct alignas(16) BlockWriter
+{
+	u8 data[B::size] = {};
+
+	template <u32 I, typename T>
+	void Set(const T& value)
+	{
+		static_assert(std::is_same<typename WrittenType<T>::Type, typename B::template Member<I>>::value, "Wrong type for this member of the block");
+		memcpy(data + B::offsets[I], &value, WrittenType<T>::size);
+	}
+
+	template <u32 I, typename T>
+	void SetArray(const T* values, u32 count)
+	{
+		using Member = typename B::template Member<I>;
+		static_assert(std::is_same<typename WrittenType<T>::Type, typename Member::Element>::value, "Wrong type for this array of the block");
+		static_assert(Member::count > 0, "Runtime sized arrays go after the block, see PushBlockArray");
+		ASSERT(count <= Member::count, "More values than the array holds");
+
+		constexpr u32 stride = MemberLayout<B::packing, Member>::stride;
+		if (stride == sizeof(T))
+		{
+			memcpy(data + B::offsets[I], values, sizeof(T) * count);
+		}
+		else
+		{
+			for (u32 i = 0; i < count; ++i)
+				memcpy(data + B::offsets[I] + stride * i, values + i, WrittenType<T>::size);
+		}
+	}
+};
+
+struct BlockCheck
+{
+	GLuint program;
+	GLenum memberInterface; // GL_UNIFORM or GL_BUFFER_VARIABLE
+	const char* programName;
+	const char* blockName;
+	bool matches;
+};
+
+// Compares a property of a member with the expected value, if the program uses that member
+void CheckReflectedMember(BlockCheck& check, const std::string& name, GLenum property, i32 expected);
+
+// topLevelStride is the stride of the storage block's top level array the member is in,
+// -1 while outside of it
+template <BlockPacking P, typename T, typename = void>
+struct BlockMemberCheck
+{
+	static void Check(BlockCheck& check, const std::string& name, u32 offset, i32 topLevelStride)
+	{
+		CheckReflectedMember(check, name, GL_OFFSET, offset);
+		if (check.memberInterface == GL_BUFFER_VARIABLE)
+			CheckReflectedMember(check, name, GL_TOP_LEVEL_ARRAY_STRIDE, topLevelStride < 0 ? 0 : topLevelStride);
+	}
+};
+
+template <typename B, size_t... I>
+void CheckBlockMembers(BlockCheck& check, const std::string& prefix, u32 offset, i32 topLevelStride, std::index_sequence<I...>)
+{
+	(BlockMemberCheck<B::packing, typename B::template Member<I>>::Check(check, prefix + B::memberNames[I], offset + B::offsets[I], topLevelStride), ...);
+}
+
+template <BlockPacking P, typename T>
+struct BlockMemberCheck<P, T, std::enable_if_t<T::isBlock>>
+{
+	static void Check(BlockCheck& check, const std::string& name, u32 offset, i32 topLevelStride)
+	{
+		CheckBlockMembers<T>(check, name + ".", offset, topLevelStride, std::make_index_sequence<T::memberCount>());
+	}
+};
+
+// Arrays of structs are listed per element and the second one gives away the stride,
+// arrays of anything else are a single member with its own stride
+template <BlockPacking P, typename T, u32 N>
+struct BlockMemberCheck<P, Array<T, N>>
+{
+	static void Check(BlockCheck& check, const std::string& name, u32 offset, i32 topLevelStride)
+	{
+		constexpr u32 stride = MemberLayout<P, Array<T, N>>::stride;
+		const i32 elementTopLevelStride = topLevelStride < 0 ? stride : topLevelStride;
+
+		BlockMemberCheck<P, T>::Check(check, name + "[0]", offset, elementTopLevelStride);
+		if (!IsBlock<T>::value)
+			CheckReflectedMember(check, name + "[0]", GL_ARRAY_STRIDE, stride);
+		else if (N != 1)
+			BlockMemberCheck<P, T>::Check(check, name + "[1]", offset + stride, elementTopLevelStride);
+	}
+};
+
+// Returns false and logs the members that differ if the program declares the block with
+// another layout. Programs without the block and members they don't use are skipped.
+template <typename B>
+bool CheckBlockLayout(GLuint program, const char* programName)
+{
+	if (glGetProgramResourceIndex(program, B::blockInterface, B::blockName) == GL_INVALID_INDEX)
+		return true;
+
+	BlockCheck check = { program, B::blockInterface == GL_UNIFORM_BLOCK ? GLenum(GL_UNIFORM) : GLenum(GL_BUFFER_VARIABLE), programName, B::blockName, true };
+	CheckBlockMembers<B>(check, "", 0, -1, std::make_index_sequence<B::memberCount>());
+	return check.matches;
+}
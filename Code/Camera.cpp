@@ -23,6 +23,8 @@ void Camera::Init(glm::vec3 pos, float near, float far, float aspRatio)
 	farPlane = far;
 	aspectRatio = aspRatio;
 	mouseInitialPos = glm::vec2(0.0f);
+	jitter = glm::vec2(0.0f);
+	jitterNdc = glm::vec2(0.0f);
 
 	projection = glm::perspective(glm::radians(60.0f), aspectRatio, nearPlane, farPlane);
 	view = glm::lookAt(position, position + front, up);
@@ -110,4 +112,29 @@ void Camera::Resize(int width, int height)
 {
 	aspectRatio = (float)width / (float)height;
 	projection = glm::perspective(glm::radians(60.0f), aspectRatio, nearPlane, farPlane);
+}
+
+void Camera::SetJitter(glm::vec2 pixelOffset, glm::ivec2 renderSize)
+{
+	jitter = pixelOffset;
+	jitterNdc = 2.0f * pixelOffset / glm::vec2(renderSize);
+}
+
+const glm::mat4 Camera::GetJitteredViewProjection()
+{
+	// The translation is scaled by w, after the divide every pixel moves by jitterNdc
+	return glm::translate(glm::mat4(1.0f), glm::vec3(jitterNdc, 0.0f)) * projection * view;
+}
+
+float Camera::Halton(unsigned int index, unsigned int base)
+{
+	float result = 0.0f;
+	float fraction = 1.0f;
+	while (index > 0)
+	{
+		fraction /= (float)base;
+		result += fraction * (float)(index % base);
+		index /= base;
+	}
+	return result;
 }
\ No newline at end of file
@@ -21,6 +21,14 @@ public:
 	const glm::mat4& GetProjectionMatrix() { return projection; }
 	const glm::mat4 GetViewProjection() { return projection * view; }
 
+	// Sub-pixel offset of the projection for temporal anti-aliasing, in pixels of the render size
+	void SetJitter(glm::vec2 pixelOffset, glm::ivec2 renderSize);
+	const glm::vec2& GetJitter() { return jitter; }
+	const glm::mat4 GetJitteredViewProjection();
+
+	// Element index of the Halton low discrepancy sequence with the given base, in [0, 1)
+	static float Halton(unsigned int index, unsigned int base);
+
 	const glm::vec3& GetPosition() { return position; }
 
 private:
@@ -30,6 +38,8 @@ private:
 
 	glm::mat4 view;
 	glm::mat4 projection;
+	glm::vec2 jitter;
+	glm::vec2 jitterNdc;
 
 	float aspectRatio;
 	float nearPlane;
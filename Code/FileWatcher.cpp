@@ -0,0 +1,175 @@
+#include "FileWatcher.h"
+
+#ifdef _WIN32
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+	std::string NormalizePath(std::string path)
+	{
+		std::replace(path.begin(), path.end(), '\\', '/');
+		return path;
+	}
+
+	std::string GetDirectory(const std::string& path)
+	{
+		size_t separator = path.find_last_of('/');
+		return separator == std::string::npos ? std::string() : path.substr(0, separator);
+	}
+}
+
+FileWatcher::FileWatcher()
+{
+#ifndef _WIN32
+	inotifyFd = inotify_init1(IN_CLOEXEC);
+	if (inotifyFd < 0)
+	{
+		ELOG("inotify_init1() failed, assets won't hot reload");
+		return;
+	}
+
+	std::thread(&FileWatcher::WatchLoop, this).detach();
+#endif
+}
+
+void FileWatcher::Watch(const std::string& path)
+{
+	const std::string file = NormalizePath(path);
+	const std::string directory = GetDirectory(file);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	files.insert(file);
+	if (!directories.insert(directory).second)
+		return;
+
+#ifdef _WIN32
+	std::thread(&FileWatcher::WatchDirectory, this, directory).detach();
+#else
+	if (inotifyFd < 0)
+		return;
+
+	int wd = inotify_add_watch(inotifyFd, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0)
+	{
+		ELOG("Couldn't watch directory %s", directory.c_str());
+		return;
+	}
+	watchDescriptors[wd] = directory;
+#endif
+}
+
+std::vector<std::string> FileWatcher::PollChanges()
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	std::vector<std::string> settled;
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto it = changes.begin(); it != changes.end();)
+	{
+		if (std::chrono::duration<f32>(now - it->second).count() >= FILE_WATCHER_SETTLE_TIME)
+		{
+			settled.push_back(it->first);
+			it = changes.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	return settled;
+}
+
+u32 FileWatcher::GetWatchedFileCount()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return files.size();
+}
+
+// Called from the watching threads with the mutex held
+void FileWatcher::OnFileChanged(const std::string& directory, const char* filename)
+{
+	const std::string file = directory.empty() ? std::string(filename) : directory + "/" + filename;
+	if (files.count(file))
+		changes[file] = std::chrono::steady_clock::now();
+}
+
+#ifdef _WIN32
+
+void FileWatcher::WatchDirectory(std::string directory)
+{
+	HANDLE handle = CreateFileA(directory.empty() ? "." : directory.c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		ELOG("Couldn't watch directory %s", directory.c_str());
+		return;
+	}
+
+	alignas(DWORD) u8 buffer[4096];
+	while (true)
+	{
+		DWORD bytesReturned = 0;
+		if (!ReadDirectoryChangesW(handle, buffer, sizeof(buffer), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, &bytesReturned, NULL, NULL))
+			break;
+
+		// Zero bytes means the buffer overflowed and the changes were lost
+		if (bytesReturned == 0)
+			continue;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)buffer;
+		while (true)
+		{
+			char filename[MAX_PATH] = {};
+			WideCharToMultiByte(CP_UTF8, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), filename, sizeof(filename) - 1, NULL, NULL);
+			OnFileChanged(directory, filename);
+
+			if (info->NextEntryOffset == 0)
+				break;
+			info = (FILE_NOTIFY_INFORMATION*)((u8*)info + info->NextEntryOffset);
+		}
+	}
+
+	CloseHandle(handle);
+}
+
+#else
+
+void FileWatcher::WatchLoop()
+{
+	alignas(struct inotify_event) char buffer[4096];
+	while (true)
+	{
+		ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+		if (length <= 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ELOG("Reading inotify events failed, assets won't hot reload anymore");
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (char* ptr = buffer; ptr < buffer + length;)
+		{
+			const struct inotify_event* event = (const struct inotify_event*)ptr;
+			auto it = watchDescriptors.find(event->wd);
+			if (event->len > 0 && it != watchDescriptors.end())
+				OnFileChanged(it->second, event->name);
+
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "platform.h"
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+// Seconds a file has to go without changes before it's reported, editors often write in several steps
+#define FILE_WATCHER_SETTLE_TIME 0.1f
+
+// Reports changes to the watched files from a background thread, so nothing
+// has to poll timestamps. It watches the directories holding the files (inotify
+// on Linux, ReadDirectoryChangesW on Windows) and filters out everything else.
+class FileWatcher
+{
+public:
+	FileWatcher();
+
+	// Paths are compared as given, relative to the working directory
+	void Watch(const std::string& path);
+
+	// Files that changed and settled since the last call, each one once
+	std::vector<std::string> PollChanges();
+
+	u32 GetWatchedFileCount();
+
+private:
+	void OnFileChanged(const std::string& directory, const char* filename);
+
+#ifdef _WIN32
+	void WatchDirectory(std::string directory);
+#else
+	void WatchLoop();
+	int inotifyFd;
+	std::map<int, std::string> watchDescriptors;
+#endif
+
+	std::mutex mutex;
+	std::set<std::string> files;
+	std::set<std::string> directories;
+	std::map<std::string, std::chrono::steady_clock::time_point> changes;
+};
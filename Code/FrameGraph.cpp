@@ -0,0 +1,262 @@
+#include "FrameGraph.h"
+#include "RenderTargetPool.h"
+#include "GpuProfiler.h"
+
+#include <glad/glad.h>
+#include <algorithm>
+
+FrameGraph::FrameGraph(RenderTargetPool* pool, GpuProfiler* profiler) : pool(pool), profiler(profiler), poolGeneration(pool->GetGeneration()), aliasedTextureCount(0)
+{
+}
+
+FrameGraph::~FrameGraph()
+{
+	ClearFramebuffers();
+}
+
+void FrameGraph::Reset()
+{
+	textures.clear();
+	passes.clear();
+}
+
+FrameGraphResource FrameGraph::ImportTexture(const char* name, u32 handle, FramebufferTextureFormat format, ivec2 size, ivec2 allocatedSize)
+{
+	FrameGraphTexture texture;
+	texture.name = name;
+	texture.format = format;
+	texture.size = size;
+	texture.allocatedSize = allocatedSize;
+	texture.handle = handle;
+	texture.imported = true;
+
+	textures.push_back(texture);
+	return textures.size() - 1;
+}
+
+FrameGraphResource FrameGraph::ImportBackbuffer(const char* name, ivec2 size)
+{
+	FrameGraphTexture texture;
+	texture.name = name;
+	texture.size = size;
+	texture.allocatedSize = size;
+	texture.imported = true;
+	texture.backbuffer = true;
+
+	textures.push_back(texture);
+	return textures.size() - 1;
+}
+
+FrameGraphResource FrameGraph::CreateTexture(const char* name, FramebufferTextureFormat format, ivec2 size, ivec2 allocatedSize)
+{
+	FrameGraphTexture texture;
+	texture.name = name;
+	texture.format = format;
+	texture.size = size;
+	texture.allocatedSize = allocatedSize;
+
+	textures.push_back(texture);
+	return textures.size() - 1;
+}
+
+void FrameGraph::AddPass(const char* name, const std::vector<FrameGraphResource>& reads, const std::vector<FrameGraphResource>& writes, FrameGraphExecuteFn execute)
+{
+	FrameGraphPass pass;
+	pass.name = name;
+	pass.reads = reads;
+	pass.writes = writes;
+	pass.execute = execute;
+
+	passes.push_back(pass);
+}
+
+void FrameGraph::Compile()
+{
+	for (FrameGraphTexture& texture : textures)
+	{
+		texture.used = texture.backbuffer;
+		texture.firstPass = UINT32_MAX;
+		texture.lastPass = 0;
+	}
+
+	// Walk backwards: a pass is needed when a later needed pass (or the screen) reads something it writes
+	for (i32 i = (i32)passes.size() - 1; i >= 0; --i)
+	{
+		FrameGraphPass& pass = passes[i];
+
+		pass.culled = true;
+		for (FrameGraphResource resource : pass.writes)
+		{
+			if (textures[resource].used)
+			{
+				pass.culled = false;
+				break;
+			}
+		}
+
+		if (pass.culled)
+			continue;
+
+		for (FrameGraphResource resource : pass.reads)
+		{
+			textures[resource].used = true;
+		}
+
+		// Targets the pass writes and samples again itself (ping-pong, mip chains) are in both
+		// lists, they keep their texture even if no other pass reads them
+		for (FrameGraphResource resource : pass.writes)
+		{
+			if (std::find(pass.reads.begin(), pass.reads.end(), resource) != pass.reads.end())
+				textures[resource].used = true;
+		}
+	}
+
+	// Lifetimes of the textures among the passes that survived
+	for (u32 i = 0; i < passes.size(); ++i)
+	{
+		FrameGraphPass& pass = passes[i];
+		if (pass.culled)
+			continue;
+
+		auto extend = [this, i](FrameGraphResource resource)
+		{
+			FrameGraphTexture& texture = textures[resource];
+			texture.firstPass = std::min(texture.firstPass, i);
+			texture.lastPass = std::max(texture.lastPass, i);
+		};
+		std::for_each(pass.reads.begin(), pass.reads.end(), extend);
+
+		// Color outputs no surviving pass reads, this one included, don't get a texture. Depth stays
+		// for the pass's own depth test.
+		for (FrameGraphResource resource : pass.writes)
+		{
+			if (textures[resource].used || Utils::IsDepthFormat(textures[resource].format))
+				extend(resource);
+		}
+	}
+}
+
+void FrameGraph::Execute()
+{
+	if (poolGeneration != pool->GetGeneration())
+	{
+		ClearFramebuffers();
+		poolGeneration = pool->GetGeneration();
+	}
+
+	aliasedTextureCount = 0;
+	std::vector<u32> handlesThisFrame;
+
+	// No attachment for the outputs that didn't get a texture, the last one they had may be in use by another
+	for (FrameGraphTexture& texture : textures)
+	{
+		if (!texture.imported && texture.firstPass == UINT32_MAX)
+			texture.handle = 0;
+	}
+
+	for (u32 i = 0; i < passes.size(); ++i)
+	{
+		FrameGraphPass& pass = passes[i];
+		if (pass.culled)
+			continue;
+
+		for (FrameGraphTexture& texture : textures)
+		{
+			if (texture.imported || texture.firstPass != i)
+				continue;
+
+			ivec2 allocatedSize;
+			texture.handle = pool->Acquire(texture.format, texture.allocatedSize.x, texture.allocatedSize.y, allocatedSize);
+			texture.allocatedSize = allocatedSize;
+
+			if (std::find(handlesThisFrame.begin(), handlesThisFrame.end(), texture.handle) != handlesThisFrame.end())
+				++aliasedTextureCount;
+			else
+				handlesThisFrame.push_back(texture.handle);
+		}
+
+		pass.execute(*this);
+
+		if (profiler)
+			profiler->Mark(pass.name);
+
+		for (FrameGraphTexture& texture : textures)
+		{
+			if (!texture.imported && texture.firstPass != UINT32_MAX && texture.lastPass == i)
+				pool->Release(texture.handle);
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void FrameGraph::BindRenderTargets(const std::vector<FrameGraphResource>& colors, FrameGraphResource depth)
+{
+	std::vector<u32> key;
+	for (FrameGraphResource resource : colors)
+		key.push_back(textures[resource].handle);
+	key.push_back(depth != FRAME_GRAPH_NO_RESOURCE ? textures[depth].handle : 0);
+
+	u32& framebufferID = framebuffers[key];
+	if (framebufferID == 0)
+	{
+		glGenFramebuffers(1, &framebufferID);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+
+		for (u32 i = 0; i < colors.size(); ++i)
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, textures[colors[i]].handle, 0);
+
+		if (depth != FRAME_GRAPH_NO_RESOURCE)
+		{
+			GLenum attachmentPoint = textures[depth].format == FramebufferTextureFormat::DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+			glFramebufferTexture(GL_FRAMEBUFFER, attachmentPoint, textures[depth].handle, 0);
+		}
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			ELOG("Frame graph framebuffer not completed");
+		}
+	}
+	else
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+	}
+
+	// Mask out the attachments no later pass reads, they have no texture
+	GLenum buffers[8];
+	ASSERT(colors.size() <= ARRAY_COUNT(buffers), "Too many color attachments");
+	for (u32 i = 0; i < colors.size(); ++i)
+		buffers[i] = textures[colors[i]].used ? GL_COLOR_ATTACHMENT0 + i : GL_NONE;
+
+	if (colors.empty())
+		glDrawBuffer(GL_NONE);
+	else
+		glDrawBuffers(colors.size(), buffers);
+
+	const ivec2 size = colors.empty() ? textures[depth].size : textures[colors[0]].size;
+	glViewport(0, 0, size.x, size.y);
+}
+
+u32 FrameGraph::GetCulledPassCount()
+{
+	u32 count = 0;
+	for (FrameGraphPass& pass : passes)
+		count += pass.culled ? 1 : 0;
+	return count;
+}
+
+u32 FrameGraph::GetTransientTextureCount()
+{
+	u32 count = 0;
+	for (FrameGraphTexture& texture : textures)
+		count += (!texture.imported && texture.firstPass != UINT32_MAX) ? 1 : 0;
+	return count;
+}
+
+void FrameGraph::ClearFramebuffers()
+{
+	for (auto& framebuffer : framebuffers)
+		glDeleteFramebuffers(1, &framebuffer.second);
+	framebuffers.clear();
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "platform.h"
+#include "Framebuffer.h"
+#include <vector>
+#include <map>
+#include <functional>
+
+class RenderTargetPool;
+class GpuProfiler;
+class FrameGraph;
+
+typedef u32 FrameGraphResource;
+
+#define FRAME_GRAPH_NO_RESOURCE UINT32_MAX
+
+struct FrameGraphTexture
+{
+	const char* name = "";
+	FramebufferTextureFormat format = FramebufferTextureFormat::NONE;
+	ivec2 size;          // rendered area
+	ivec2 allocatedSize; // full texture, transient textures ask the pool for this size
+	u32 handle = 0;
+
+	bool imported = false;
+	bool backbuffer = false;
+
+	// Filled by Compile
+	bool used = false;
+	u32 firstPass = UINT32_MAX;
+	u32 lastPass = 0;
+};
+
+typedef std::function<void(FrameGraph& graph)> FrameGraphExecuteFn;
+
+struct FrameGraphPass
+{
+	const char* name;
+	std::vector<FrameGraphResource> reads;
+	std::vector<FrameGraphResource> writes;
+	FrameGraphExecuteFn execute;
+
+	bool culled = false;
+};
+
+// Per frame description of the render passes. Passes declare the textures they
+// read and write and are executed in declaration order. Compile culls the passes
+// whose writes nobody reads (the backbuffer always counts as read) and works out
+// the lifetime of the transient textures, which are taken from the render target
+// pool right before their first use and given back after their last one, so
+// textures whose lifetimes don't overlap end up sharing memory. With a profiler,
+// the GPU time of every executed pass is measured under the pass name.
+class FrameGraph
+{
+public:
+	FrameGraph(RenderTargetPool* pool, GpuProfiler* profiler = nullptr);
+	~FrameGraph();
+
+	// Drops the passes and resources of the previous frame
+	void Reset();
+
+	FrameGraphResource ImportTexture(const char* name, u32 handle, FramebufferTextureFormat format, ivec2 size, ivec2 allocatedSize);
+	FrameGraphResource ImportBackbuffer(const char* name, ivec2 size);
+	FrameGraphResource CreateTexture(const char* name, FramebufferTextureFormat format, ivec2 size, ivec2 allocatedSize);
+
+	// A pass that samples one of its own outputs (intermediate targets) lists it in reads as well
+	void AddPass(const char* name, const std::vector<FrameGraphResource>& reads, const std::vector<FrameGraphResource>& writes, FrameGraphExecuteFn execute);
+
+	void Compile();
+	void Execute();
+
+	// Usable while executing a pass
+	u32 GetTexture(FrameGraphResource resource) { return textures[resource].handle; }
+	ivec2 GetSize(FrameGraphResource resource) { return textures[resource].size; }
+	vec2 GetUVScale(FrameGraphResource resource) { return vec2(textures[resource].size) / vec2(textures[resource].allocatedSize); }
+
+	// True when a pass that wasn't culled reads the resource
+	bool IsUsed(FrameGraphResource resource) { return textures[resource].used; }
+
+	// Binds a framebuffer with these attachments and sets the viewport to their
+	// rendered area. Color attachments nobody reads afterwards are not written.
+	void BindRenderTargets(const std::vector<FrameGraphResource>& colors, FrameGraphResource depth = FRAME_GRAPH_NO_RESOURCE);
+
+	const std::vector<FrameGraphPass>& GetPasses() { return passes; }
+	u32 GetCulledPassCount();
+	u32 GetTransientTextureCount();
+	u32 GetAliasedTextureCount() { return aliasedTextureCount; }
+
+private:
+	void ClearFramebuffers();
+
+	RenderTargetPool* pool;
+	GpuProfiler* profiler;
+
+	std::vector<FrameGraphTexture> textures;
+	std::vector<FrameGraphPass> passes;
+
+	// Framebuffers are cached by their attachments, the pool hands out the same textures every frame
+	std::map<std::vector<u32>, u32> framebuffers;
+	u32 poolGeneration;
+
+	u32 aliasedTextureCount;
+};
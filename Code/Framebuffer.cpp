@@ -1,77 +1,244 @@
 #include "Framebuffer.h"
+#include "RenderTargetPool.h"
 
 #include <glad/glad.h>
 
-Framebuffer::Framebuffer(u32 numColorAttachments, int w, int h) : framebufferID(0), width(w), height(h)
+namespace Utils
 {
-	Init(numColorAttachments);
+	bool IsDepthFormat(FramebufferTextureFormat format)
+	{
+		switch (format)
+		{
+		case FramebufferTextureFormat::DEPTH24_STENCIL8:
+		case FramebufferTextureFormat::DEPTH24:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	void GetGLFormat(FramebufferTextureFormat format, GLenum& internalFormat, GLenum& dataFormat, GLenum& dataType)
+	{
+		switch (format)
+		{
+		case FramebufferTextureFormat::RGBA8:            internalFormat = GL_RGBA8;             dataFormat = GL_RGBA;            dataType = GL_UNSIGNED_BYTE; break;
+		case FramebufferTextureFormat::RGBA16:           internalFormat = GL_RGBA16F;           dataFormat = GL_RGBA;            dataType = GL_FLOAT; break;
+		case FramebufferTextureFormat::RED_INTEGER:      internalFormat = GL_R32I;              dataFormat = GL_RED_INTEGER;     dataType = GL_INT; break;
+		case FramebufferTextureFormat::DEPTH24_STENCIL8: internalFormat = GL_DEPTH24_STENCIL8;  dataFormat = GL_DEPTH_STENCIL;   dataType = GL_UNSIGNED_INT_24_8; break;
+		case FramebufferTextureFormat::SRGBA8:           internalFormat = GL_SRGB8_ALPHA8;      dataFormat = GL_RGBA;            dataType = GL_UNSIGNED_BYTE; break;
+		case FramebufferTextureFormat::RG16_SNORM:       internalFormat = GL_RG16_SNORM;        dataFormat = GL_RG;              dataType = GL_FLOAT; break;
+		case FramebufferTextureFormat::RGBA32F:          internalFormat = GL_RGBA32F;           dataFormat = GL_RGBA;            dataType = GL_FLOAT; break;
+		case FramebufferTextureFormat::DEPTH24:          internalFormat = GL_DEPTH_COMPONENT24; dataFormat = GL_DEPTH_COMPONENT; dataType = GL_FLOAT; break;
+		case FramebufferTextureFormat::R11F_G11F_B10F:   internalFormat = GL_R11F_G11F_B10F;    dataFormat = GL_RGB;             dataType = GL_FLOAT; break;
+		case FramebufferTextureFormat::R8:               internalFormat = GL_R8;                dataFormat = GL_RED;             dataType = GL_UNSIGNED_BYTE; break;
+		case FramebufferTextureFormat::R16F:             internalFormat = GL_R16F;              dataFormat = GL_RED;             dataType = GL_FLOAT; break;
+		case FramebufferTextureFormat::RG16F:            internalFormat = GL_RG16F;             dataFormat = GL_RG;              dataType = GL_FLOAT; break;
+		case FramebufferTextureFormat::R32UI:            internalFormat = GL_R32UI;             dataFormat = GL_RED_INTEGER;     dataType = GL_UNSIGNED_INT; break;
+		default:
+			ELOG("Framebuffer texture format not supported");
+			internalFormat = GL_RGBA16F; dataFormat = GL_RGBA; dataType = GL_FLOAT;
+			break;
+		}
+	}
+
+	u32 GetBytesPerPixel(FramebufferTextureFormat format)
+	{
+		switch (format)
+		{
+		case FramebufferTextureFormat::RGBA8:            return 4;
+		case FramebufferTextureFormat::RGBA16:           return 8;
+		case FramebufferTextureFormat::RED_INTEGER:      return 4;
+		case FramebufferTextureFormat::DEPTH24_STENCIL8: return 4;
+		case FramebufferTextureFormat::SRGBA8:           return 4;
+		case FramebufferTextureFormat::RG16_SNORM:       return 4;
+		case FramebufferTextureFormat::RGBA32F:          return 16;
+		case FramebufferTextureFormat::DEPTH24:          return 4;
+		case FramebufferTextureFormat::R11F_G11F_B10F:   return 4;
+		case FramebufferTextureFormat::R8:               return 1;
+		case FramebufferTextureFormat::R16F:             return 2;
+		case FramebufferTextureFormat::RG16F:            return 4;
+		case FramebufferTextureFormat::R32UI:            return 4;
+		default:                                         return 0;
+		}
+	}
+
+	f32 MeasureFormatPrecision(FramebufferTextureFormat format, f32 minValue, f32 maxValue)
+	{
+		const u32 sampleCount = 256;
+
+		GLenum internalFormat, dataFormat, dataType;
+		GetGLFormat(format, internalFormat, dataFormat, dataType);
+		const u32 channelCount = dataFormat == GL_RED ? 1 : dataFormat == GL_RG ? 2 : dataFormat == GL_RGB ? 3 : 4;
+
+		// Channels are offset from each other so they don't all round the same way
+		std::vector<vec4> values(sampleCount);
+		for (u32 i = 0; i < sampleCount; ++i)
+		{
+			for (u32 c = 0; c < 4; ++c)
+			{
+				const f32 t = glm::min((i + c * 0.25f) / (sampleCount - 1), 1.0f);
+				values[i][c] = glm::exp2(glm::mix(glm::log2(minValue), glm::log2(maxValue), t));
+			}
+		}
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, sampleCount, 1, 0, GL_RGBA, GL_FLOAT, values.data());
+
+		std::vector<vec4> readBack(sampleCount);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, readBack.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glDeleteTextures(1, &texture);
+
+		f32 maxError = 0.0f;
+		for (u32 i = 0; i < sampleCount; ++i)
+		{
+			for (u32 c = 0; c < channelCount; ++c)
+				maxError = glm::max(maxError, glm::abs(readBack[i][c] - values[i][c]) / values[i][c]);
+		}
+		return maxError;
+	}
+}
+
+Framebuffer::Framebuffer(u32 numColorAttachments, int w, int h, RenderTargetPool* pool) : framebufferID(0), pool(pool), allocatedSize(0), acquired(false), depthAttachment(0)
+{
+	specification.width = w;
+	specification.height = h;
+	for (u32 i = 0; i < numColorAttachments; ++i)
+	{
+		specification.attachments.attachments.push_back(FramebufferTextureFormat::RGBA16);
+	}
+	specification.attachments.attachments.push_back(FramebufferTextureFormat::DEPTH24);
+
+	Init();
+}
+
+Framebuffer::Framebuffer(const FramebufferSpecification& spec, RenderTargetPool* pool) : framebufferID(0), pool(pool), allocatedSize(0), acquired(false), specification(spec), depthAttachment(0)
+{
+	Init();
 }
 
 Framebuffer::~Framebuffer()
 {
+	ReleaseTargets();
+	glDeleteFramebuffers(1, &framebufferID);
 }
 
-void Framebuffer::Init(u32 numColorAttachments)
+void Framebuffer::Init()
 {
-	if (framebufferID != 0)
-	{
-		glDeleteTextures(colorAttachments.size(), colorAttachments.data());
-		glDeleteTextures(1, &depthAttachment);
+	ReleaseTargets();
 
-		glDeleteFramebuffers(1, &framebufferID);
+	colorAttachmentSpecs.clear();
+	depthAttachmentSpec = FramebufferTextureSpecification();
+	for (const FramebufferTextureSpecification& attachment : specification.attachments.attachments)
+	{
+		if (Utils::IsDepthFormat(attachment.textureFormat))
+			depthAttachmentSpec = attachment;
+		else
+			colorAttachmentSpecs.push_back(attachment);
 	}
 
-	glGenFramebuffers(1, &framebufferID);
+	colorAttachments.assign(colorAttachmentSpecs.size(), 0);
+	depthAttachment = 0;
+
+	if (framebufferID == 0)
+		glGenFramebuffers(1, &framebufferID);
+
 	glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
-	colorAttachments.resize(numColorAttachments);
 
+	GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5, GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7 };
+	ASSERT(colorAttachments.size() <= ARRAY_COUNT(buffers), "Too many color attachments");
+	if (colorAttachments.empty())
+		glDrawBuffer(GL_NONE);
+	else
+		glDrawBuffers(colorAttachments.size(), buffers);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	AcquireTargets();
+}
+
+void Framebuffer::AcquireTargets()
+{
+	if (acquired)
+		return;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+
+	// The pool usually hands back the same textures, only re-attach when they change.
+	// It matches the size class exactly, so every attachment comes back with the same
+	// allocated size and GetUVScale holds for all of them.
 	for (int i = 0; i < colorAttachments.size(); ++i)
 	{
-		glGenTextures(1, &colorAttachments[i]);
-		glBindTexture(GL_TEXTURE_2D, colorAttachments[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, colorAttachments[i], 0);
+		u32 texture = pool->Acquire(colorAttachmentSpecs[i].textureFormat, specification.width, specification.height, allocatedSize);
+		ASSERT(allocatedSize == RenderTargetPool::GetSizeClass(specification.width, specification.height), "Attachments with different allocated sizes");
+		if (texture != colorAttachments[i])
+		{
+			colorAttachments[i] = texture;
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, texture, 0);
+		}
 	}
 
 	// Depth
-	glGenTextures(1, &depthAttachment);
-	glBindTexture(GL_TEXTURE_2D, depthAttachment);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthAttachment, 0);
-
-	GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4 };
-	glDrawBuffers(colorAttachments.size(), buffers);
+	if (depthAttachmentSpec.textureFormat != FramebufferTextureFormat::NONE)
+	{
+		u32 texture = pool->Acquire(depthAttachmentSpec.textureFormat, specification.width, specification.height, allocatedSize);
+		if (texture != depthAttachment)
+		{
+			depthAttachment = texture;
+			GLenum attachmentPoint = depthAttachmentSpec.textureFormat == FramebufferTextureFormat::DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+			glFramebufferTexture(GL_FRAMEBUFFER, attachmentPoint, texture, 0);
+		}
+	}
 
 	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if (status != GL_FRAMEBUFFER_COMPLETE)
 	{
 		ELOG("Framebuffer not completed");
 	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	acquired = true;
+}
+
+void Framebuffer::ReleaseTargets()
+{
+	if (!acquired)
+		return;
+
+	// Handles are kept so the next AcquireTargets can tell if they changed
+	for (u32 texture : colorAttachments)
+		pool->Release(texture);
+	if (depthAttachment != 0)
+		pool->Release(depthAttachment);
+
+	acquired = false;
+}
+
+bool Framebuffer::Fits(int w, int h)
+{
+	return w <= allocatedSize.x && h <= allocatedSize.y;
 }
 
 void Framebuffer::Resize(int w, int h)
 {
-	width = w;
-	height = h;
-	Init(colorAttachments.size());
+	const bool fits = Fits(w, h);
+
+	specification.width = w;
+	specification.height = h;
+
+	if (!fits)
+	{
+		ReleaseTargets();
+		AcquireTargets();
+	}
 }
 
 void Framebuffer::Bind()
 {
 	glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
-	glViewport(0, 0, width, height);
+	glViewport(0, 0, specification.width, specification.height);
 }
 
 void Framebuffer::Unbind()
@@ -3,6 +3,8 @@
 #include "platform.h"
 #include <vector>
 
+class RenderTargetPool;
+
 enum class FramebufferTextureFormat
 {
 	NONE = 0,
@@ -15,7 +17,32 @@ enum class FramebufferTextureFormat
 	RED_INTEGER = 3,
 
 	// Depth / Stencil
-	DEPTH24_STENCIL8 = 4
+	DEPTH24_STENCIL8 = 4,
+
+	// Color (sRGB encoded on write, decoded on read)
+	SRGBA8 = 5,
+
+	// Two signed normalized channels (e.g. octahedral normals)
+	RG16_SNORM = 6,
+
+	// Full precision color
+	RGBA32F = 7,
+
+	// Depth
+	DEPTH24 = 8,
+
+	// Packed float color without alpha (HDR at 4 bytes per pixel)
+	R11F_G11F_B10F = 9,
+
+	// Single channel
+	R8 = 10,
+	R16F = 11,
+
+	// Two half float channels (e.g. screen space velocity)
+	RG16F = 12,
+
+	// Single unsigned integer channel (e.g. visibility buffer IDs)
+	R32UI = 13
 };
 
 struct FramebufferTextureSpecification
@@ -44,14 +71,31 @@ struct FramebufferSpecification
 	FramebufferAttachmentSpecification attachments;
 };
 
+namespace Utils
+{
+	bool IsDepthFormat(FramebufferTextureFormat format);
+	void GetGLFormat(FramebufferTextureFormat format, GLenum& internalFormat, GLenum& dataFormat, GLenum& dataType);
+	u32 GetBytesPerPixel(FramebufferTextureFormat format);
+
+	// Uploads log spaced values between minValue and maxValue, reads them back and
+	// returns the largest relative error of any channel. Only for float formats.
+	f32 MeasureFormatPrecision(FramebufferTextureFormat format, f32 minValue, f32 maxValue);
+}
+
 class Framebuffer
 {
 public:
-	Framebuffer(u32 numColorAttachments, int w, int h);
+	// numColorAttachments RGBA16F attachments plus a depth attachment
+	Framebuffer(u32 numColorAttachments, int w, int h, RenderTargetPool* pool);
+	Framebuffer(const FramebufferSpecification& spec, RenderTargetPool* pool);
 	~Framebuffer();
 
-	void Init(u32 numColorAttachments);
+	void Init();
+
+	// Only reallocates when the new size doesn't fit in the current textures,
+	// otherwise the framebuffer renders to a smaller sub-rect of them
 	void Resize(int w, int h);
+	bool Fits(int w, int h);
 
 	void Bind();
 	void Unbind();
@@ -62,13 +106,29 @@ public:
 	void BindDepthTexture();
 
 	u32 GetColorAttachment(u32 slot = 0) { return colorAttachments[slot]; }
+	u32 GetDepthAttachment() { return depthAttachment; }
+
+	const FramebufferSpecification& GetSpecification() { return specification; }
+	ivec2 GetSize() { return ivec2(specification.width, specification.height); }
+	ivec2 GetAllocatedSize() { return allocatedSize; }
+
+	// Maps [0, 1] screen coordinates to the rendered sub-rect of the textures
+	vec2 GetUVScale() { return vec2(specification.width, specification.height) / vec2(allocatedSize); }
 
 private:
+	// Takes the attachment textures from the pool / gives them back
+	void AcquireTargets();
+	void ReleaseTargets();
+
 	u32 framebufferID;
+	RenderTargetPool* pool;
+	ivec2 allocatedSize;
+	bool acquired;
+
+	FramebufferSpecification specification;
+	std::vector<FramebufferTextureSpecification> colorAttachmentSpecs;
+	FramebufferTextureSpecification depthAttachmentSpec;
 
 	std::vector<u32> colorAttachments;
 	u32 depthAttachment;
-
-	int width;
-	int height;
 };
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "GpuProfiler.h"
+
+#include <glad/glad.h>
+
+GpuProfiler::~GpuProfiler()
+{
+	for (FrameQueries& frame : frames)
+	{
+		if (!frame.queries.empty())
+			glDeleteQueries(frame.queries.size(), frame.queries.data());
+	}
+}
+
+void GpuProfiler::BeginFrame()
+{
+	FrameQueries& frame = frames[currentFrame % GPU_PROFILER_FRAME_LATENCY];
+
+	newResults = false;
+	if (frame.pending)
+		Resolve(frame);
+
+	frame.count = 0;
+	frame.names.clear();
+	Mark(nullptr);
+}
+
+void GpuProfiler::Mark(const char* name)
+{
+	FrameQueries& frame = frames[currentFrame % GPU_PROFILER_FRAME_LATENCY];
+
+	if (frame.count == frame.queries.size())
+	{
+		u32 query;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+
+	glQueryCounter(frame.queries[frame.count++], GL_TIMESTAMP);
+	frame.names.push_back(name);
+}
+
+void GpuProfiler::EndFrame()
+{
+	frames[currentFrame % GPU_PROFILER_FRAME_LATENCY].pending = true;
+	++currentFrame;
+}
+
+void GpuProfiler::Resolve(FrameQueries& frame)
+{
+	frame.pending = false;
+
+	// The last query finishes last, if even that one is ready all of them are
+	GLint available = 0;
+	glGetQueryObjectiv(frame.queries[frame.count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	std::vector<GLuint64> timestamps(frame.count);
+	for (u32 i = 0; i < frame.count; ++i)
+		glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+	timings.clear();
+	for (u32 i = 1; i < frame.count; ++i)
+	{
+		GpuTiming timing;
+		timing.name = frame.names[i];
+		timing.milliseconds = (timestamps[i] - timestamps[i - 1]) / 1000000.0f;
+		timings.push_back(timing);
+	}
+
+	frameMilliseconds = (timestamps[frame.count - 1] - timestamps[0]) / 1000000.0f;
+	newResults = true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "platform.h"
+#include <vector>
+
+// Frames of queries in flight. Results are read this many frames later, when
+// the GPU has surely finished them, so reading never stalls the pipeline.
+#define GPU_PROFILER_FRAME_LATENCY 4
+
+struct GpuTiming
+{
+	const char* name;
+	f32 milliseconds;
+};
+
+// GPU time of the sections of a frame, measured with timestamp queries. Each
+// Mark ends the section that started at the previous one (or at BeginFrame).
+class GpuProfiler
+{
+public:
+	GpuProfiler() = default;
+	~GpuProfiler();
+
+	// Reads the oldest frame in flight and starts measuring a new one
+	void BeginFrame();
+	void Mark(const char* name);
+	void EndFrame();
+
+	// Timings of the last frame that was read, names must outlive it (string literals)
+	const std::vector<GpuTiming>& GetTimings() { return timings; }
+	f32 GetFrameMilliseconds() { return frameMilliseconds; }
+
+	// True when the last BeginFrame read a new frame
+	bool HasNewResults() { return newResults; }
+
+private:
+	struct FrameQueries
+	{
+		std::vector<u32> queries; // grows to the most marks a frame has needed
+		std::vector<const char*> names;
+		u32 count = 0;
+		bool pending = false;
+	};
+
+	void Resolve(FrameQueries& frame);
+
+	FrameQueries frames[GPU_PROFILER_FRAME_LATENCY];
+	u32 currentFrame = 0;
+
+	std::vector<GpuTiming> timings;
+	f32 frameMilliseconds = 0.0f;
+	bool newResults = false;
+};
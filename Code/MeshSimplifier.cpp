@@ -0,0 +1,268 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <numeric>
+
+// Collapses keep the normals of both ends within ~60 degrees
+#define SIMPLIFY_NORMAL_DOT_THRESHOLD 0.5f
+
+// Collapses can't turn a remaining triangle by more than ~75 degrees, small folds add up over the levels
+#define SIMPLIFY_FLIP_DOT_THRESHOLD 0.25f
+
+// A level has to remove at least this fraction of what it was asked to, otherwise it's the last one
+#define SIMPLIFY_MIN_PROGRESS 0.5f
+
+namespace
+{
+	// Area weighted sum of the squared distance to triangle planes, a symmetric 4x4 matrix
+	struct Quadric
+	{
+		f64 a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+		f64 weight;
+	};
+
+	void AddPlane(Quadric& q, vec3 normal, f32 d, f32 weight)
+	{
+		q.a2 += weight * normal.x * normal.x;
+		q.ab += weight * normal.x * normal.y;
+		q.ac += weight * normal.x * normal.z;
+		q.ad += weight * normal.x * d;
+		q.b2 += weight * normal.y * normal.y;
+		q.bc += weight * normal.y * normal.z;
+		q.bd += weight * normal.y * d;
+		q.c2 += weight * normal.z * normal.z;
+		q.cd += weight * normal.z * d;
+		q.d2 += weight * d * d;
+		q.weight += weight;
+	}
+
+	void AddQuadric(Quadric& q, const Quadric& other)
+	{
+		q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+		q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+		q.c2 += other.c2; q.cd += other.cd;
+		q.d2 += other.d2;
+		q.weight += other.weight;
+	}
+
+	// Mean squared distance of p to the planes
+	f32 Evaluate(const Quadric& q, vec3 p)
+	{
+		const f64 x = p.x, y = p.y, z = p.z;
+		const f64 error = q.a2 * x * x + 2.0 * q.ab * x * y + 2.0 * q.ac * x * z + 2.0 * q.ad * x
+			+ q.b2 * y * y + 2.0 * q.bc * y * z + 2.0 * q.bd * y
+			+ q.c2 * z * z + 2.0 * q.cd * z
+			+ q.d2;
+		return (f32)(glm::max(error, 0.0) / glm::max(q.weight, 1e-12));
+	}
+
+	struct Collapse
+	{
+		u32 from;
+		u32 to;
+		f32 error;
+	};
+
+	u64 EdgeKey(u32 a, u32 b)
+	{
+		return a < b ? ((u64)a << 32) | b : ((u64)b << 32) | a;
+	}
+}
+
+std::vector<SimplifiedLevel> SimplifyMesh(const std::vector<float>& vertices, u32 floatStride, const std::vector<u32>& indices, u32 levelCount, f32 reduction)
+{
+	std::vector<SimplifiedLevel> levels;
+
+	const u32 vertexCount = vertices.size() / floatStride;
+	auto position = [&](u32 v) { return vec3(vertices[v * floatStride], vertices[v * floatStride + 1], vertices[v * floatStride + 2]); };
+	auto normal = [&](u32 v) { return vec3(vertices[v * floatStride + 3], vertices[v * floatStride + 4], vertices[v * floatStride + 5]); };
+
+	// Vertices sharing a position with another one are on a seam, the first of each group stands for the position
+	std::vector<u32> sorted(vertexCount);
+	std::iota(sorted.begin(), sorted.end(), 0);
+	auto positionLess = [&](u32 a, u32 b) {
+		const vec3 pa = position(a), pb = position(b);
+		return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+	};
+	std::sort(sorted.begin(), sorted.end(), positionLess);
+
+	std::vector<u32> positionVertex(vertexCount);
+	std::vector<bool> locked(vertexCount, false);
+	for (u32 begin = 0; begin < vertexCount;)
+	{
+		u32 end = begin + 1;
+		while (end < vertexCount && position(sorted[end]) == position(sorted[begin]))
+			++end;
+		for (u32 i = begin; i < end; ++i)
+		{
+			positionVertex[sorted[i]] = sorted[begin];
+			locked[sorted[i]] = end - begin > 1;
+		}
+		begin = end;
+	}
+
+	// Edges used by a single triangle are open borders, counted by position so seams don't look open
+	std::vector<u64> edges;
+	edges.reserve(indices.size());
+	for (u32 i = 0; i + 2 < indices.size(); i += 3)
+	{
+		for (u32 e = 0; e < 3; ++e)
+			edges.push_back(EdgeKey(positionVertex[indices[i + e]], positionVertex[indices[i + (e + 1) % 3]]));
+	}
+	std::sort(edges.begin(), edges.end());
+	for (u32 begin = 0; begin < edges.size();)
+	{
+		u32 end = begin + 1;
+		while (end < edges.size() && edges[end] == edges[begin])
+			++end;
+		if (end - begin == 1)
+		{
+			locked[edges[begin] >> 32] = true;
+			locked[edges[begin] & 0xFFFFFFFFu] = true;
+		}
+		begin = end;
+	}
+	for (u32 v = 0; v < vertexCount; ++v)
+	{
+		if (locked[positionVertex[v]])
+			locked[v] = true;
+	}
+
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (u32 i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const vec3 p0 = position(indices[i]), p1 = position(indices[i + 1]), p2 = position(indices[i + 2]);
+		const vec3 cross = glm::cross(p1 - p0, p2 - p0);
+		const f32 length = glm::length(cross);
+		if (length <= 0.0f)
+			continue;
+
+		const vec3 planeNormal = cross / length;
+		const f32 d = -glm::dot(planeNormal, p0);
+		for (u32 k = 0; k < 3; ++k)
+			AddPlane(quadrics[indices[i + k]], planeNormal, d, length * 0.5f);
+	}
+
+	std::vector<u32> result = indices;
+	f32 maxError = 0.0f;
+
+	std::vector<u32> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<u32> triangleOffsets(vertexCount + 1);
+	std::vector<u32> vertexTriangles;
+
+	for (u32 level = 0; level < levelCount; ++level)
+	{
+		const u32 startIndexCount = result.size();
+		const u32 targetIndexCount = (u32)(startIndexCount / 3 * reduction) * 3;
+
+		// Passes of independent collapses, cheapest first, until the target is reached or nothing can go
+		while (result.size() > targetIndexCount)
+		{
+			std::vector<Collapse> collapses;
+			collapses.reserve(result.size() * 2);
+			for (u32 i = 0; i < result.size(); i += 3)
+			{
+				for (u32 e = 0; e < 3; ++e)
+				{
+					const u32 a = result[i + e], b = result[i + (e + 1) % 3];
+					if (glm::dot(normal(a), normal(b)) < SIMPLIFY_NORMAL_DOT_THRESHOLD)
+						continue;
+
+					Quadric q = quadrics[a];
+					AddQuadric(q, quadrics[b]);
+					if (!locked[a])
+						collapses.push_back({ a, b, Evaluate(q, position(b)) });
+					if (!locked[b])
+						collapses.push_back({ b, a, Evaluate(q, position(a)) });
+				}
+			}
+			if (collapses.empty())
+				break;
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+			// Triangles around each vertex
+			std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+			for (u32 index : result)
+				++triangleOffsets[index + 1];
+			for (u32 v = 0; v < vertexCount; ++v)
+				triangleOffsets[v + 1] += triangleOffsets[v];
+			vertexTriangles.resize(result.size());
+			std::vector<u32> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+			for (u32 i = 0; i < result.size(); ++i)
+				vertexTriangles[fill[result[i]]++] = i / 3;
+
+			std::iota(remap.begin(), remap.end(), 0);
+			std::fill(touched.begin(), touched.end(), false);
+
+			u32 removedIndices = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (result.size() - removedIndices <= targetIndexCount)
+					break;
+				if (touched[collapse.from] || touched[collapse.to])
+					continue;
+
+				// Moving the vertex can't flip (or nearly flip) any of the triangles it keeps
+				bool flips = false;
+				u32 sharedTriangles = 0;
+				for (u32 t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1] && !flips; ++t)
+				{
+					const u32* triangle = &result[vertexTriangles[t] * 3];
+					if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+					{
+						++sharedTriangles;
+						continue;
+					}
+
+					vec3 p[3], moved[3];
+					for (u32 k = 0; k < 3; ++k)
+					{
+						p[k] = position(triangle[k]);
+						moved[k] = triangle[k] == collapse.from ? position(collapse.to) : p[k];
+					}
+					const vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+					const vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+					flips = glm::dot(before, after) <= SIMPLIFY_FLIP_DOT_THRESHOLD * glm::length(before) * glm::length(after);
+				}
+				if (flips)
+					continue;
+
+				// The triangles around it change, their vertices wait for the next pass
+				for (u32 t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1]; ++t)
+				{
+					const u32* triangle = &result[vertexTriangles[t] * 3];
+					touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+				}
+
+				remap[collapse.from] = collapse.to;
+				AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+				maxError = glm::max(maxError, collapse.error);
+				removedIndices += sharedTriangles * 3;
+			}
+			if (removedIndices == 0)
+				break;
+
+			std::vector<u32> collapsed;
+			collapsed.reserve(result.size() - removedIndices);
+			for (u32 i = 0; i < result.size(); i += 3)
+			{
+				const u32 a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+				if (a != b && b != c && a != c)
+				{
+					collapsed.push_back(a);
+					collapsed.push_back(b);
+					collapsed.push_back(c);
+				}
+			}
+			result.swap(collapsed);
+		}
+
+		if (startIndexCount - result.size() < (startIndexCount - targetIndexCount) * SIMPLIFY_MIN_PROGRESS)
+			break;
+
+		levels.push_back({ result, glm::sqrt(maxError) });
+	}
+
+	return levels;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "platform.h"
+#include <vector>
+
+// Quadric error metric simplification (Garland & Heckbert) by half-edge collapses, so every level
+// reuses the vertices of the original mesh and only needs its own indices.
+//
+// Vertices duplicated at UV seams or normal splits, and the ones on open borders, never move. Edges
+// between vertices whose normals diverge aren't collapsed either, which keeps the creases shaded.
+struct SimplifiedLevel
+{
+	std::vector<u32> indices;
+	f32 error; // largest mean distance to the planes of the merged triangles, in mesh units
+};
+
+// Levels with about reduction times the triangles of the previous one. Stops early when a level
+// can't get close to its target, so fewer than levelCount can come back.
+std::vector<SimplifiedLevel> SimplifyMesh(const std::vector<float>& vertices, u32 floatStride, const std::vector<u32>& indices, u32 levelCount, f32 reduction);
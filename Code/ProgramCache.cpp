@@ -0,0 +1,165 @@
+#include "ProgramCache.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include <glad/glad.h>
+#include <chrono>
+
+#define PROGRAM_CACHE_MAGIC 0x42475250 // "PRGB"
+#define PROGRAM_CACHE_FILE_VERSION 1
+
+struct ProgramCacheHeader
+{
+	u32 magic;
+	u32 fileVersion;
+	u64 key;
+	u32 binaryFormat;
+	u32 binaryLength;
+	f32 compileMilliseconds;
+};
+
+namespace
+{
+	// FNV-1a
+	u64 HashBytes(const void* data, u64 size, u64 hash = 14695981039346656037ull)
+	{
+		const u8* bytes = (const u8*)data;
+		for (u64 i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	f32 MillisecondsSince(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<f32, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+}
+
+ProgramCache::ProgramCache(const char* directory, const std::string& renderer, const std::string& version)
+	: directory(directory), hits(0), misses(0), millisecondsSaved(0.0f)
+{
+	driverHash = HashBytes(renderer.data(), renderer.size());
+	driverHash = HashBytes(version.data(), version.size(), driverHash);
+
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	enabled = formatCount > 0;
+	if (!enabled)
+	{
+		ILOG("Program cache disabled, the driver doesn't support program binaries");
+		return;
+	}
+
+#ifdef _WIN32
+	_mkdir(directory);
+#else
+	mkdir(directory, 0755);
+#endif
+}
+
+u64 ProgramCache::ComputeKey(const std::string& compilerInput)
+{
+	return HashBytes(compilerInput.data(), compilerInput.size(), driverHash);
+}
+
+std::string ProgramCache::GetEntryPath(u64 key)
+{
+	char filename[32];
+	sprintf(filename, "%016llx.bin", (unsigned long long)key);
+	return directory + "/" + filename;
+}
+
+u32 ProgramCache::Load(u64 key, bool separable)
+{
+	if (!enabled)
+		return 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	FILE* file = fopen(GetEntryPath(key).c_str(), "rb");
+	if (!file)
+	{
+		++misses;
+		return 0;
+	}
+
+	ProgramCacheHeader header = {};
+	std::string binary;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic == PROGRAM_CACHE_MAGIC && header.fileVersion == PROGRAM_CACHE_FILE_VERSION && header.key == key;
+	if (valid)
+	{
+		binary.resize(header.binaryLength);
+		valid = fread(&binary[0], 1, header.binaryLength, file) == header.binaryLength;
+	}
+	fclose(file);
+
+	if (!valid)
+	{
+		++misses;
+		return 0;
+	}
+
+	// The driver rejects binaries from another version or configuration, recompile in that case
+	GLuint programHandle = glCreateProgram();
+	glProgramParameteri(programHandle, GL_PROGRAM_SEPARABLE, separable ? GL_TRUE : GL_FALSE);
+	glProgramBinary(programHandle, header.binaryFormat, binary.data(), header.binaryLength);
+
+	GLint success = GL_FALSE;
+	glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glDeleteProgram(programHandle);
+		++misses;
+		return 0;
+	}
+
+	++hits;
+	millisecondsSaved += header.compileMilliseconds - MillisecondsSince(start);
+	return programHandle;
+}
+
+void ProgramCache::Store(u64 key, u32 programHandle, f32 compileMilliseconds)
+{
+	if (!enabled)
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(programHandle, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::string binary;
+	binary.resize(length);
+
+	GLenum binaryFormat = 0;
+	GLsizei writtenLength = 0;
+	glGetProgramBinary(programHandle, length, &writtenLength, &binaryFormat, &binary[0]);
+
+	ProgramCacheHeader header = {};
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.fileVersion = PROGRAM_CACHE_FILE_VERSION;
+	header.key = key;
+	header.binaryFormat = binaryFormat;
+	header.binaryLength = writtenLength;
+	header.compileMilliseconds = compileMilliseconds;
+
+	FILE* file = fopen(GetEntryPath(key).c_str(), "wb");
+	if (!file)
+	{
+		ELOG("Couldn't write program cache entry %s", GetEntryPath(key).c_str());
+		return;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(binary.data(), 1, writtenLength, file);
+	fclose(file);
+}
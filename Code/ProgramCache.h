@@ -0,0 +1,40 @@
+#pragma once
+
+#include "platform.h"
+#include <string>
+
+#define PROGRAM_CACHE_DIRECTORY "ProgramCache"
+
+// Linked program binaries saved to disk so the next launch can skip compiling.
+// Entries are keyed by a hash of everything the compiler sees (version, defines
+// and source) plus the GL_RENDERER and GL_VERSION strings, so a driver update
+// or a different GPU just misses. A binary the driver refuses is recompiled.
+class ProgramCache
+{
+public:
+	ProgramCache(const char* directory, const std::string& renderer, const std::string& version);
+
+	u64 ComputeKey(const std::string& compilerInput);
+
+	// Returns 0 on a miss
+	u32 Load(u64 key, bool separable);
+	void Store(u64 key, u32 programHandle, f32 compileMilliseconds);
+
+	bool IsEnabled() { return enabled; }
+	u32 GetHits() { return hits; }
+	u32 GetMisses() { return misses; }
+
+	// Compile time of the cached programs minus the time it took to load them
+	f32 GetMillisecondsSaved() { return millisecondsSaved; }
+
+private:
+	std::string GetEntryPath(u64 key);
+
+	std::string directory;
+	u64 driverHash;
+	bool enabled;
+
+	u32 hits;
+	u32 misses;
+	f32 millisecondsSaved;
+};
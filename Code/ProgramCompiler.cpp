@@ -0,0 +1,251 @@
+#include "ProgramCompiler.h"
+
+#include <glad/glad.h>
+
+namespace
+{
+	const char* GetStageName(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_VERTEX_SHADER: return "VERTEX";
+		case GL_GEOMETRY_SHADER: return "GEOMETRY";
+		case GL_FRAGMENT_SHADER: return "FRAGMENT";
+		case GL_COMPUTE_SHADER: return "COMPUTE";
+		default: return "UNKNOWN";
+		}
+	}
+
+	GLuint StartShaderCompile(GLenum type, const ProgramCompileJob& job)
+	{
+		// Separable programs have to redeclare the built-in outputs they use
+		const char* perVertex = job.stage == GL_VERTEX_SHADER ? "out gl_PerVertex { vec4 gl_Position; };\n" : "";
+
+		char versionString[] = GLSL_VERSION_STRING;
+		char shaderNameDefine[128];
+		sprintf(shaderNameDefine, "#define %s\n", job.programName.c_str());
+		char stageDefine[32];
+		sprintf(stageDefine, "#define %s\n", GetStageName(type));
+
+		const GLchar* shaderSource[] = {
+			versionString,
+			shaderNameDefine,
+			stageDefine,
+			job.featureDefines.c_str(),
+			perVertex,
+			job.source.c_str()
+		};
+		const GLint shaderLengths[] = {
+			(GLint)strlen(versionString),
+			(GLint)strlen(shaderNameDefine),
+			(GLint)strlen(stageDefine),
+			(GLint)job.featureDefines.size(),
+			(GLint)strlen(perVertex),
+			(GLint)job.source.size()
+		};
+
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, ARRAY_COUNT(shaderSource), shaderSource, shaderLengths);
+		glCompileShader(shader);
+		return shader;
+	}
+}
+
+void StartProgramCompile(ProgramCompileJob& job)
+{
+	job.shaderCount = 0;
+	if (job.stage)
+	{
+		job.shaders[job.shaderCount++] = StartShaderCompile(job.stage, job);
+	}
+	else if (job.source.find("defined(COMPUTE)") != std::string::npos)
+	{
+		// Compute programs have that single stage
+		job.shaders[job.shaderCount++] = StartShaderCompile(GL_COMPUTE_SHADER, job);
+	}
+	else
+	{
+		job.shaders[job.shaderCount++] = StartShaderCompile(GL_VERTEX_SHADER, job);
+
+		// The geometry stage is optional, only programs that declare it get one
+		if (job.source.find("defined(GEOMETRY)") != std::string::npos)
+			job.shaders[job.shaderCount++] = StartShaderCompile(GL_GEOMETRY_SHADER, job);
+
+		job.shaders[job.shaderCount++] = StartShaderCompile(GL_FRAGMENT_SHADER, job);
+	}
+
+	job.programHandle = glCreateProgram();
+	for (u32 i = 0; i < job.shaderCount; ++i)
+		glAttachShader(job.programHandle, job.shaders[i]);
+	glProgramParameteri(job.programHandle, GL_PROGRAM_SEPARABLE, job.stage ? GL_TRUE : GL_FALSE);
+	glProgramParameteri(job.programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(job.programHandle);
+}
+
+bool FinishProgramCompile(ProgramCompileJob& job)
+{
+	GLchar  infoLogBuffer[1024] = {};
+	GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+	GLsizei infoLogSize;
+	GLint   success;
+
+	glGetProgramiv(job.programHandle, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		for (u32 i = 0; i < job.shaderCount; ++i)
+		{
+			GLint compiled;
+			glGetShaderiv(job.shaders[i], GL_COMPILE_STATUS, &compiled);
+			if (compiled)
+				continue;
+
+			GLint type;
+			glGetShaderiv(job.shaders[i], GL_SHADER_TYPE, &type);
+			glGetShaderInfoLog(job.shaders[i], infoLogBufferSize, &infoLogSize, infoLogBuffer);
+			ELOG("glCompileShader() failed with %s shader %s\nReported message:\n%s\n", GetStageName(type), job.programName.c_str(), infoLogBuffer);
+		}
+
+		glGetProgramInfoLog(job.programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+		ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", job.programName.c_str(), infoLogBuffer);
+	}
+
+	for (u32 i = 0; i < job.shaderCount; ++i)
+	{
+		glDetachShader(job.programHandle, job.shaders[i]);
+		glDeleteShader(job.shaders[i]);
+	}
+	job.shaderCount = 0;
+
+	return success == GL_TRUE;
+}
+
+ProgramCompiler::ProgramCompiler(bool parallelCompileExtension) : workerBusy(0), stopWorker(false)
+{
+	if (parallelCompileExtension)
+	{
+		mode = Mode::PARALLEL_EXTENSION;
+	}
+	else if (IsSharedContextAvailable())
+	{
+		mode = Mode::WORKER_THREAD;
+		worker = std::thread(&ProgramCompiler::WorkerLoop, this);
+	}
+	else
+	{
+		mode = Mode::SYNCHRONOUS;
+	}
+}
+
+ProgramCompiler::~ProgramCompiler()
+{
+	if (!worker.joinable())
+		return;
+
+	// The worker finishes the job it's on, whatever is still queued is dropped
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopWorker = true;
+		wakeUp.notify_one();
+	}
+	worker.join();
+}
+
+void ProgramCompiler::Submit(ProgramCompileJob job)
+{
+	job.submitTime = std::chrono::high_resolution_clock::now();
+
+	if (mode == Mode::WORKER_THREAD)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(std::move(job));
+		wakeUp.notify_one();
+		return;
+	}
+
+	// With the extension the driver returns right away, otherwise this is where the time goes
+	StartProgramCompile(job);
+	inFlight.push_back(std::move(job));
+}
+
+std::vector<ProgramCompileJob> ProgramCompiler::Poll()
+{
+	std::vector<ProgramCompileJob> done;
+
+	if (mode == Mode::WORKER_THREAD)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		done.swap(finished);
+		return done;
+	}
+
+	for (u32 i = 0; i < inFlight.size();)
+	{
+		GLint completed = GL_TRUE;
+		if (mode == Mode::PARALLEL_EXTENSION)
+			glGetProgramiv(inFlight[i].programHandle, GL_COMPLETION_STATUS_KHR, &completed);
+
+		if (completed)
+		{
+			done.push_back(std::move(inFlight[i]));
+			inFlight.erase(inFlight.begin() + i);
+		}
+		else
+		{
+			++i;
+		}
+	}
+	return done;
+}
+
+u32 ProgramCompiler::GetPendingCount()
+{
+	if (mode == Mode::WORKER_THREAD)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return queue.size() + workerBusy;
+	}
+	return inFlight.size();
+}
+
+const char* ProgramCompiler::GetModeName()
+{
+	switch (mode)
+	{
+	case Mode::PARALLEL_EXTENSION: return "parallel shader compile extension";
+	case Mode::WORKER_THREAD: return "worker thread";
+	default: return "synchronous";
+	}
+}
+
+void ProgramCompiler::WorkerLoop()
+{
+	MakeSharedContextCurrent();
+
+	while (true)
+	{
+		ProgramCompileJob job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [this]() { return stopWorker || !queue.empty(); });
+			if (stopWorker)
+				break;
+			job = std::move(queue.front());
+			queue.pop_front();
+			workerBusy = 1;
+		}
+
+		StartProgramCompile(job);
+
+		// Waits for the link here instead of on the main thread, and makes sure
+		// the program is complete before the main context gets to use it
+		GLint linked;
+		glGetProgramiv(job.programHandle, GL_LINK_STATUS, &linked);
+		glFinish();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		finished.push_back(std::move(job));
+		workerBusy = 0;
+	}
+
+	ReleaseCurrentContext();
+}
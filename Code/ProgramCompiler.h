@@ -0,0 +1,77 @@
+#pragma once
+
+#include "platform.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#define GLSL_VERSION_STRING "#version 430\n"
+
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile, not in the glad profile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+struct ProgramCompileJob
+{
+	u32 programIdx = 0;        // the Program the result goes to
+	std::string programName;   // name define
+	std::string source;
+	std::string featureDefines;
+	GLenum stage = 0;          // 0 links the whole program, otherwise just this stage as a separable program
+	u64 cacheKey = 0;
+	std::chrono::high_resolution_clock::time_point submitTime;
+
+	// Filled by StartProgramCompile
+	u32 programHandle = 0;
+	u32 shaders[3] = {};
+	u32 shaderCount = 0;
+};
+
+// Compiles programs without making the frame loop wait for the compiler.
+// With GL_KHR_parallel_shader_compile the driver compiles in its own threads
+// and completion is polled with GL_COMPLETION_STATUS_KHR. Without it a worker
+// thread compiles on a hidden context that shares objects with the main one.
+// If the platform couldn't make that context, compiles run at submit time.
+class ProgramCompiler
+{
+public:
+	ProgramCompiler(bool parallelCompileExtension);
+	// Stops and joins the worker, has to run while the shared context is still alive
+	~ProgramCompiler();
+
+	void Submit(ProgramCompileJob job);
+
+	// Jobs whose program finished linking since the last call, successfully or not
+	std::vector<ProgramCompileJob> Poll();
+
+	u32 GetPendingCount();
+	const char* GetModeName();
+
+private:
+	enum class Mode { PARALLEL_EXTENSION, WORKER_THREAD, SYNCHRONOUS };
+
+	void WorkerLoop();
+
+	Mode mode;
+	std::vector<ProgramCompileJob> inFlight;
+
+	// Worker thread mode
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::deque<ProgramCompileJob> queue;
+	std::vector<ProgramCompileJob> finished;
+	u32 workerBusy;
+	bool stopWorker;
+};
+
+// Issues the compiles and the link without asking for any status, so the call doesn't wait on the driver
+void StartProgramCompile(ProgramCompileJob& job);
+
+// Checks the link, logs the errors and deletes the shaders. Returns true if the program linked.
+bool FinishProgramCompile(ProgramCompileJob& job);
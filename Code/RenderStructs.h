@@ -36,17 +36,60 @@ struct Model
 {
 	u32 meshIdx;
 	std::vector<u32> materialIdx;
+
+	// For hot reloading, the materials of the file are contiguous
+	std::string filepath;
+	u32 baseMaterialIdx;
+	u32 materialCount;
+};
+
+// Meshlet limits, the triangles fit one culling workgroup
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// Cluster of contiguous triangles of a submesh, laid out as its std430 copy in the meshlet buffer
+struct Meshlet
+{
+	vec3 center;     // bounding sphere
+	f32 radius;
+	vec3 coneAxis;   // average triangle normal
+	f32 coneCutoff;  // sine of the normal cone angle, 1 when the cluster can't be back-face culled
+	u32 firstIndex;  // in the submesh indices
+	u32 indexCount;
+	u32 padding[2];
+};
+
+// Levels of detail generated at import, the full detail one included. Each simplified level
+// aims for MESH_LOD_REDUCTION times the triangles of the previous one.
+#define MESH_LOD_MAX_LEVELS 5
+#define MESH_LOD_REDUCTION 0.5f
+
+// Level of detail of a submesh, a range of its indices and of its meshlets
+struct SubmeshLod
+{
+	u32 firstIndex;   // in the submesh indices
+	u32 indexCount;
+	u32 firstMeshlet; // in the submesh meshlets
+	u32 meshletCount;
+	f32 error;        // of the simplification, in mesh units
 };
 
 struct Submesh
 {
 	VertexBufferLayout vertexBufferLayout;
 	std::vector<float> vertices;
-	std::vector<u32> indices;
+	std::vector<u32> indices; // every level of detail one after the other
+	std::vector<SubmeshLod> lods; // lods[0] is the imported mesh
 	u32 vertexOffset;
 	u32 indexOffset;
+	u32 positionOffset; // in the position only stream
+	u32 visibilityFirstIndex; // in the scene wide index buffer the visibility resolve reads
+
+	std::vector<Meshlet> meshlets;
+	u32 meshletOffset; // in the mesh's meshlet buffer
 
 	std::vector<VertexArray> vaos;
+	u32 positionVao; // reads only the position stream, for the depth pre-pass
 };
 
 struct Mesh
@@ -54,6 +97,15 @@ struct Mesh
 	std::vector<Submesh> submeshes;
 	u32 vertexBufferHandle;
 	u32 indexBufferHandle;
+	u32 positionBufferHandle; // tightly packed positions, a third of the bandwidth of the interleaved vertices
+	u32 meshletBufferHandle;  // the meshlets of every submesh
+
+	// Bounding sphere in model space
+	vec3 boundsCenter;
+	f32 boundsRadius;
+
+	// Simplification error of each level of detail, the largest of the submeshes relative to boundsRadius
+	std::vector<f32> lodErrors;
 };
 
 struct Material
@@ -0,0 +1,116 @@
+#include "RenderTargetPool.h"
+
+#include <glad/glad.h>
+
+namespace
+{
+	int NextPowerOfTwo(int value)
+	{
+		int result = 16;
+		while (result < value)
+			result <<= 1;
+		return result;
+	}
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+	for (PooledRenderTarget& target : targets)
+	{
+		glDeleteTextures(1, &target.handle);
+	}
+}
+
+ivec2 RenderTargetPool::GetSizeClass(int w, int h)
+{
+	return ivec2(NextPowerOfTwo(w), NextPowerOfTwo(h));
+}
+
+u32 RenderTargetPool::Acquire(FramebufferTextureFormat format, int w, int h, ivec2& allocatedSize)
+{
+	const ivec2 sizeClass = GetSizeClass(w, h);
+
+	// Only the exact size class, a bigger texture would give this target another uv scale
+	// than the ones it gets sampled with (all the attachments of a framebuffer share one)
+	PooledRenderTarget* best = nullptr;
+	for (PooledRenderTarget& target : targets)
+	{
+		if (!target.inUse && target.format == format && target.size == sizeClass)
+		{
+			best = &target;
+			break;
+		}
+	}
+
+	if (!best)
+	{
+		GLenum internalFormat, dataFormat, dataType;
+		Utils::GetGLFormat(format, internalFormat, dataFormat, dataType);
+
+		PooledRenderTarget target;
+		target.format = format;
+		target.size = sizeClass;
+
+		glGenTextures(1, &target.handle);
+		glBindTexture(GL_TEXTURE_2D, target.handle);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, sizeClass.x, sizeClass.y, 0, dataFormat, dataType, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		targets.push_back(target);
+		best = &targets.back();
+		++allocationCount;
+	}
+
+	best->inUse = true;
+	best->lastUsedFrame = currentFrame;
+	allocatedSize = best->size;
+	return best->handle;
+}
+
+void RenderTargetPool::Release(u32 handle)
+{
+	for (PooledRenderTarget& target : targets)
+	{
+		if (target.handle == handle)
+		{
+			target.inUse = false;
+			target.lastUsedFrame = currentFrame;
+			return;
+		}
+	}
+	ELOG("Releasing a texture that doesn't belong to the render target pool");
+}
+
+void RenderTargetPool::BeginFrame(u64 frame)
+{
+	currentFrame = frame;
+
+	for (u32 i = 0; i < targets.size();)
+	{
+		PooledRenderTarget& target = targets[i];
+		if (!target.inUse && currentFrame - target.lastUsedFrame > RENDER_TARGET_POOL_MAX_IDLE_FRAMES)
+		{
+			glDeleteTextures(1, &target.handle);
+			targets.erase(targets.begin() + i);
+			++generation;
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+u64 RenderTargetPool::GetMemoryUsage()
+{
+	u64 bytes = 0;
+	for (PooledRenderTarget& target : targets)
+	{
+		bytes += (u64)target.size.x * target.size.y * Utils::GetBytesPerPixel(target.format);
+	}
+	return bytes;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "platform.h"
+#include "Framebuffer.h"
+#include <vector>
+
+// Frames a free texture is kept around before being deleted
+#define RENDER_TARGET_POOL_MAX_IDLE_FRAMES 240
+
+struct PooledRenderTarget
+{
+	u32 handle = 0;
+	FramebufferTextureFormat format = FramebufferTextureFormat::NONE;
+	ivec2 size;
+
+	bool inUse = false;
+	u64 lastUsedFrame = 0;
+};
+
+// Render target textures shared by all the framebuffers. Textures are keyed by
+// format and size class: sizes are rounded up to the next power of two and a
+// request is served by a free texture of that format and exactly that class, so
+// a target only gets reallocated when it moves to another class and requests of
+// the same size always get the same allocated size. The part actually rendered
+// is a sub-rect in the lower left corner of the texture.
+class RenderTargetPool
+{
+public:
+	RenderTargetPool() = default;
+	~RenderTargetPool();
+
+	// Returns the texture handle, allocatedSize is the full size of the texture
+	u32 Acquire(FramebufferTextureFormat format, int w, int h, ivec2& allocatedSize);
+	void Release(u32 handle);
+
+	// Deletes the textures nobody asked for in a while
+	void BeginFrame(u64 frame);
+
+	static ivec2 GetSizeClass(int w, int h);
+
+	u32 GetTextureCount() { return targets.size(); }
+	u32 GetAllocationCount() { return allocationCount; }
+	u64 GetMemoryUsage();
+
+	// Changes whenever textures are deleted, anything caching handles must drop them
+	u32 GetGeneration() { return generation; }
+
+private:
+	std::vector<PooledRenderTarget> targets;
+	u64 currentFrame = 0;
+	u32 allocationCount = 0;
+	u32 generation = 0;
+};
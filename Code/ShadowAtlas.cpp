@@ -0,0 +1,104 @@
+#include "ShadowAtlas.h"
+
+#include <glad/glad.h>
+
+ShadowAtlas::ShadowAtlas(u32 numSlots, u32 cubeSize) : cubeArrayID(0), size(cubeSize)
+{
+	slots.resize(numSlots);
+
+	glGenTextures(1, &cubeArrayID);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, cubeArrayID);
+	glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 1, GL_DEPTH_COMPONENT16, size, size, numSlots * 6);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+	// Every slot gets a cube map view over its 6 layers, so clearing and
+	// rendering one light never touches the rest of the atlas
+	for (u32 i = 0; i < slots.size(); ++i)
+	{
+		ShadowSlot& slot = slots[i];
+
+		glGenTextures(1, &slot.viewID);
+		glTextureView(slot.viewID, GL_TEXTURE_CUBE_MAP, cubeArrayID, GL_DEPTH_COMPONENT16, 0, 1, i * 6, 6);
+
+		glGenFramebuffers(1, &slot.framebufferID);
+		glBindFramebuffer(GL_FRAMEBUFFER, slot.framebufferID);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, slot.viewID, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			ELOG("Shadow atlas framebuffer not completed");
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowAtlas::~ShadowAtlas()
+{
+	for (u32 i = 0; i < slots.size(); ++i)
+	{
+		glDeleteFramebuffers(1, &slots[i].framebufferID);
+		glDeleteTextures(1, &slots[i].viewID);
+	}
+	glDeleteTextures(1, &cubeArrayID);
+}
+
+u32 ShadowAtlas::AcquireSlot(u32 lightIdx, u32 currentSlot, u64 frame, bool& newlyAssigned)
+{
+	newlyAssigned = false;
+
+	if (currentSlot < slots.size() && slots[currentSlot].lightIdx == lightIdx)
+	{
+		slots[currentSlot].lastUsedFrame = frame;
+		return currentSlot;
+	}
+
+	// Take a free slot or evict the least recently used one that nobody claimed this frame
+	u32 candidate = UINT32_MAX;
+	for (u32 i = 0; i < slots.size(); ++i)
+	{
+		if (slots[i].lightIdx == UINT32_MAX)
+		{
+			candidate = i;
+			break;
+		}
+		if (slots[i].lastUsedFrame < frame && (candidate == UINT32_MAX || slots[i].lastUsedFrame < slots[candidate].lastUsedFrame))
+		{
+			candidate = i;
+		}
+	}
+
+	if (candidate != UINT32_MAX)
+	{
+		slots[candidate].lightIdx = lightIdx;
+		slots[candidate].lastUsedFrame = frame;
+		newlyAssigned = true;
+	}
+
+	return candidate;
+}
+
+void ShadowAtlas::BindSlot(u32 slot)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, slots[slot].framebufferID);
+	glViewport(0, 0, size, size);
+}
+
+void ShadowAtlas::Unbind()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowAtlas::BindTexture(u32 unit)
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, cubeArrayID);
+}
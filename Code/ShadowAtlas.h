@@ -0,0 +1,43 @@
+#pragma once
+
+#include "platform.h"
+#include <vector>
+
+#define SHADOW_ATLAS_SLOTS 12
+#define SHADOW_CUBE_SIZE 512
+
+// Omnidirectional shadow maps for point lights. All the cube maps live in one
+// cube map array and lights are assigned a slot each frame. When there are more
+// shadow casters than slots, the least recently used slot is recycled.
+struct ShadowSlot
+{
+	u32 lightIdx = UINT32_MAX;
+	u64 lastUsedFrame = 0;
+
+	u32 viewID = 0;
+	u32 framebufferID = 0;
+};
+
+class ShadowAtlas
+{
+public:
+	ShadowAtlas(u32 numSlots, u32 cubeSize);
+	~ShadowAtlas();
+
+	// Returns the slot for the light (or UINT32_MAX if every slot is already in use this frame).
+	// newlyAssigned is true when the slot contents belong to another light and must be re-rendered.
+	u32 AcquireSlot(u32 lightIdx, u32 currentSlot, u64 frame, bool& newlyAssigned);
+
+	void BindSlot(u32 slot);
+	void Unbind();
+
+	void BindTexture(u32 unit);
+
+	u32 GetSlotCount() { return slots.size(); }
+	u32 GetCubeSize() { return size; }
+
+private:
+	u32 cubeArrayID;
+	std::vector<ShadowSlot> slots;
+	u32 size;
+};
@@ -1,4 +1,128 @@
 #include "assimp_model_loading.h"
+#include "MeshSimplifier.h"
+
+// Bounding sphere and normal cone of the triangles [firstIndex, firstIndex + indexCount) of the submesh
+Meshlet ComputeMeshletBounds(const Submesh& submesh, u32 firstIndex, u32 indexCount)
+{
+    const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+    auto position = [&](u32 index) {
+        const float* vertex = &submesh.vertices[submesh.indices[index] * floatStride];
+        return vec3(vertex[0], vertex[1], vertex[2]);
+    };
+
+    Meshlet meshlet = {};
+    meshlet.firstIndex = firstIndex;
+    meshlet.indexCount = indexCount;
+
+    vec3 aabbMin = vec3(FLT_MAX);
+    vec3 aabbMax = vec3(-FLT_MAX);
+    for (u32 i = firstIndex; i < firstIndex + indexCount; ++i)
+    {
+        aabbMin = glm::min(aabbMin, position(i));
+        aabbMax = glm::max(aabbMax, position(i));
+    }
+    meshlet.center = (aabbMin + aabbMax) * 0.5f;
+    for (u32 i = firstIndex; i < firstIndex + indexCount; ++i)
+    {
+        meshlet.radius = glm::max(meshlet.radius, glm::length(position(i) - meshlet.center));
+    }
+
+    // Degenerate triangles face nowhere, they don't widen the cone
+    vec3 normals[MESHLET_MAX_TRIANGLES];
+    u32 normalCount = 0;
+    vec3 normalSum = vec3(0.0f);
+    for (u32 i = firstIndex; i + 2 < firstIndex + indexCount; i += 3)
+    {
+        const vec3 normal = glm::cross(position(i + 1) - position(i), position(i + 2) - position(i));
+        const f32 length = glm::length(normal);
+        if (length > 0.0f)
+        {
+            normals[normalCount++] = normal / length;
+            normalSum += normal / length;
+        }
+    }
+
+    meshlet.coneAxis = glm::length(normalSum) > 0.0f ? glm::normalize(normalSum) : vec3(0.0f, 0.0f, 1.0f);
+    f32 minDot = 1.0f;
+    for (u32 i = 0; i < normalCount; ++i)
+    {
+        minDot = glm::min(minDot, glm::dot(meshlet.coneAxis, normals[i]));
+    }
+
+    // The back-facing region is the normal cone widened by 90 degrees and flipped, its cosine is
+    // the sine of the normal cone's angle. Cones wider than ~84 degrees almost never pass, skip them.
+    meshlet.coneCutoff = minDot <= 0.1f ? 1.0f : glm::sqrt(1.0f - minDot * minDot);
+
+    return meshlet;
+}
+
+// Simplified levels appended to the submesh indices, they share its vertices
+void BuildLods(Submesh& submesh)
+{
+    const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+
+    submesh.lods.clear();
+    submesh.lods.push_back(SubmeshLod{ 0, (u32)submesh.indices.size(), 0, 0, 0.0f });
+
+    // Each level is simplified from the previous one, so the errors only grow
+    std::vector<SimplifiedLevel> levels = SimplifyMesh(submesh.vertices, floatStride, submesh.indices, MESH_LOD_MAX_LEVELS - 1, MESH_LOD_REDUCTION);
+    for (const SimplifiedLevel& level : levels)
+    {
+        submesh.lods.push_back(SubmeshLod{ (u32)submesh.indices.size(), (u32)level.indices.size(), 0, 0, level.error });
+        submesh.indices.insert(submesh.indices.end(), level.indices.begin(), level.indices.end());
+    }
+}
+
+// Greedy clusters in the triangle order of every level, which aiProcess_ImproveCacheLocality
+// already keeps local, so the triangles of a meshlet are contiguous in the submesh indices
+void BuildMeshlets(Submesh& submesh)
+{
+    const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+
+    // Last meshlet that used each vertex
+    std::vector<u32> vertexMeshlet(submesh.vertices.size() / floatStride, UINT32_MAX);
+
+    submesh.meshlets.clear();
+    for (SubmeshLod& lod : submesh.lods)
+    {
+        lod.firstMeshlet = submesh.meshlets.size();
+
+        const u32 endTriangle = (lod.firstIndex + lod.indexCount) / 3;
+        u32 firstTriangle = lod.firstIndex / 3;
+        while (firstTriangle < endTriangle)
+        {
+            const u32 meshletIdx = submesh.meshlets.size();
+            u32 vertexCount = 0;
+            u32 triangle = firstTriangle;
+            for (; triangle < endTriangle && triangle - firstTriangle < MESHLET_MAX_TRIANGLES; ++triangle)
+            {
+                const u32* indices = &submesh.indices[triangle * 3];
+                u32 newVertices = 0;
+                for (u32 i = 0; i < 3; ++i)
+                {
+                    if (vertexMeshlet[indices[i]] != meshletIdx)
+                        ++newVertices;
+                }
+                if (vertexCount + newVertices > MESHLET_MAX_VERTICES)
+                    break;
+
+                for (u32 i = 0; i < 3; ++i)
+                {
+                    if (vertexMeshlet[indices[i]] != meshletIdx)
+                    {
+                        vertexMeshlet[indices[i]] = meshletIdx;
+                        ++vertexCount;
+                    }
+                }
+            }
+
+            submesh.meshlets.push_back(ComputeMeshletBounds(submesh, firstTriangle * 3, (triangle - firstTriangle) * 3));
+            firstTriangle = triangle;
+        }
+
+        lod.meshletCount = submesh.meshlets.size() - lod.firstMeshlet;
+    }
+}
 
 void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
 {
@@ -83,6 +207,8 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
     submesh.vertexBufferLayout = vertexBufferLayout;
     submesh.vertices.swap(vertices);
     submesh.indices.swap(indices);
+    BuildLods(submesh);
+    BuildMeshlets(submesh);
     myMesh->submeshes.push_back( submesh );
 }
 
@@ -160,7 +286,9 @@ void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 bas
     }
 }
 
-u32 LoadModel(App* app, const char* filename)
+// Imports the file into mesh and model. The materials overwrite the ones from
+// model.baseMaterialIdx if the file has the same amount, otherwise they're appended.
+bool ImportModel(App* app, const char* filename, Mesh& mesh, Model& model)
 {
     const aiScene* scene = aiImportFile(filename,
                                         aiProcess_Triangulate           |
@@ -175,40 +303,41 @@ u32 LoadModel(App* app, const char* filename)
     if (!scene)
     {
         ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-        return UINT32_MAX;
+        return false;
     }
 
-    app->meshes.push_back(Mesh{});
-    Mesh& mesh = app->meshes.back();
-    u32 meshIdx = (u32)app->meshes.size() - 1u;
-
-    app->models.push_back(Model{});
-    Model& model = app->models.back();
-    model.meshIdx = meshIdx;
-    u32 modelIdx = (u32)app->models.size() - 1u;
-
     String directory = GetDirectoryPart(MakeString(filename));
 
     // Create a list of materials
-    u32 baseMeshMaterialIndex = (u32)app->materials.size();
+    if (model.materialCount != scene->mNumMaterials)
+    {
+        model.baseMaterialIdx = (u32)app->materials.size();
+        model.materialCount = scene->mNumMaterials;
+        app->materials.resize(app->materials.size() + scene->mNumMaterials);
+    }
     for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
     {
-        app->materials.push_back(Material{});
-        Material& material = app->materials.back();
+        Material& material = app->materials[model.baseMaterialIdx + i];
+        material = Material{};
         ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
     }
 
-    ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+    model.filepath = filename;
+    model.materialIdx.clear();
+    ProcessAssimpNode(scene, scene->mRootNode, &mesh, model.baseMaterialIdx, model.materialIdx);
 
     aiReleaseImport(scene);
 
     u32 vertexBufferSize = 0;
     u32 indexBufferSize = 0;
+    u32 positionBufferSize = 0;
 
     for (u32 i = 0; i < mesh.submeshes.size(); ++i)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize  += mesh.submeshes[i].indices.size()  * sizeof(u32);
+        const Submesh& submesh = mesh.submeshes[i];
+        vertexBufferSize   += submesh.vertices.size() * sizeof(float);
+        indexBufferSize    += submesh.indices.size()  * sizeof(u32);
+        positionBufferSize += submesh.vertices.size() / (submesh.vertexBufferLayout.stride / sizeof(float)) * sizeof(vec3);
     }
 
     glGenBuffers(1, &mesh.vertexBufferHandle);
@@ -237,8 +366,133 @@ u32 LoadModel(App* app, const char* filename)
         indicesOffset += indicesSize;
     }
 
+    // Position only stream, copied out of the interleaved vertices (the position is always the first attribute)
+    glGenBuffers(1, &mesh.positionBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.positionBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, positionBufferSize, NULL, GL_STATIC_DRAW);
+
+    u32 positionsOffset = 0;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        Submesh& submesh = mesh.submeshes[i];
+        const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+
+        std::vector<vec3> positions;
+        positions.reserve(submesh.vertices.size() / floatStride);
+        for (u32 v = 0; v + 2 < submesh.vertices.size(); v += floatStride)
+        {
+            positions.push_back(vec3(submesh.vertices[v], submesh.vertices[v + 1], submesh.vertices[v + 2]));
+        }
+
+        const u32 positionsSize = positions.size() * sizeof(vec3);
+        glBufferSubData(GL_ARRAY_BUFFER, positionsOffset, positionsSize, positions.data());
+        submesh.positionOffset = positionsOffset;
+        positionsOffset += positionsSize;
+    }
+
+    // Meshlets of every submesh, the cluster culling pass reads them by offset
+    std::vector<Meshlet> meshlets;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        Submesh& submesh = mesh.submeshes[i];
+        submesh.meshletOffset = meshlets.size();
+        meshlets.insert(meshlets.end(), submesh.meshlets.begin(), submesh.meshlets.end());
+    }
+
+    glGenBuffers(1, &mesh.meshletBufferHandle);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh.meshletBufferHandle);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, meshlets.size() * sizeof(Meshlet), meshlets.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+    // bounding sphere (centered in the AABB) used for culling and shadow invalidation
+    vec3 aabbMin = vec3(FLT_MAX);
+    vec3 aabbMax = vec3(-FLT_MAX);
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+        for (u32 v = 0; v + 2 < submesh.vertices.size(); v += floatStride)
+        {
+            vec3 pos = vec3(submesh.vertices[v], submesh.vertices[v + 1], submesh.vertices[v + 2]);
+            aabbMin = glm::min(aabbMin, pos);
+            aabbMax = glm::max(aabbMax, pos);
+        }
+    }
+
+    mesh.boundsCenter = (aabbMin + aabbMax) * 0.5f;
+    mesh.boundsRadius = 0.0f;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+        for (u32 v = 0; v + 2 < submesh.vertices.size(); v += floatStride)
+        {
+            vec3 pos = vec3(submesh.vertices[v], submesh.vertices[v + 1], submesh.vertices[v + 2]);
+            mesh.boundsRadius = glm::max(mesh.boundsRadius, glm::length(pos - mesh.boundsCenter));
+        }
+    }
+
+    // Submeshes with fewer levels keep drawing their last one
+    u32 lodCount = 0;
+    for (const Submesh& submesh : mesh.submeshes)
+        lodCount = glm::max(lodCount, (u32)submesh.lods.size());
+
+    mesh.lodErrors.assign(lodCount, 0.0f);
+    for (u32 i = 0; i < lodCount; ++i)
+    {
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            const f32 error = submesh.lods[glm::min(i, (u32)submesh.lods.size() - 1)].error;
+            mesh.lodErrors[i] = glm::max(mesh.lodErrors[i], error / glm::max(mesh.boundsRadius, FLT_MIN));
+        }
+    }
+
+    return true;
+}
+
+u32 LoadModel(App* app, const char* filename)
+{
+    Mesh mesh = {};
+    Model model = {};
+    if (!ImportModel(app, filename, mesh, model))
+        return UINT32_MAX;
+
+    app->meshes.push_back(mesh);
+    model.meshIdx = (u32)app->meshes.size() - 1u;
+
+    app->models.push_back(model);
+    u32 modelIdx = (u32)app->models.size() - 1u;
+    app->visibilityGeometryDirty = true;
+
+    app->fileWatcher->Watch(filename);
     return modelIdx;
+}
+
+bool ReloadModel(App* app, u32 modelIdx)
+{
+    Mesh mesh = {};
+    Model model = app->models[modelIdx];
+    if (!ImportModel(app, model.filepath.c_str(), mesh, model))
+        return false;
+
+    // Same indices, new buffers
+    Mesh& oldMesh = app->meshes[model.meshIdx];
+    for (Submesh& submesh : oldMesh.submeshes)
+    {
+        for (VertexArray& vao : submesh.vaos)
+            glDeleteVertexArrays(1, &vao.handle);
+        glDeleteVertexArrays(1, &submesh.positionVao);
+    }
+    glDeleteBuffers(1, &oldMesh.vertexBufferHandle);
+    glDeleteBuffers(1, &oldMesh.indexBufferHandle);
+    glDeleteBuffers(1, &oldMesh.positionBufferHandle);
+    glDeleteBuffers(1, &oldMesh.meshletBufferHandle);
+
+    oldMesh = std::move(mesh);
+    app->models[modelIdx] = model;
+    app->visibilityGeometryDirty = true;
+    return true;
 }
\ No newline at end of file
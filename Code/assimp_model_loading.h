@@ -13,3 +13,6 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 bas
 void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
 void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
 u32 LoadModel(App* app, const char* filename);
+
+// Re-imports the file of the model keeping its mesh and material indices
+bool ReloadModel(App* app, u32 modelIdx);
@@ -7,6 +7,7 @@ Buffer CreateBuffer(u32 size, GLenum type, GLenum usage);
 #define CreateConstantBuffer(size) CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STREAM_DRAW)
 #define CreateStaticVertexBuffer(size) CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
+#define CreateStorageBuffer(size) CreateBuffer(size, GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW)
 
 void BindBuffer(const Buffer& buffer);
 void MapBuffer(Buffer& buffer, GLenum access);
@@ -16,7 +17,23 @@ void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 
 #define PushData(buffer, data, size) PushAlignedData(buffer, data, size, 1)
 #define PushUInt(buffer, value) { u32 v = value; PushAlignedData(buffer, &v, sizeof(v), 4); }
+#define PushFloat(buffer, value) { f32 v = value; PushAlignedData(buffer, &v, sizeof(v), 4); }
 #define PushVec3(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
 #define PushVec4(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
 #define PushMat3(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
-#define PushMat4(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
\ No newline at end of file
+#define PushMat4(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
+
+// Whole blocks in one copy, see BufferLayout.h
+template <typename B>
+void PushBlock(Buffer& buffer, const BlockWriter<B>& block)
+{
+    PushAlignedData(buffer, block.data, B::size, B::alignment);
+}
+
+// Elements of a runtime sized array of a storage block, back to back
+template <typename B>
+void PushBlockArray(Buffer& buffer, const BlockWriter<B>* blocks, u32 count)
+{
+    static_assert(sizeof(BlockWriter<B>) == B::size, "The elements have to be as big as their stride");
+    PushAlignedData(buffer, blocks, B::size * count, B::alignment);
+}
\ No newline at end of file
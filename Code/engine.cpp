@@ -14,6 +14,8 @@
 #include "buffermanagement.h"
 #include <glm/gtx/matrix_decompose.hpp>
 #include <glm/gtx/euler_angles.hpp>
+#include <algorithm>
+#include <chrono>
 
 namespace Utils
 {
@@ -25,103 +27,384 @@ namespace Utils
             return 3;
         case GL_FLOAT_VEC2:
             return 2;
+        case GL_UNSIGNED_INT:
+            return 1;
         default:
             assert("Not implemented");
         }
     }
 }
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+// Indexed by the bit of each ShaderFeature
+const char* const ShaderFeatureDefines[SHADER_FEATURE_COUNT] =
 {
-    GLchar  infoLogBuffer[1024] = {};
-    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
-    GLsizei infoLogSize;
-    GLint   success;
+    "FEATURE_FORWARD",
+    "FEATURE_HDR",
+    "FEATURE_STOCHASTIC",
+    "FEATURE_DEBUG_POSITIONS",
+    "FEATURE_DEBUG_NORMALS",
+    "FEATURE_DEBUG_ALBEDO",
+    "FEATURE_DEBUG_DEPTH",
+    "FEATURE_LIGHTING_ONLY",
+    "FEATURE_REDUCED_LIGHTING",
+};
+
+std::string GetFeatureDefines(ShaderFeatures features)
+{
+    std::string featureDefines;
+    for (u32 i = 0; i < SHADER_FEATURE_COUNT; ++i)
+    {
+        if (features & (1 << i))
+            featureDefines += std::string("#define ") + ShaderFeatureDefines[i] + "\n";
+    }
+    return featureDefines;
+}
 
-    char versionString[] = "#version 430\n";
-    char shaderNameDefine[128];
-    sprintf(shaderNameDefine, "#define %s\n", shaderName);
-    char vertexShaderDefine[] = "#define VERTEX\n";
-    char fragmentShaderDefine[] = "#define FRAGMENT\n";
+// Compiles and waits for it, only meant for the fallback programs
+GLuint CreateProgramFromSource(String programSource, const char* shaderName, ShaderFeatures features = 0)
+{
+    ProgramCompileJob job;
+    job.programName = shaderName;
+    job.source = std::string(programSource.str, programSource.len);
+    job.featureDefines = GetFeatureDefines(features);
+
+    StartProgramCompile(job);
+    FinishProgramCompile(job);
+    return job.programHandle;
+}
 
-    const GLchar* vertexShaderSource[] = {
-        versionString,
-        shaderNameDefine,
-        vertexShaderDefine,
-        programSource.str
-    };
-    const GLint vertexShaderLengths[] = {
-        (GLint) strlen(versionString),
-        (GLint) strlen(shaderNameDefine),
-        (GLint) strlen(vertexShaderDefine),
-        (GLint) programSource.len
-    };
-    const GLchar* fragmentShaderSource[] = {
-        versionString,
-        shaderNameDefine,
-        fragmentShaderDefine,
-        programSource.str
-    };
-    const GLint fragmentShaderLengths[] = {
-        (GLint) strlen(versionString),
-        (GLint) strlen(shaderNameDefine),
-        (GLint) strlen(fragmentShaderDefine),
-        (GLint) programSource.len
-    };
+// The program holding the vertex inputs, VAOs are made for it
+GLuint GetVertexProgram(const Program& program)
+{
+    return program.ready && program.separable ? program.vertexStage : program.handle;
+}
+
+void ChargeProgram(Program& program)
+{
+    program.vertexInputLayout.attributes.clear();
+
+    const GLuint vertexProgram = GetVertexProgram(program);
 
-    GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
-    glCompileShader(vshader);
-    glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    i32 attributeCount;
+    glGetProgramiv(vertexProgram, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+
+    for (int i = 0; i < attributeCount; ++i)
     {
-        glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        char attributeName[128] = {};
+
+        GLsizei attributeNameLength = 0;
+        GLsizei attributeSize = 0;
+        GLenum attributeType = 0;
+        glGetActiveAttrib(vertexProgram, i, ARRAY_COUNT(attributeName), &attributeNameLength, &attributeSize, &attributeType, attributeName);
+
+        GLint location = glGetAttribLocation(vertexProgram, attributeName);
+
+        VertexShaderAttribute attribute = {};
+        attribute.location = location;
+        attribute.componentCount = Utils::GetGLComponentCount(attributeType);
+        program.vertexInputLayout.attributes.push_back(attribute);
     }
+}
 
-    GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
-    glCompileShader(fshader);
-    glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
-    if (!success)
+void DeleteProgramVAOs(App* app, GLuint vertexProgram)
+{
+    for (Mesh& mesh : app->meshes)
     {
-        glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        for (Submesh& submesh : mesh.submeshes)
+        {
+            for (u32 i = 0; i < submesh.vaos.size();)
+            {
+                if (submesh.vaos[i].programHandle == vertexProgram)
+                {
+                    glDeleteVertexArrays(1, &submesh.vaos[i].handle);
+                    submesh.vaos.erase(submesh.vaos.begin() + i);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
     }
+}
 
-    GLuint programHandle = glCreateProgram();
-    glAttachShader(programHandle, vshader);
-    glAttachShader(programHandle, fshader);
-    glLinkProgram(programHandle);
-    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
-    if (!success)
+// Swaps a monolithic program in place, the VAOs made for the previous handle go with it
+void ReplaceProgramHandle(App* app, Program& program, GLuint handle)
+{
+    if (program.ready)
     {
-        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        DeleteProgramVAOs(app, program.handle);
+        glDeleteProgram(program.handle);
     }
 
-    glUseProgram(0);
+    program.handle = handle;
+    program.ready = true;
+    ChargeProgram(program);
+}
+
+// A separable program is ready once it has both stages, until then it draws with the fallback
+void AssemblePipeline(Program& program)
+{
+    if (!program.vertexStage || !program.fragmentStage)
+        return;
+
+    if (!program.pipeline)
+        glGenProgramPipelines(1, &program.pipeline);
+
+    glUseProgramStages(program.pipeline, GL_VERTEX_SHADER_BIT, program.vertexStage);
+    glUseProgramStages(program.pipeline, GL_FRAGMENT_SHADER_BIT, program.fragmentStage);
+
+    program.handle = program.fragmentStage;
+    program.ready = true;
+    ChargeProgram(program);
+}
+
+// Logs the blocks the program declares differently from the engine's descriptors
+void CheckProgramBlocks(GLuint handle, const char* programName)
+{
+    CheckBlockLayout<GlobalParamsBlock>(handle, programName);
+    CheckBlockLayout<LightListBlock>(handle, programName);
+    CheckBlockLayout<ObjectsBlock>(handle, programName);
+}
+
+// stage is 0 for a monolithic program
+void InstallCompiledProgram(App* app, u32 programIdx, GLenum stage, GLuint handle)
+{
+    Program& program = app->programs[programIdx];
+    CheckProgramBlocks(handle, program.programName.c_str());
+
+    if (stage == GL_VERTEX_SHADER)
+    {
+        // Only base programs compile it, every variant uses theirs
+        const GLuint previous = program.vertexStage;
+        for (auto& variant : program.variants)
+        {
+            app->programs[variant.second].vertexStage = handle;
+            AssemblePipeline(app->programs[variant.second]);
+        }
+
+        if (previous)
+        {
+            DeleteProgramVAOs(app, previous);
+            glDeleteProgram(previous);
+        }
+    }
+    else if (stage == GL_FRAGMENT_SHADER)
+    {
+        const GLuint previous = program.fragmentStage;
+        program.fragmentStage = handle;
+        AssemblePipeline(program);
+
+        if (previous)
+            glDeleteProgram(previous);
+    }
+    else
+    {
+        ReplaceProgramHandle(app, program, handle);
+    }
+}
+
+// Cache hits are installed right away, the rest keeps the fallback until UpdateProgramCompiles gets them
+void SubmitProgramStage(App* app, u32 programIdx, GLenum stage, const std::string& source)
+{
+    const Program& program = app->programs[programIdx];
+
+    ProgramCompileJob job;
+    job.programIdx = programIdx;
+    job.programName = program.programName;
+    job.source = source;
+    job.stage = stage;
+
+    // Features only reach the fragment stage, that's what lets all the variants share the vertex one
+    job.featureDefines = stage == GL_VERTEX_SHADER ? "" : GetFeatureDefines(program.features);
+
+    // Everything the compiler gets
+    const char* stageName = stage == GL_VERTEX_SHADER ? "VERTEX\n" : stage == GL_FRAGMENT_SHADER ? "FRAGMENT\n" : "";
+    job.cacheKey = app->programCache->ComputeKey(GLSL_VERSION_STRING "#define " + job.programName + "\n" + stageName + job.featureDefines + job.source);
+
+    GLuint cachedHandle = app->programCache->Load(job.cacheKey, stage != 0);
+    if (cachedHandle)
+    {
+        InstallCompiledProgram(app, programIdx, stage, cachedHandle);
+        return;
+    }
+
+    app->programCompiler->Submit(std::move(job));
+}
+
+void SubmitProgramCompile(App* app, u32 programIdx, String programSource)
+{
+    const Program& program = app->programs[programIdx];
+    const std::string source(programSource.str, programSource.len);
+
+    if (!program.separable)
+    {
+        SubmitProgramStage(app, programIdx, 0, source);
+        return;
+    }
+
+    if (program.baseIdx == programIdx)
+        SubmitProgramStage(app, programIdx, GL_VERTEX_SHADER, source);
+    SubmitProgramStage(app, programIdx, GL_FRAGMENT_SHADER, source);
+}
+
+void UpdateProgramCompiles(App* app)
+{
+    for (ProgramCompileJob& job : app->programCompiler->Poll())
+    {
+        // On failure it keeps drawing with what it had, the fallback or the previous version
+        if (!FinishProgramCompile(job))
+        {
+            glDeleteProgram(job.programHandle);
+            continue;
+        }
+
+        f32 compileMilliseconds = std::chrono::duration<f32, std::milli>(std::chrono::high_resolution_clock::now() - job.submitTime).count();
+        app->programCache->Store(job.cacheKey, job.programHandle, compileMilliseconds);
+
+        InstallCompiledProgram(app, job.programIdx, job.stage, job.programHandle);
+    }
+}
+
+// Separable programs bind their pipeline, a program bound with glUseProgram would take precedence over it
+void UseProgram(const Program& program)
+{
+    if (program.ready && program.separable)
+    {
+        glUseProgram(0);
+        glBindProgramPipeline(program.pipeline);
+    }
+    else
+    {
+        glUseProgram(program.handle);
+    }
+}
+
+// Uniforms are set in every stage of the program that declares them
+template <typename SetFunction>
+void SetUniformInStages(const Program& program, const char* name, SetFunction set)
+{
+    const GLuint stages[] =
+    {
+        program.handle,
+        program.ready && program.separable ? program.vertexStage : 0u
+    };
+
+    for (GLuint stage : stages)
+    {
+        if (!stage)
+            continue;
+
+        GLint location = glGetUniformLocation(stage, name);
+        if (location >= 0)
+            set(stage, location);
+    }
+}
+
+void SetUniform(const Program& program, const char* name, i32 value)
+{
+    SetUniformInStages(program, name, [&](GLuint stage, GLint location) { glProgramUniform1i(stage, location, value); });
+}
+
+void SetUniform(const Program& program, const char* name, u32 value)
+{
+    SetUniformInStages(program, name, [&](GLuint stage, GLint location) { glProgramUniform1ui(stage, location, value); });
+}
+
+void SetUniform(const Program& program, const char* name, f32 value)
+{
+    SetUniformInStages(program, name, [&](GLuint stage, GLint location) { glProgramUniform1f(stage, location, value); });
+}
+
+void SetUniform(const Program& program, const char* name, const vec2& value)
+{
+    SetUniformInStages(program, name, [&](GLuint stage, GLint location) { glProgramUniform2fv(stage, location, 1, glm::value_ptr(value)); });
+}
 
-    glDetachShader(programHandle, vshader);
-    glDetachShader(programHandle, fshader);
-    glDeleteShader(vshader);
-    glDeleteShader(fshader);
+void SetUniform(const Program& program, const char* name, const vec3& value)
+{
+    SetUniformInStages(program, name, [&](GLuint stage, GLint location) { glProgramUniform3fv(stage, location, 1, glm::value_ptr(value)); });
+}
+
+void SetUniform(const Program& program, const char* name, const glm::mat4* values, u32 count)
+{
+    SetUniformInStages(program, name, [&](GLuint stage, GLint location) { glProgramUniformMatrix4fv(stage, location, count, false, glm::value_ptr(values[0])); });
+}
+
+void SetUniform(const Program& program, const char* name, const glm::mat4& value)
+{
+    SetUniform(program, name, &value, 1);
+}
 
-    return programHandle;
+// Every combination of supportedFeatures is compiled up front, a program falling back to
+// this one draws with the variant that matches its own features
+u32 LoadFallbackProgram(App* app, const char* filepath, const char* programName, ShaderFeatures supportedFeatures = 0)
+{
+    String programSource = ReadTextFile(filepath);
+
+    u32 programIdx = app->programs.size();
+    ShaderFeatures features = 0;
+    do
+    {
+        Program program = {};
+        program.handle = CreateProgramFromSource(programSource, programName, features);
+        program.filepath = filepath;
+        program.programName = programName;
+        program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+        program.features = features;
+        program.supportedFeatures = supportedFeatures;
+        program.ready = true;
+        program.separable = false;
+        program.fallbackIdx = UINT32_MAX;
+        program.baseIdx = programIdx;
+        ChargeProgram(program);
+        app->programs.push_back(program);
+
+        app->programs[programIdx].variants[features] = app->programs.size() - 1;
+        features = (features - supportedFeatures) & supportedFeatures;
+    } while (features != 0);
+
+    return programIdx;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+// The variant of a fallback program for the given features, its base if it doesn't support them
+u32 GetFallbackVariant(App* app, u32 fallbackIdx, ShaderFeatures features)
+{
+    const Program& fallback = app->programs[fallbackIdx];
+    auto it = fallback.variants.find(features & fallback.supportedFeatures);
+    return it != fallback.variants.end() ? it->second : fallbackIdx;
+}
+
+// Draws with fallbackIdx until the compile finishes, without one it's just skipped
+u32 LoadProgram(App* app, const char* filepath, const char* programName, ShaderFeatures supportedFeatures = 0, u32 fallbackIdx = UINT32_MAX)
 {
     String programSource = ReadTextFile(filepath);
 
     Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
     program.filepath = filepath;
     program.programName = programName;
     program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.features = 0;
+    program.supportedFeatures = supportedFeatures;
+    program.ready = false;
+    program.fallbackIdx = fallbackIdx;
+    if (fallbackIdx != UINT32_MAX)
+    {
+        program.handle = app->programs[fallbackIdx].handle;
+        program.vertexInputLayout = app->programs[fallbackIdx].vertexInputLayout;
+    }
+
+    // Programs with a geometry stage stay monolithic, and compute programs have a single stage anyway
+    program.separable = strstr(programSource.str, "defined(GEOMETRY)") == NULL && strstr(programSource.str, "defined(COMPUTE)") == NULL;
     app->programs.push_back(program);
 
-    return app->programs.size() - 1;
+    u32 programIdx = app->programs.size() - 1;
+    app->programs[programIdx].baseIdx = programIdx;
+    app->programs[programIdx].variants[0] = programIdx;
+    SubmitProgramCompile(app, programIdx, programSource);
+
+    app->fileWatcher->Watch(filepath);
+    return programIdx;
 }
 
 Image LoadImage(const char* filename)
@@ -189,6 +472,7 @@ u32 LoadTexture2D(App* app, const char* filepath)
 
         u32 texIdx = app->textures.size();
         app->textures.push_back(tex);
+        app->fileWatcher->Watch(filepath);
 
         FreeImage(image);
         return texIdx;
@@ -199,27 +483,120 @@ u32 LoadTexture2D(App* app, const char* filepath)
     }
 }
 
-void ChargeProgram(Program& program)
+u32 GetProgramVariant(App* app, u32 programIdx, ShaderFeatures features)
 {
-    i32 attributeCount;
-    glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
-
-    for (int i = 0; i < attributeCount; ++i)
+    features &= app->programs[programIdx].supportedFeatures;
+
+    std::map<ShaderFeatures, u32>& variants = app->programs[programIdx].variants;
+    auto it = variants.find(features);
+    if (it != variants.end())
+        return it->second;
+
+    const Program& base = app->programs[programIdx];
+    String programSource = ReadTextFile(base.filepath.c_str());
+
+    Program variant = {};
+    variant.filepath = base.filepath;
+    variant.programName = base.programName;
+    variant.lastWriteTimestamp = base.lastWriteTimestamp;
+    variant.features = features;
+    variant.supportedFeatures = base.supportedFeatures;
+    variant.ready = false;
+    variant.fallbackIdx = base.fallbackIdx != UINT32_MAX ? GetFallbackVariant(app, base.fallbackIdx, features) : UINT32_MAX;
+    variant.separable = base.separable;
+    variant.baseIdx = programIdx;
+    variant.vertexStage = base.vertexStage;
+    if (variant.fallbackIdx != UINT32_MAX)
     {
-        char attributeName[128] = {};
+        variant.handle = app->programs[variant.fallbackIdx].handle;
+        variant.vertexInputLayout = app->programs[variant.fallbackIdx].vertexInputLayout;
+    }
 
-        GLsizei attributeNameLength = 0;
-        GLsizei attributeSize = 0;
-        GLenum attributeType = 0;
-        glGetActiveAttrib(program.handle, i, ARRAY_COUNT(attributeName), &attributeNameLength, &attributeSize, &attributeType, attributeName);
+    app->programs.push_back(variant);
+    u32 variantIdx = app->programs.size() - 1;
+    app->programs[programIdx].variants[features] = variantIdx;
+    SubmitProgramCompile(app, variantIdx, programSource);
+    return variantIdx;
+}
+
+vec3 ApplyTonemapper(Tonemapper tonemapper, vec3 color)
+{
+    switch (tonemapper)
+    {
+        case Tonemapper::REINHARD:
+            return color / (color + vec3(1.0f));
+        case Tonemapper::ACES:
+            // Narkowicz's fit of the ACES filmic curve
+            return glm::clamp((color * (2.51f * color + 0.03f)) / (color * (2.43f * color + 0.59f) + 0.14f), 0.0f, 1.0f);
+        default:
+            return color;
+    }
+}
 
-        GLint location = glGetAttribLocation(program.handle, attributeName);
+// Bakes the tone mapping curve into a 3D texture, the post pass only does a lookup.
+// Texels are spaced in log2 of the exposed color, the first one of each axis is black.
+void BuildTonemapLUT(App* app)
+{
+    std::vector<vec3> texels(TONEMAP_LUT_SIZE * TONEMAP_LUT_SIZE * TONEMAP_LUT_SIZE);
+    for (u32 b = 0; b < TONEMAP_LUT_SIZE; ++b)
+    {
+        for (u32 g = 0; g < TONEMAP_LUT_SIZE; ++g)
+        {
+            for (u32 r = 0; r < TONEMAP_LUT_SIZE; ++r)
+            {
+                const vec3 t = vec3(r, g, b) / f32(TONEMAP_LUT_SIZE - 1);
+                vec3 color = glm::exp2(TONEMAP_LUT_MIN_LOG + t * (TONEMAP_LUT_MAX_LOG - TONEMAP_LUT_MIN_LOG));
+                color = glm::mix(color, vec3(0.0f), glm::equal(glm::uvec3(r, g, b), glm::uvec3(0)));
 
-        VertexShaderAttribute attribute = {};
-        attribute.location = location;
-        attribute.componentCount = Utils::GetGLComponentCount(attributeType);
-        program.vertexInputLayout.attributes.push_back(attribute);
+                texels[(b * TONEMAP_LUT_SIZE + g) * TONEMAP_LUT_SIZE + r] = ApplyTonemapper(app->tonemapper, color);
+            }
+        }
     }
+
+    if (!app->tonemapLUT)
+        glGenTextures(1, &app->tonemapLUT);
+
+    glBindTexture(GL_TEXTURE_3D, app->tonemapLUT);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, TONEMAP_LUT_SIZE, TONEMAP_LUT_SIZE, TONEMAP_LUT_SIZE, 0, GL_RGB, GL_FLOAT, texels.data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+// Grows the buffer the draw index attribute reads, entry i holds i. The handle stays the same so
+// the vertex arrays that already point at it don't have to be rebuilt.
+void ReserveDrawIndices(App* app, u32 count)
+{
+    if (count <= app->drawIndexCapacity)
+        return;
+
+    app->drawIndexCapacity = glm::max(count, app->drawIndexCapacity * 2);
+    std::vector<u32> indices(app->drawIndexCapacity);
+    for (u32 i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+
+    glBindBuffer(GL_ARRAY_BUFFER, app->drawIndexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(u32), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Adds the draw index to the bound vertex array. It advances per instance, so with a single
+// instance it reads the entry at the draw's base instance (no gl_BaseInstance in GLSL 4.30).
+void BindDrawIndexAttribute(App* app)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, app->drawIndexBuffer);
+    glVertexAttribIPointer(DRAW_INDEX_LOCATION, 1, GL_UNSIGNED_INT, 0, (void*)0);
+    glEnableVertexAttribArray(DRAW_INDEX_LOCATION);
+    glVertexAttribDivisor(DRAW_INDEX_LOCATION, 1);
+}
+
+// Draws the bound vertex array's triangles with the object params at objectIdx
+void DrawObject(GLenum indexType, u32 indexCount, u64 indexOffset, u32 objectIdx)
+{
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, indexCount, indexType, (void*)indexOffset, 1, objectIdx);
 }
 
 void Init(App* app)
@@ -237,6 +614,15 @@ void Init(App* app)
         app->glInfo.glExtensions.push_back(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)));
     }
 
+    app->programCache = new ProgramCache(PROGRAM_CACHE_DIRECTORY, app->glInfo.glRenderer, app->glInfo.glVersion);
+
+    const bool parallelShaderCompile =
+        std::find(app->glInfo.glExtensions.begin(), app->glInfo.glExtensions.end(), "GL_KHR_parallel_shader_compile") != app->glInfo.glExtensions.end() ||
+        std::find(app->glInfo.glExtensions.begin(), app->glInfo.glExtensions.end(), "GL_ARB_parallel_shader_compile") != app->glInfo.glExtensions.end();
+    app->programCompiler = new ProgramCompiler(parallelShaderCompile);
+    app->fileWatcher = new FileWatcher();
+    ILOG("Compiling programs with the %s", app->programCompiler->GetModeName());
+
     glGenBuffers(1, &app->embeddedVertices);
     glBindBuffer(GL_ARRAY_BUFFER, app->embeddedVertices);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
@@ -247,6 +633,11 @@ void Init(App* app)
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
+    // Every vertex array reads it (see BindDrawIndexAttribute), it grows in place with the number of objects
+    glGenBuffers(1, &app->drawIndexBuffer);
+    app->drawIndexCapacity = 0;
+    ReserveDrawIndices(app, 64);
+
     glGenVertexArrays(1, &app->vao);
     glBindVertexArray(app->vao);
     glBindBuffer(GL_ARRAY_BUFFER, app->embeddedVertices);
@@ -254,40 +645,51 @@ void Init(App* app)
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex3V2V), (void*)(3*sizeof(float)));
     glEnableVertexAttribArray(2);
+    BindDrawIndexAttribute(app);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
     glBindVertexArray(0);
 
-    app->texturedGeometryProgramIdx = LoadProgram(app, "shaders.glsl", "MESH_GEOMETRY");
-    Program& program = app->programs[app->texturedGeometryProgramIdx];
-    ChargeProgram(program);
-
-    app->deferredIdx = LoadProgram(app, "mesh.glsl", "MESH");
-    Program& program2 = app->programs[app->deferredIdx];
-    ChargeProgram(program2);
-
-    app->finalQuadIdx = LoadProgram(app, "deferred.glsl", "DEFERRED");
-    Program& program3 = app->programs[app->finalQuadIdx];
-    ChargeProgram(program3);
-    
-    app->lightsIdx = LoadProgram(app, "lights.glsl", "LIGHTS");
-    Program& program4 = app->programs[app->lightsIdx];
-    ChargeProgram(program4);
-
-    app->bloomIdx = LoadProgram(app, "bloom.glsl", "BLOOM");
-    Program& program5 = app->programs[app->bloomIdx];
-    ChargeProgram(program5);
-
-    app->quadForwardIdx = LoadProgram(app, "quadForward.glsl", "FORWARD");
-    Program& program6 = app->programs[app->quadForwardIdx];
-    ChargeProgram(program6);
-
-    app->reliefIdx = LoadProgram(app, "relief.glsl", "RELIEF");
-    Program& program7 = app->programs[app->reliefIdx];
-    ChargeProgram(program7);
-
-    app->programUniformTexture = glGetUniformLocation(program2.handle, "uTexture");
-    app->normalsUniformTexture = glGetUniformLocation(program2.handle, "normalTexture");
-    app->depthUniformTexture = glGetUniformLocation(program2.handle, "depthTexture");
+    // The placeholders have to exist before anything that falls back to them
+    app->fallbackMeshIdx = LoadFallbackProgram(app, "fallback.glsl", "FALLBACK_MESH", SHADER_FEATURE_FORWARD);
+    app->fallbackQuadIdx = LoadFallbackProgram(app, "fallback.glsl", "FALLBACK_QUAD");
+
+    // All the compiles are submitted here and finish over the next frames
+    app->texturedGeometryProgramIdx = LoadProgram(app, "shaders.glsl", "MESH_GEOMETRY", 0, app->fallbackQuadIdx);
+    app->deferredIdx = LoadProgram(app, "mesh.glsl", "MESH", SHADER_FEATURE_FORWARD, app->fallbackMeshIdx);
+    app->finalQuadIdx = LoadProgram(app, "deferred.glsl", "DEFERRED", SHADER_FEATURE_STOCHASTIC | SHADER_FEATURE_DEBUG_VIEWS | SHADER_FEATURE_LIGHTING_ONLY | SHADER_FEATURE_REDUCED_LIGHTING, app->fallbackQuadIdx);
+    app->lightsIdx = LoadProgram(app, "lights.glsl", "LIGHTS", SHADER_FEATURE_FORWARD);
+    app->bloomPrefilterIdx = LoadProgram(app, "bloom.glsl", "BLOOM_PREFILTER", 0, app->fallbackQuadIdx);
+    app->bloomDownsampleIdx = LoadProgram(app, "bloom.glsl", "BLOOM_DOWNSAMPLE", 0, app->fallbackQuadIdx);
+    app->bloomUpsampleIdx = LoadProgram(app, "bloom.glsl", "BLOOM_UPSAMPLE", 0, app->fallbackQuadIdx);
+    app->quadForwardIdx = LoadProgram(app, "quadForward.glsl", "FORWARD", SHADER_FEATURE_DEBUG_VIEWS, app->fallbackQuadIdx);
+    app->lightingDownsampleIdx = LoadProgram(app, "lightingDownsample.glsl", "LIGHTING_DOWNSAMPLE");
+    app->upscaleIdx = LoadProgram(app, "upscale.glsl", "UPSCALE");
+    app->taaResolveIdx = LoadProgram(app, "taa.glsl", "TAA_RESOLVE");
+    app->depthPrepassIdx = LoadProgram(app, "depthPrepass.glsl", "DEPTH_PREPASS");
+    app->visibilityIdx = LoadProgram(app, "visibility.glsl", "VISIBILITY");
+    app->visibilityResolveIdx = LoadProgram(app, "visibilityResolve.glsl", "VISIBILITY_RESOLVE");
+    app->clusterCullIdx = LoadProgram(app, "clusterCull.glsl", "CLUSTER_CULL");
+    app->impostorIdx = LoadProgram(app, "impostor.glsl", "IMPOSTOR");
+    app->postIdx = LoadProgram(app, "post.glsl", "POST", SHADER_FEATURE_HDR);
+    app->exposureAdaptIdx = LoadProgram(app, "post.glsl", "EXPOSURE_ADAPT");
+    app->reliefIdx = LoadProgram(app, "relief.glsl", "RELIEF", SHADER_FEATURE_FORWARD, app->fallbackMeshIdx);
+    app->pointShadowIdx = LoadProgram(app, "shadows.glsl", "POINT_SHADOW");
+    app->restirTemporalIdx = LoadProgram(app, "restir.glsl", "RESTIR_TEMPORAL", 0, app->fallbackQuadIdx);
+    app->restirSpatialIdx = LoadProgram(app, "restir.glsl", "RESTIR_SPATIAL", 0, app->fallbackQuadIdx);
+
+    // Warm the variants every frame can switch to from the render options, debug views compile on demand
+    GetProgramVariant(app, app->deferredIdx, SHADER_FEATURE_FORWARD);
+    GetProgramVariant(app, app->reliefIdx, SHADER_FEATURE_FORWARD);
+    GetProgramVariant(app, app->lightsIdx, SHADER_FEATURE_FORWARD);
+    GetProgramVariant(app, app->finalQuadIdx, SHADER_FEATURE_STOCHASTIC);
+    GetProgramVariant(app, app->postIdx, SHADER_FEATURE_HDR);
+
+    ILOG("Program cache: %u hits, %u misses, %.1f ms saved", app->programCache->GetHits(), app->programCache->GetMisses(), app->programCache->GetMillisecondsSaved());
+
+    Program& meshProgram = app->programs[app->deferredIdx];
+    app->programUniformTexture = glGetUniformLocation(meshProgram.handle, "uTexture");
+    app->normalsUniformTexture = glGetUniformLocation(meshProgram.handle, "normalTexture");
+    app->depthUniformTexture = glGetUniformLocation(meshProgram.handle, "depthTexture");
 
     app->diceTexIdx = LoadTexture2D(app, "dice.png");
     app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
@@ -306,14 +708,31 @@ void Init(App* app)
     app->uniformBuffer = CreateBuffer(app->maxUniformBufferSize, GL_UNIFORM_BUFFER, GL_STATIC_DRAW);
     app->globalParamsOffset = app->uniformBuffer.head;
 
+    // Light list for the stochastic lighting, it grows with the number of lights
+    app->lightsBuffer = CreateStorageBuffer(LightListBlock::size + LightBlock::size * 64);
+    app->visibilityDrawBuffer = CreateStorageBuffer(VISIBILITY_DRAW_SIZE * 64);
+    app->clusterDrawBuffer = CreateStorageBuffer(CLUSTER_DRAW_COMMAND_SIZE * 64);
+    app->objectBuffer = CreateStorageBuffer(ObjectParamsBlock::size * 64);
+
+    // Empty histogram, and the first frames are exposed for middle grey
+    app->exposureBuffer = CreateStorageBuffer(sizeof(u32) * LUMINANCE_HISTOGRAM_BINS + sizeof(f32) * 2);
+    MapBuffer(app->exposureBuffer, GL_WRITE_ONLY);
+    for (u32 i = 0; i < LUMINANCE_HISTOGRAM_BINS; ++i)
+    {
+        PushUInt(app->exposureBuffer, 0);
+    }
+    PushFloat(app->exposureBuffer, 1.0f);  // exposure
+    PushFloat(app->exposureBuffer, 0.18f); // adapted luminance
+    UnmapBuffer(app->exposureBuffer);
+
+    BuildTonemapLUT(app);
+
     app->sphereIdx = LoadModel(app, "sphere/sphere.fbx");
 
     for (int i = -1; i <= 1; ++i)
     {
         Entity& entity = app->entities.emplace_back();
         entity.modelIndex = LoadModel(app, "backpack/backpack.obj");
-        entity.localParamsOffset = (sizeof(glm::mat4) * 2) * app->entities.size();
-        entity.localParamsSize = sizeof(glm::mat4) * 2;
         entity.relief = false;
 
         entity.position = vec3(i * 5.0f, 0.0f, 0.0f);
@@ -322,12 +741,11 @@ void Init(App* app)
 
         entity.worldMatrix = glm::translate(entity.position) * glm::eulerAngleXYZ(glm::radians(entity.rotation.x), glm::radians(entity.rotation.y), glm::radians(entity.rotation.z));
         entity.worldMatrix = glm::scale(entity.worldMatrix, entity.scale);
+        entity.prevWorldMatrix = entity.worldMatrix;
     }
 
     Entity& entity = app->entities.emplace_back();
     entity.modelIndex = LoadModel(app, "sphere/plane.fbx");
-    entity.localParamsOffset = (sizeof(glm::mat4) * 2) * app->entities.size();
-    entity.localParamsSize = sizeof(glm::mat4) * 2;
     entity.relief = true;
 
     entity.position = vec3(0.0f, 0.0f, -5.0f);
@@ -336,6 +754,7 @@ void Init(App* app)
 
     entity.worldMatrix = glm::translate(entity.position) * glm::eulerAngleXYZ(glm::radians(entity.rotation.x), glm::radians(entity.rotation.y), glm::radians(entity.rotation.z));
     entity.worldMatrix = glm::scale(entity.worldMatrix, entity.scale);
+    entity.prevWorldMatrix = entity.worldMatrix;
 
     for (int i = -1; i <= 1; ++i)
     {
@@ -379,10 +798,54 @@ void Init(App* app)
 
     glEnable(GL_DEPTH_TEST);
 
-    app->fbo1 = new Framebuffer(5, app->displaySize.x, app->displaySize.y);
+    // Only the depth, the G-buffer colors are transient textures of the frame graph (see Render)
+    FramebufferSpecification gbufferSpec;
+    gbufferSpec.width = app->displaySize.x;
+    gbufferSpec.height = app->displaySize.y;
+    gbufferSpec.attachments = { FramebufferTextureFormat::DEPTH24 };
+    app->renderTargetPool = new RenderTargetPool();
+
+    app->fbo1 = new Framebuffer(gbufferSpec, app->renderTargetPool);
     
-    app->fboBloom1 = new Framebuffer(1, app->displaySize.x, app->displaySize.y);
-    app->fboBloom2 = new Framebuffer(1, app->displaySize.x, app->displaySize.y);
+    FramebufferSpecification reservoirSpec;
+    reservoirSpec.width = app->displaySize.x;
+    reservoirSpec.height = app->displaySize.y;
+    reservoirSpec.attachments = { FramebufferTextureFormat::RGBA32F };
+    app->fboReservoirHistory = new Framebuffer(reservoirSpec, app->renderTargetPool);
+
+    // Half floats, the history is blended into itself every frame and packed floats would drift in hue
+    FramebufferSpecification taaHistorySpec;
+    taaHistorySpec.width = app->displaySize.x;
+    taaHistorySpec.height = app->displaySize.y;
+    taaHistorySpec.attachments = { FramebufferTextureFormat::RGBA16 };
+    for (u32 i = 0; i < ARRAY_COUNT(app->fboTaaHistory); ++i)
+    {
+        app->fboTaaHistory[i] = new Framebuffer(taaHistorySpec, app->renderTargetPool);
+    }
+
+    // The bloom and the intermediate reservoirs are transient textures of the frame graph
+    app->gpuProfiler = new GpuProfiler();
+    app->frameGraph = new FrameGraph(app->renderTargetPool, app->gpuProfiler);
+
+    glGenSamplers(1, &app->linearClampSampler);
+    glSamplerParameteri(app->linearClampSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(app->linearClampSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(app->linearClampSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(app->linearClampSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    app->shadowAtlas = new ShadowAtlas(SHADOW_ATLAS_SLOTS, SHADOW_CUBE_SIZE);
+
+    glGenQueries(1, &app->overdrawQuery);
+
+#ifndef NDEBUG
+    // Lighting and bloom targets are packed floats, check the driver keeps the precision they
+    // promise over every value the exposure can bring to the screen
+    {
+        const f32 error = Utils::MeasureFormatPrecision(FramebufferTextureFormat::R11F_G11F_B10F, glm::exp2(EXPOSURE_MIN_LOG_LUMINANCE), glm::exp2(TONEMAP_LUT_MAX_LOG));
+        ILOG("R11F_G11F_B10F round trip: %.2f%% max relative error", error * 100.0f);
+        ASSERT(error <= R11F_G11F_B10F_MAX_RELATIVE_ERROR, "R11F_G11F_B10F targets lose more precision than expected");
+    }
+#endif
 
     app->mode = Mode_TexturedQuad;
     app->renderMode = RenderMode::DEFERRED;
@@ -428,17 +891,80 @@ void Gui(App* app)
         {
             app->renderMode = RenderMode::FORWARD;
         }
+        if (ImGui::MenuItem("VISIBILITY BUFFER", "", app->renderMode == RenderMode::VISIBILITY))
+        {
+            app->renderMode = RenderMode::VISIBILITY;
+        }
         ImGui::EndMenu();
     }
     if (ImGui::BeginMenu("Render Options"))
     {
         ImGui::Checkbox("HDR", &app->hdr);
+        if (ImGui::BeginCombo("Tone mapper", app->tonemapper == Tonemapper::REINHARD ? "Reinhard" : "ACES"))
+        {
+            if (ImGui::MenuItem("Reinhard"))
+            {
+                app->tonemapper = Tonemapper::REINHARD;
+                BuildTonemapLUT(app);
+            }
+            if (ImGui::MenuItem("ACES"))
+            {
+                app->tonemapper = Tonemapper::ACES;
+                BuildTonemapLUT(app);
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::SliderFloat("Exposure compensation", &app->exposureCompensation, -4.0f, 4.0f);
+        ImGui::SliderFloat("Adaptation speed", &app->exposureAdaptationSpeed, 0.1f, 10.0f);
+        ImGui::Separator();
+        ImGui::Text("Bloom");
+        ImGui::SliderFloat("Threshold", &app->bloomThreshold, 0.0f, 2.0f);
+        ImGui::SliderFloat("Knee", &app->bloomKnee, 0.0f, 1.0f);
+        ImGui::SliderFloat("Intensity", &app->bloomIntensity, 0.0f, 2.0f);
+        ImGui::SliderFloat("Radius", &app->bloomRadius, 0.5f, 3.0f);
         ImGui::Separator();
         ImGui::Text("Relief Mapping optins");
         ImGui::DragFloat("Min layers", &app->minLayers);
         ImGui::DragFloat("Max layers", &app->maxLayers);
         ImGui::DragFloat("Height scale", &app->heightScale);
         ImGui::Separator();
+        ImGui::Text("Dynamic resolution");
+        ImGui::Checkbox("Enabled", &app->dynamicResolution);
+        ImGui::SliderFloat("GPU budget (ms)", &app->gpuBudgetMilliseconds, 2.0f, 33.0f);
+        ImGui::SliderFloat("Upscale sharpness", &app->upscaleSharpness, 0.0f, 1.0f);
+        ImGui::Separator();
+        ImGui::Text("Depth pre-pass");
+        ImGui::RadioButton("Off", (int*)&app->depthPrepass, (int)DepthPrepassMode::OFF);
+        ImGui::SameLine();
+        ImGui::RadioButton("On", (int*)&app->depthPrepass, (int)DepthPrepassMode::ON);
+        ImGui::SameLine();
+        ImGui::RadioButton("Auto", (int*)&app->depthPrepass, (int)DepthPrepassMode::AUTO);
+        ImGui::Separator();
+        ImGui::Text("Geometry");
+        ImGui::Checkbox("Cluster culling", &app->clusterCulling);
+        ImGui::Checkbox("Static batching", &app->staticBatching);
+        ImGui::Checkbox("Levels of detail", &app->lodSelection);
+        ImGui::SliderFloat("LOD pixel error", &app->lodPixelError, 0.25f, 8.0f);
+        ImGui::Checkbox("Impostors", &app->impostorRendering);
+        ImGui::SliderFloat("Impostor distance", &app->impostorDistance, 5.0f, 200.0f);
+        ImGui::Separator();
+        ImGui::Text("Anti-aliasing");
+        ImGui::Checkbox("Temporal anti-aliasing", &app->taa);
+        ImGui::SliderFloat("History feedback", &app->taaFeedback, 0.5f, 0.98f);
+        ImGui::SliderFloat("Relief layers with TAA", &app->taaReliefLayerScale, 0.125f, 1.0f);
+        ImGui::Separator();
+        ImGui::Text("Deferred lighting");
+        ImGui::RadioButton("Full resolution", &app->lightingDownscale, 1);
+        ImGui::RadioButton("Half resolution", &app->lightingDownscale, 2);
+        ImGui::RadioButton("Quarter resolution", &app->lightingDownscale, 4);
+        ImGui::Separator();
+        ImGui::Text("Stochastic lighting (deferred)");
+        ImGui::Checkbox("Reservoir light sampling", &app->stochasticLighting);
+        ImGui::Checkbox("Temporal reuse", &app->temporalReuse);
+        ImGui::SliderInt("Light candidates", &app->lightCandidates, 1, 32);
+        ImGui::SliderInt("Spatial samples", &app->spatialSamples, 0, 8);
+        ImGui::DragFloat("Spatial radius", &app->spatialRadius, 0.5f, 1.0f, 64.0f);
+        ImGui::Separator();
         ImGui::EndMenu();
     }
     if (ImGui::BeginMenu("Create Lights"))
@@ -453,12 +979,59 @@ void Gui(App* app)
             Light& light = app->lights.emplace_back();
             light.type = LightType::POINT;
         }
+        if (ImGui::MenuItem("Create 1000 Random Point Lights"))
+        {
+            for (u32 i = 0; i < 1000; ++i)
+            {
+                Light& light = app->lights.emplace_back();
+                light.type = LightType::POINT;
+                light.color = vec3(rand() / (f32)RAND_MAX, rand() / (f32)RAND_MAX, rand() / (f32)RAND_MAX);
+                light.position = vec3(rand() / (f32)RAND_MAX * 30.0f - 15.0f, rand() / (f32)RAND_MAX * 6.0f - 3.0f, rand() / (f32)RAND_MAX * 30.0f - 15.0f);
+                light.radius = 3.0f;
+                light.castShadows = false;
+            }
+        }
         ImGui::EndMenu();
     }
     ImGui::EndMainMenuBar();
 
     ImGui::Begin("Info");
     ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
+    ImGui::Text("Shadow passes: %u", app->shadowPassesLastFrame);
+    ImGui::Text("Depth pre-pass: %s", app->depthPrepassActive ? "on" : "off");
+    ImGui::Text("Geometry overdraw: %.2f fragments/pixel without pre-pass, %.2f with", app->overdrawWithoutPrepass, app->overdrawWithPrepass);
+    ImGui::Text("Levels of detail: %u triangles, %u at full detail", app->lodTriangleCount, app->fullDetailTriangleCount);
+    ImGui::Text("Cluster culling: %s, %u meshlets in %u draws", app->clusterCullingActive ? "on" : "off", app->clusterMeshletCount, app->clusterDrawCount);
+    ImGui::Text("Impostors: %u entities, %u atlases", app->impostorCount, (u32)app->impostors.size());
+    ImGui::Text("Static batching: %u entities in %u batches, %u drawn", app->staticEntityCount, (u32)app->staticBatches.size(), app->staticBatchDrawCount);
+    ImGui::Text("Visibility buffer: %u draws, %u albedo textures (%u resolve dispatches)", app->visibilityDrawCount, (u32)app->visibilityTextures.size(),
+        (glm::max((u32)app->visibilityTextures.size(), 1u) + VISIBILITY_TEXTURE_SLOTS - 1) / VISIBILITY_TEXTURE_SLOTS);
+    ImGui::Text("Programs (with variants): %u", (u32)app->programs.size());
+    ImGui::Text("Programs compiling: %u (%s)", app->programCompiler->GetPendingCount(), app->programCompiler->GetModeName());
+    ImGui::Text("Watched files: %u", app->fileWatcher->GetWatchedFileCount());
+    ImGui::Text("Program cache: %u hits, %u misses, %.1f ms saved", app->programCache->GetHits(), app->programCache->GetMisses(), app->programCache->GetMillisecondsSaved());
+    ImGui::Text("Render targets: %u (%.1f MB), %u allocations", app->renderTargetPool->GetTextureCount(),
+        app->renderTargetPool->GetMemoryUsage() / (1024.0f * 1024.0f), app->renderTargetPool->GetAllocationCount());
+    ImGui::Text("Frame graph: %u passes, %u culled, %u transient textures (%u aliased)", (u32)app->frameGraph->GetPasses().size(),
+        app->frameGraph->GetCulledPassCount(), app->frameGraph->GetTransientTextureCount(), app->frameGraph->GetAliasedTextureCount());
+    if (ImGui::TreeNode("Frame graph passes"))
+    {
+        for (const FrameGraphPass& pass : app->frameGraph->GetPasses())
+        {
+            ImGui::Text("%s%s", pass.name, pass.culled ? " (culled)" : "");
+        }
+        ImGui::TreePop();
+    }
+    const ivec2 renderSize = GetRenderSize(app);
+    ImGui::Text("GPU: %.2f ms, rendering at %dx%d (%.0f%%)", app->gpuProfiler->GetFrameMilliseconds(), renderSize.x, renderSize.y, app->renderScale * 100.0f);
+    if (ImGui::TreeNode("GPU pass timings"))
+    {
+        for (const GpuTiming& timing : app->gpuProfiler->GetTimings())
+        {
+            ImGui::Text("%s: %.3f ms", timing.name, timing.milliseconds);
+        }
+        ImGui::TreePop();
+    }
 
     if (ImGui::BeginPopup("OpenGL information"))
     {
@@ -497,6 +1070,7 @@ void Gui(App* app)
             ImGui::DragFloat3("Position", glm::value_ptr(entity.position));
             ImGui::DragFloat3("Rotation", glm::value_ptr(entity.rotation));
             ImGui::DragFloat3("Scale", glm::value_ptr(entity.scale));
+            ImGui::Checkbox("Static", &entity.isStatic);
 
             entity.worldMatrix = glm::translate(entity.position) * glm::eulerAngleXYZ(glm::radians(entity.rotation.x), glm::radians(entity.rotation.y), glm::radians(entity.rotation.z));
             entity.worldMatrix = glm::scale(entity.worldMatrix, entity.scale);
@@ -530,6 +1104,11 @@ void Gui(App* app)
             }
             ImGui::DragFloat3("Position", glm::value_ptr(light.position));
             ImGui::DragFloat3("Direction", glm::value_ptr(light.direction));
+            if (light.type == LightType::POINT)
+            {
+                ImGui::Checkbox("Cast shadows", &light.castShadows);
+                ImGui::DragFloat("Radius", &light.radius, 0.1f, 0.1f, 100.0f);
+            }
             ImGui::ColorPicker4("Color", glm::value_ptr(light.color));
         }
         ImGui::PopID();
@@ -538,97 +1117,2001 @@ void Gui(App* app)
     ImGui::End();
 }
 
-void Update(App* app)
+bool EntityIntersectsSphere(App* app, const Entity& entity, const glm::mat4& worldMatrix, vec3 center, f32 radius)
 {
-    // You can handle app->input keyboard/mouse here
-    app->camera.Update(app->input, app->deltaTime);
-
-    MapBuffer(app->uniformBuffer, GL_WRITE_ONLY);
+    const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
 
-    app->globalParamsOffset = app->uniformBuffer.head;
+    f32 maxScale = glm::max(glm::length(vec3(worldMatrix[0])), glm::max(glm::length(vec3(worldMatrix[1])), glm::length(vec3(worldMatrix[2]))));
+    vec3 entityCenter = vec3(worldMatrix * vec4(mesh.boundsCenter, 1.0f));
+    f32 entityRadius = mesh.boundsRadius * maxScale;
 
-    PushVec3(app->uniformBuffer, app->camera.GetPosition());
-    PushUInt(app->uniformBuffer, app->lights.size());
+    return glm::length(entityCenter - center) <= entityRadius + radius;
+}
 
-    // Global Params
-    for (int i = 0; i < app->lights.size(); ++i)
+void UpdatePointShadowSlots(App* app)
+{
+    // Closest lights to the camera get the slots first
+    std::vector<u32> casters;
+    for (u32 i = 0; i < app->lights.size(); ++i)
     {
         Light& light = app->lights[i];
-
-        AlignHead(app->uniformBuffer, sizeof(vec4));
-        
-        PushUInt(app->uniformBuffer, (u32)light.type);
-        PushVec3(app->uniformBuffer, light.color);
-        PushVec3(app->uniformBuffer, light.direction);
-        PushVec3(app->uniformBuffer, light.position);
+        if (light.type == LightType::POINT && light.castShadows)
+            casters.push_back(i);
+        else
+            light.shadowSlot = UINT32_MAX;
     }
 
-    app->globalParamsSize = app->uniformBuffer.head - app->globalParamsOffset;
-    
-    // Local Params
-    for (int i = 0; i < app->entities.size(); ++i)
+    const vec3 cameraPos = app->camera.GetPosition();
+    std::sort(casters.begin(), casters.end(), [app, cameraPos](u32 a, u32 b) {
+        return glm::length(app->lights[a].position - cameraPos) < glm::length(app->lights[b].position - cameraPos);
+    });
+
+    for (u32 i = 0; i < casters.size(); ++i)
+    {
+        Light& light = app->lights[casters[i]];
+
+        bool newlyAssigned = false;
+        light.shadowSlot = app->shadowAtlas->AcquireSlot(casters[i], light.shadowSlot, app->frameIndex, newlyAssigned);
+        if (light.shadowSlot == UINT32_MAX)
+        {
+            light.shadowDirty = false;
+            continue;
+        }
+
+        // Only re-render the cube map when the light or something inside its radius has moved
+        bool dirty = newlyAssigned || light.shadowPosition != light.position || light.shadowRadius != light.radius;
+        for (u32 e = 0; e < app->entities.size() && !dirty; ++e)
+        {
+            const Entity& entity = app->entities[e];
+            if (entity.moved)
+            {
+                dirty = EntityIntersectsSphere(app, entity, entity.worldMatrix, light.position, light.radius) ||
+                        EntityIntersectsSphere(app, entity, entity.prevWorldMatrix, light.position, light.radius);
+            }
+        }
+
+        light.shadowDirty = light.shadowDirty || dirty;
+    }
+}
+
+BlockWriter<LightBlock> GetLightBlock(const Light& light)
+{
+    BlockWriter<LightBlock> block;
+    block.Set<LightBlock::TYPE>((i32)light.type);
+    block.Set<LightBlock::COLOR>(light.color);
+    block.Set<LightBlock::DIRECTION>(light.direction);
+    block.Set<LightBlock::POSITION>(light.position);
+    block.Set<LightBlock::RADIUS>(light.radius);
+    block.Set<LightBlock::SHADOW_SLOT>((i32)light.shadowSlot); // UINT32_MAX is -1, no shadow
+    return block;
+}
+
+void RequestResize(App* app, int width, int height)
+{
+    app->displaySize = ivec2(width, height);
+    app->camera.Resize(width, height);
+
+    app->resizePending = true;
+    app->resizeSettleTimer = RESIZE_SETTLE_TIME;
+}
+
+ivec2 GetRenderSize(App* app)
+{
+    return glm::max(ivec2(vec2(app->displaySize) * app->renderScale + 0.5f), ivec2(1));
+}
+
+void ResizeRenderTargets(App* app)
+{
+    // Framebuffers that follow the render size. They're allocated for the whole
+    // window, so the dynamic resolution only moves their rendered sub-rect.
+    Framebuffer* targets[] = { app->fbo1, app->fboReservoirHistory, app->fboTaaHistory[0], app->fboTaaHistory[1] };
+
+    bool fits = true;
+    for (Framebuffer* target : targets)
+    {
+        fits = fits && target->Fits(app->displaySize.x, app->displaySize.y);
+    }
+
+    // Shrinking (or growing inside the allocated textures) is free, anything
+    // else waits until a burst of resize events is over. In the meantime the
+    // old targets are stretched over the window.
+    app->resizeSettleTimer -= app->deltaTime;
+    if (!fits && app->resizeSettleTimer > 0.0f)
+        return;
+
+    const ivec2 renderSize = GetRenderSize(app);
+    for (Framebuffer* target : targets)
+    {
+        if (!target->Fits(app->displaySize.x, app->displaySize.y))
+        {
+            target->Resize(app->displaySize.x, app->displaySize.y);
+            app->taaHistoryValid = false;
+        }
+        target->Resize(renderSize.x, renderSize.y);
+    }
+    app->resizePending = false;
+}
+
+// Scales the render resolution so the GPU time of the frame graph stays under the budget
+void UpdateDynamicResolution(App* app)
+{
+    if (!app->dynamicResolution)
+    {
+        app->renderScale = DYNAMIC_RESOLUTION_MAX_SCALE;
+        return;
+    }
+
+    const f32 gpuMilliseconds = app->gpuProfiler->GetFrameMilliseconds();
+    if (!app->gpuProfiler->HasNewResults() || gpuMilliseconds <= 0.0f)
+        return;
+
+    // The cost goes with the pixel count, so the scale goes with the square root of the
+    // time. Aims a bit under the budget, and recovers slower than it drops because the
+    // timings are a few frames late.
+    f32 targetScale = app->renderScale * glm::sqrt(app->gpuBudgetMilliseconds * 0.9f / gpuMilliseconds);
+    targetScale = glm::clamp(targetScale, DYNAMIC_RESOLUTION_MIN_SCALE, DYNAMIC_RESOLUTION_MAX_SCALE);
+
+    const f32 rate = targetScale < app->renderScale ? 0.5f : 0.1f;
+    const f32 renderScale = app->renderScale + (targetScale - app->renderScale) * rate;
+
+    // Small steps aren't worth the different sub-rect
+    if (glm::abs(renderScale - app->renderScale) > 0.01f || targetScale == DYNAMIC_RESOLUTION_MAX_SCALE)
+        app->renderScale = glm::min(renderScale, DYNAMIC_RESOLUTION_MAX_SCALE);
+}
+
+// Only the assets whose file changed are reloaded, their indices stay the same
+void ReloadChangedAssets(App* app)
+{
+    for (const std::string& path : app->fileWatcher->PollChanges())
+    {
+        for (u32 i = 0; i < app->programs.size(); ++i)
+        {
+            Program& program = app->programs[i];
+            if (program.filepath != path)
+                continue;
+
+            ILOG("Reloading program %s (features 0x%x)", program.programName.c_str(), program.features);
+            program.lastWriteTimestamp = GetFileLastWriteTimestamp(path.c_str());
+            SubmitProgramCompile(app, i, ReadTextFile(path.c_str()));
+        }
+
+        for (Texture& texture : app->textures)
+        {
+            if (texture.filepath != path)
+                continue;
+
+            Image image = LoadImage(path.c_str());
+            if (!image.pixels)
+                continue;
+
+            ILOG("Reloading texture %s", path.c_str());
+            glDeleteTextures(1, &texture.handle);
+            texture.handle = CreateTexture2DFromImage(image);
+            FreeImage(image);
+
+            // Any of them may have it baked in
+            for (Impostor& impostor : app->impostors)
+                impostor.dirty = true;
+        }
+
+        for (u32 i = 0; i < app->models.size(); ++i)
+        {
+            if (app->models[i].filepath != path)
+                continue;
+
+            ILOG("Reloading model %s", path.c_str());
+            if (ReloadModel(app, i))
+            {
+                for (Light& light : app->lights)
+                    light.shadowDirty = light.shadowSlot != UINT32_MAX;
+                for (Impostor& impostor : app->impostors)
+                    impostor.dirty |= impostor.modelIdx == i;
+                app->staticBatchesDirty = true;
+            }
+        }
+    }
+}
+
+// Reads the overdraw query once it's available and picks whether this frame draws the depth pre-pass
+void UpdateDepthPrepass(App* app)
+{
+    if (app->overdrawQueryPending)
+    {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(app->overdrawQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 fragments = 0;
+            glGetQueryObjectui64v(app->overdrawQuery, GL_QUERY_RESULT, &fragments);
+
+            const ivec2 size = app->fbo1->GetSize();
+            const f32 overdraw = f32(fragments) / f32(size.x * size.y);
+            (app->overdrawQueryPrepass ? app->overdrawWithPrepass : app->overdrawWithoutPrepass) = overdraw;
+            app->overdrawQueryPending = false;
+        }
+    }
+
+    switch (app->depthPrepass)
+    {
+        case DepthPrepassMode::OFF: app->depthPrepassActive = false; break;
+        case DepthPrepassMode::ON:  app->depthPrepassActive = true; break;
+        default:
+        {
+            const bool measured = app->overdrawWithPrepass > 0.0f && app->overdrawWithoutPrepass > 0.0f;
+            const bool worthIt = !measured || app->overdrawWithoutPrepass > app->overdrawWithPrepass * DEPTH_PREPASS_SAVING_THRESHOLD;
+            app->depthPrepassActive = worthIt;
+
+            // Only a frame whose query gets issued is worth going the other way
+            if (!app->overdrawQueryPending && (!measured || app->frameIndex >= app->overdrawRemeasureFrame))
+            {
+                app->depthPrepassActive = measured ? !worthIt : app->overdrawWithPrepass == 0.0f;
+                app->overdrawRemeasureFrame = app->frameIndex + DEPTH_PREPASS_REMEASURE_FRAMES;
+            }
+        }
+    }
+
+    // Without its program the geometry pass writes the depth itself. The visibility buffer
+    // already shades every pixel once, and its pass is as cheap as a depth only one.
+    const bool visibility = app->renderMode == RenderMode::VISIBILITY && app->textureToRender == TextureToRender::FINAL_RENDER;
+    app->depthPrepassActive = app->depthPrepassActive && app->programs[app->depthPrepassIdx].ready && !visibility;
+}
+
+// Relief mapping offsets the texture coordinates per pixel and discards, it's drawn forward after the resolve
+bool DrawsInVisibilityBuffer(const Entity& entity)
+{
+    return !entity.relief;
+}
+
+// Scene wide copy of the submesh geometry in a fixed layout, which the visibility resolve indexes by draw
+void BuildVisibilityGeometry(App* app)
+{
+    std::vector<vec4> vertexData; // two per vertex
+    std::vector<u32> indexData;
+
+    for (Mesh& mesh : app->meshes)
+    {
+        for (Submesh& submesh : mesh.submeshes)
+        {
+            // Only the full detail, the triangle IDs are its gl_PrimitiveID
+            const SubmeshLod& lod = submesh.lods[0];
+            ASSERT(lod.indexCount / 3 < (1u << VISIBILITY_TRIANGLE_BITS), "Too many triangles in a submesh for the visibility buffer IDs");
+
+            // The position and the normal are always the first two attributes
+            const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+            u32 texCoordOffset = UINT32_MAX;
+            for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+            {
+                if (attribute.location == 2)
+                    texCoordOffset = attribute.offset / sizeof(float);
+            }
+
+            const u32 baseVertex = vertexData.size() / 2;
+            for (u32 v = 0; v + floatStride <= submesh.vertices.size(); v += floatStride)
+            {
+                const float* vertex = &submesh.vertices[v];
+                const vec2 texCoord = texCoordOffset != UINT32_MAX ? vec2(vertex[texCoordOffset], vertex[texCoordOffset + 1]) : vec2(0.0f);
+                vertexData.push_back(vec4(vertex[0], vertex[1], vertex[2], texCoord.x));
+                vertexData.push_back(vec4(vertex[3], vertex[4], vertex[5], texCoord.y));
+            }
+
+            submesh.visibilityFirstIndex = indexData.size();
+            for (u32 i = 0; i < lod.indexCount; ++i)
+            {
+                indexData.push_back(baseVertex + submesh.indices[lod.firstIndex + i]);
+            }
+        }
+    }
+
+    if (!app->visibilityVertexBuffer)
+    {
+        glGenBuffers(1, &app->visibilityVertexBuffer);
+        glGenBuffers(1, &app->visibilityIndexBuffer);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->visibilityVertexBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, vertexData.size() * sizeof(vec4), vertexData.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->visibilityIndexBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, indexData.size() * sizeof(u32), indexData.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    app->visibilityGeometryDirty = false;
+}
+
+// Draw list of the visibility buffer (std430), in the order RenderVisibility draws them
+void UpdateVisibilityDraws(App* app)
+{
+    if (app->visibilityGeometryDirty)
+        BuildVisibilityGeometry(app);
+
+    u32 drawCount = 0;
+    for (const Entity& entity : app->entities)
+    {
+        if (DrawsInVisibilityBuffer(entity))
+            drawCount += app->meshes[app->models[entity.modelIndex].meshIdx].submeshes.size();
+    }
+    ASSERT(drawCount < (1u << (32 - VISIBILITY_TRIANGLE_BITS)), "Too many draws for the visibility buffer IDs");
+
+    const u32 drawBufferSize = VISIBILITY_DRAW_SIZE * drawCount;
+    if (app->visibilityDrawBuffer.size < drawBufferSize)
+    {
+        glDeleteBuffers(1, &app->visibilityDrawBuffer.handle);
+        app->visibilityDrawBuffer = CreateStorageBuffer(drawBufferSize * 2);
+    }
+
+    app->visibilityTextures.clear();
+
+    MapBuffer(app->visibilityDrawBuffer, GL_WRITE_ONLY);
+    for (const Entity& entity : app->entities)
+    {
+        if (!DrawsInVisibilityBuffer(entity))
+            continue;
+
+        const Model& model = app->models[entity.modelIndex];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        const glm::mat4 normalMatrix = glm::transpose(glm::inverse(entity.worldMatrix));
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const GLuint texture = app->textures[app->materials[model.materialIdx[i]].albedoTextureIdx].handle;
+            auto it = std::find(app->visibilityTextures.begin(), app->visibilityTextures.end(), texture);
+            const u32 textureSlot = it - app->visibilityTextures.begin();
+            if (it == app->visibilityTextures.end())
+                app->visibilityTextures.push_back(texture);
+
+            PushMat4(app->visibilityDrawBuffer, entity.worldMatrix);
+            PushMat4(app->visibilityDrawBuffer, normalMatrix);
+            PushUInt(app->visibilityDrawBuffer, mesh.submeshes[i].visibilityFirstIndex);
+            PushUInt(app->visibilityDrawBuffer, textureSlot);
+            PushUInt(app->visibilityDrawBuffer, 0);
+            PushUInt(app->visibilityDrawBuffer, 0);
+        }
+    }
+    UnmapBuffer(app->visibilityDrawBuffer);
+
+    app->visibilityDrawCount = drawCount;
+}
+
+// Level of a submesh for the entity's level, submeshes with fewer levels keep their last one
+const SubmeshLod& GetSubmeshLod(const Submesh& submesh, u32 lod)
+{
+    return submesh.lods[glm::min(lod, (u32)submesh.lods.size() - 1)];
+}
+
+// Coarsest level whose simplification error, scaled by the projected bounding sphere, stays under
+// the allowed pixels. Between that and the one under MESH_LOD_HYSTERESIS of it the level stays put.
+void UpdateLods(App* app)
+{
+    const f32 pixelsPerUnit = app->camera.GetProjectionMatrix()[1][1] * app->fbo1->GetSize().y * 0.5f;
+
+    app->lodTriangleCount = 0;
+    app->fullDetailTriangleCount = 0;
+    for (Entity& entity : app->entities)
+    {
+        const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+
+        const f32 maxScale = glm::max(glm::length(vec3(entity.worldMatrix[0])), glm::max(glm::length(vec3(entity.worldMatrix[1])), glm::length(vec3(entity.worldMatrix[2]))));
+        const vec3 center = vec3(entity.worldMatrix * vec4(mesh.boundsCenter, 1.0f));
+        const f32 radius = mesh.boundsRadius * maxScale;
+        const f32 distance = glm::length(center - app->camera.GetPosition());
+
+        u32 maxLod = 0; // coarsest level within the error budget
+        u32 minLod = 0; // coarsest level within the hysteresis threshold, it doesn't go finer than that
+        if (app->lodSelection && distance > radius)
+        {
+            const f32 radiusPixels = radius / distance * pixelsPerUnit;
+            for (u32 i = 1; i < mesh.lodErrors.size(); ++i)
+            {
+                const f32 errorPixels = mesh.lodErrors[i] * radiusPixels;
+                if (errorPixels <= app->lodPixelError)
+                    maxLod = i;
+                if (errorPixels <= app->lodPixelError * MESH_LOD_HYSTERESIS)
+                    minLod = i;
+            }
+        }
+        entity.lod = glm::clamp(entity.lod, minLod, maxLod);
+
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            app->lodTriangleCount += GetSubmeshLod(submesh, entity.lod).indexCount / 3;
+            app->fullDetailTriangleCount += submesh.lods[0].indexCount / 3;
+        }
+    }
+}
+
+// The back-facing test relies on closed meshes, the relief plane is single sided (and only two triangles)
+bool DrawsWithClusterCulling(const Entity& entity)
+{
+    return !entity.relief && !entity.impostor && !entity.batched;
+}
+
+// Assigns the indirect commands of the cluster culled draws and resets them to no triangles,
+// the culling pass adds the ones that survive (see RenderClusterCulling)
+void UpdateClusterDraws(App* app)
+{
+    app->clusterCullingActive = app->clusterCulling && app->programs[app->clusterCullIdx].ready;
+
+    u32 drawCount = 0;
+    u32 indexCount = 0;
+    u32 meshletCount = 0;
+    for (Entity& entity : app->entities)
+    {
+        entity.clusterDrawIdx = UINT32_MAX;
+        if (!app->clusterCullingActive || !DrawsWithClusterCulling(entity))
+            continue;
+
+        entity.clusterDrawIdx = drawCount;
+        const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        drawCount += mesh.submeshes.size();
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            indexCount += GetSubmeshLod(submesh, entity.lod).indexCount;
+            meshletCount += GetSubmeshLod(submesh, entity.lod).meshletCount;
+        }
+    }
+
+    app->clusterDrawCount = drawCount;
+    app->clusterMeshletCount = meshletCount;
+    if (drawCount == 0)
+        return;
+
+    // Room for every triangle of every draw, each one writes into its own range
+    const u32 indexBufferSize = indexCount * sizeof(u32);
+    if (app->clusterIndexBufferSize < indexBufferSize)
+    {
+        if (!app->clusterIndexBuffer)
+            glGenBuffers(1, &app->clusterIndexBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->clusterIndexBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, indexBufferSize * 2, NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        app->clusterIndexBufferSize = indexBufferSize * 2;
+    }
+
+    const u32 drawBufferSize = CLUSTER_DRAW_COMMAND_SIZE * drawCount;
+    if (app->clusterDrawBuffer.size < drawBufferSize)
+    {
+        glDeleteBuffers(1, &app->clusterDrawBuffer.handle);
+        app->clusterDrawBuffer = CreateStorageBuffer(drawBufferSize * 2);
+    }
+
+    MapBuffer(app->clusterDrawBuffer, GL_WRITE_ONLY);
+    u32 firstIndex = 0;
+    for (const Entity& entity : app->entities)
+    {
+        if (entity.clusterDrawIdx == UINT32_MAX)
+            continue;
+
+        const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            PushUInt(app->clusterDrawBuffer, 0);          // count
+            PushUInt(app->clusterDrawBuffer, 1);          // instanceCount
+            PushUInt(app->clusterDrawBuffer, firstIndex); // firstIndex
+            PushUInt(app->clusterDrawBuffer, 0);          // baseVertex
+            PushUInt(app->clusterDrawBuffer, entity.objectIdx); // baseInstance, the draw index
+            firstIndex += GetSubmeshLod(submesh, entity.lod).indexCount;
+        }
+    }
+    UnmapBuffer(app->clusterDrawBuffer);
+}
+
+// Relief mapped entities need their own program and textures
+bool BelongsInStaticBatch(App* app, const Entity& entity)
+{
+    return app->staticBatching && entity.isStatic && !entity.relief && entity.unbatchedTimer <= 0.0f;
+}
+
+// Gribb & Hartmann, the frustum planes are sums and differences of the rows of the view projection
+bool BoxIntersectsFrustum(const glm::mat4& viewProjection, vec3 boxMin, vec3 boxMax)
+{
+    const glm::mat4 rows = glm::transpose(viewProjection);
+    for (u32 i = 0; i < 6; ++i)
+    {
+        const vec4 plane = rows[3] + (i % 2 == 0 ? 1.0f : -1.0f) * rows[i / 2];
+
+        // The corner furthest along the plane normal
+        const vec3 corner = glm::mix(boxMin, boxMax, glm::step(vec3(0.0f), vec3(plane)));
+        if (glm::dot(vec3(plane), corner) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// Merges the full detail submeshes of the static entities, transformed to world space, into one vertex and index
+// buffer. Each batch holds the triangles of one material whose entity's center falls in one chunk.
+void BuildStaticBatches(App* app)
+{
+    struct BatchSource
+    {
+        u32 materialIdx;
+        ivec3 chunk;
+        u32 entityIdx;
+        u32 submeshIdx;
+    };
+
+    std::vector<BatchSource> sources;
+    app->staticEntityCount = 0;
+    for (u32 e = 0; e < app->entities.size(); ++e)
+    {
+        Entity& entity = app->entities[e];
+        entity.batched = BelongsInStaticBatch(app, entity);
+        if (!entity.batched)
+            continue;
+
+        const Model& model = app->models[entity.modelIndex];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        const vec3 center = vec3(entity.worldMatrix * vec4(mesh.boundsCenter, 1.0f));
+        const ivec3 chunk = ivec3(glm::floor(center / STATIC_BATCH_CHUNK_SIZE));
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            sources.push_back({ model.materialIdx[i], chunk, e, i });
+        }
+        app->staticEntityCount++;
+    }
+
+    // By material and then by chunk, every batch is one contiguous range
+    std::sort(sources.begin(), sources.end(), [](const BatchSource& a, const BatchSource& b)
+    {
+        if (a.materialIdx != b.materialIdx)
+            return a.materialIdx < b.materialIdx;
+        if (a.chunk.x != b.chunk.x)
+            return a.chunk.x < b.chunk.x;
+        if (a.chunk.y != b.chunk.y)
+            return a.chunk.y < b.chunk.y;
+        return a.chunk.z < b.chunk.z;
+    });
+
+    std::vector<float> vertexData;
+    std::vector<u32> indexData;
+    app->staticBatches.clear();
+    for (u32 s = 0; s < sources.size(); ++s)
+    {
+        const BatchSource& source = sources[s];
+        if (s == 0 || source.materialIdx != sources[s - 1].materialIdx || source.chunk != sources[s - 1].chunk)
+            app->staticBatches.push_back({ source.materialIdx, (u32)indexData.size(), 0, vec3(FLT_MAX), vec3(-FLT_MAX), false });
+        StaticBatch& batch = app->staticBatches.back();
+
+        const Entity& entity = app->entities[source.entityIdx];
+        const Submesh& submesh = app->meshes[app->models[entity.modelIndex].meshIdx].submeshes[source.submeshIdx];
+
+        // What mesh.glsl does to the attributes with this world matrix
+        const glm::mat3 rotation = glm::mat3(entity.worldMatrix);
+        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(rotation));
+
+        const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+        const u32 baseVertex = vertexData.size() / STATIC_BATCH_VERTEX_FLOATS;
+        for (u32 v = 0; v + floatStride <= submesh.vertices.size(); v += floatStride)
+        {
+            // Indexed by location, the attributes a submesh doesn't have stay zero
+            vec3 attributes[5] = {};
+            for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+            {
+                for (u32 c = 0; c < attribute.componentCount; ++c)
+                    attributes[attribute.location][c] = submesh.vertices[v + attribute.offset / sizeof(float) + c];
+            }
+
+            const vec3 position = vec3(entity.worldMatrix * vec4(attributes[0], 1.0f));
+            const vec3 normal = normalMatrix * attributes[1];
+            const vec3 tangent = rotation * attributes[3];
+            const vec3 bitangent = rotation * attributes[4];
+            const float vertex[STATIC_BATCH_VERTEX_FLOATS] =
+            {
+                position.x, position.y, position.z,
+                normal.x, normal.y, normal.z,
+                attributes[2].x, attributes[2].y,
+                tangent.x, tangent.y, tangent.z,
+                bitangent.x, bitangent.y, bitangent.z,
+            };
+            vertexData.insert(vertexData.end(), vertex, vertex + STATIC_BATCH_VERTEX_FLOATS);
+
+            batch.boundsMin = glm::min(batch.boundsMin, position);
+            batch.boundsMax = glm::max(batch.boundsMax, position);
+        }
+
+        const SubmeshLod& lod = submesh.lods[0];
+        for (u32 i = 0; i < lod.indexCount; ++i)
+        {
+            indexData.push_back(baseVertex + submesh.indices[lod.firstIndex + i]);
+        }
+        batch.indexCount += lod.indexCount;
+    }
+
+    if (!app->staticVao)
+    {
+        glGenBuffers(1, &app->staticVertexBuffer);
+        glGenBuffers(1, &app->staticIndexBuffer);
+        glGenVertexArrays(1, &app->staticVao);
+
+        glBindVertexArray(app->staticVao);
+        glBindBuffer(GL_ARRAY_BUFFER, app->staticVertexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->staticIndexBuffer);
+
+        const u32 componentCounts[] = { 3, 3, 2, 3, 3 };
+        u32 offset = 0;
+        for (u32 location = 0; location < ARRAY_COUNT(componentCounts); ++location)
+        {
+            glVertexAttribPointer(location, componentCounts[location], GL_FLOAT, GL_FALSE, STATIC_BATCH_VERTEX_FLOATS * sizeof(float), (void*)(u64)offset);
+            glEnableVertexAttribArray(location);
+            offset += componentCounts[location] * sizeof(float);
+        }
+        BindDrawIndexAttribute(app);
+        glBindVertexArray(0);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, app->staticVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(float), vertexData.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // The element buffer binding belongs to the vertex array
+    glBindVertexArray(app->staticVao);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size() * sizeof(u32), indexData.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    app->staticBatchesDirty = false;
+}
+
+// Rebuilds the batches when the set of static entities changes or one of them moves anyway,
+// and culls them against this frame's frustum
+void UpdateStaticBatches(App* app)
+{
+    for (Entity& entity : app->entities)
+    {
+        // A static entity that moves leaves the batches and is drawn like the others until it's been still
+        // for a while, so dragging it rebuilds them twice instead of every frame
+        if (entity.isStatic && entity.moved)
+            entity.unbatchedTimer = STATIC_BATCH_SETTLE_TIME;
+        else
+            entity.unbatchedTimer = glm::max(entity.unbatchedTimer - app->deltaTime, 0.0f);
+
+        if (entity.batched != BelongsInStaticBatch(app, entity))
+            app->staticBatchesDirty = true;
+    }
+
+    if (app->staticBatchesDirty)
+        BuildStaticBatches(app);
+
+    app->staticBatchDrawCount = 0;
+    for (StaticBatch& batch : app->staticBatches)
+    {
+        batch.visible = BoxIntersectsFrustum(app->camera.GetViewProjection(), batch.boundsMin, batch.boundsMax);
+        app->staticBatchDrawCount += batch.visible ? 1 : 0;
+    }
+}
+
+// Direction from the model's center to the camera of a frame of its impostor atlas, the
+// octahedral mapping of the sphere with y up. impostor.glsl maps them the same way.
+vec3 GetImpostorFrameDirection(u32 x, u32 y)
+{
+    const vec2 e = (vec2(x, y) + 0.5f) / (f32)IMPOSTOR_GRID * 2.0f - 1.0f;
+    vec3 direction = vec3(e.x, 1.0f - glm::abs(e.x) - glm::abs(e.y), e.y);
+    if (direction.y < 0.0f)
+    {
+        const vec2 folded = (1.0f - glm::abs(vec2(direction.z, direction.x))) * vec2(direction.x >= 0.0f ? 1.0f : -1.0f, direction.z >= 0.0f ? 1.0f : -1.0f);
+        direction.x = folded.x;
+        direction.z = folded.y;
+    }
+    return glm::normalize(direction);
+}
+
+u32 FindImpostor(App* app, u32 modelIdx)
+{
+    for (u32 i = 0; i < app->impostors.size(); ++i)
+    {
+        if (app->impostors[i].modelIdx == modelIdx)
+            return i;
+    }
+    return UINT32_MAX;
+}
+
+// Picks the entities drawn as impostors and the atlas baked this frame, an atlas is made the first time
+// its model is far enough. Only the G-buffer pass draws them, forward shading and the visibility buffer keep the meshes.
+void UpdateImpostors(App* app)
+{
+    const bool gbufferRendered = app->textureToRender != TextureToRender::FINAL_RENDER || app->renderMode == RenderMode::DEFERRED;
+    const bool programsReady = app->programs[app->impostorIdx].ready && app->programs[GetProgramVariant(app, app->deferredIdx, 0)].ready;
+    app->impostorsActive = app->impostorRendering && gbufferRendered && programsReady;
+
+    app->impostorBakeIdx = UINT32_MAX;
+    app->impostorCount = 0;
+    for (Entity& entity : app->entities)
+    {
+        entity.impostor = false;
+        if (!app->impostorsActive || entity.relief || entity.batched)
+            continue;
+
+        const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        const vec3 center = vec3(entity.worldMatrix * vec4(mesh.boundsCenter, 1.0f));
+        if (glm::length(center - app->camera.GetPosition()) <= app->impostorDistance)
+            continue;
+
+        u32 impostorIdx = FindImpostor(app, entity.modelIndex);
+        if (impostorIdx == UINT32_MAX)
+        {
+            FramebufferSpecification atlasSpec;
+            atlasSpec.width = IMPOSTOR_GRID * IMPOSTOR_FRAME_SIZE;
+            atlasSpec.height = IMPOSTOR_GRID * IMPOSTOR_FRAME_SIZE;
+            atlasSpec.attachments = { FramebufferTextureFormat::RG16_SNORM, FramebufferTextureFormat::SRGBA8, FramebufferTextureFormat::DEPTH24 };
+
+            impostorIdx = app->impostors.size();
+            app->impostors.push_back({ entity.modelIndex, new Framebuffer(atlasSpec, app->renderTargetPool), true });
+        }
+
+        // One bake per frame, the entities of the others keep their mesh until it's their turn
+        if (app->impostors[impostorIdx].dirty)
+        {
+            if (app->impostorBakeIdx != UINT32_MAX && app->impostorBakeIdx != impostorIdx)
+                continue;
+            app->impostorBakeIdx = impostorIdx;
+        }
+
+        entity.impostor = true;
+        app->impostorCount++;
+    }
+}
+
+BlockWriter<ObjectParamsBlock> GetObjectParamsBlock(const glm::mat4& worldMatrix, const glm::mat4& worldViewProjection, const glm::mat4& currWorldViewProjection, const glm::mat4& prevWorldViewProjection)
+{
+    BlockWriter<ObjectParamsBlock> block;
+    block.Set<ObjectParamsBlock::WORLD_MATRIX>(worldMatrix);
+    block.Set<ObjectParamsBlock::WORLD_VIEW_PROJECTION>(worldViewProjection);
+    block.Set<ObjectParamsBlock::CURR_WORLD_VIEW_PROJECTION>(currWorldViewProjection);
+    block.Set<ObjectParamsBlock::PREV_WORLD_VIEW_PROJECTION>(prevWorldViewProjection);
+    return block;
+}
+
+// Object params of everything drawn this frame, packed one after the other: an entity's index is its
+// object index, then the static batches, then the frames of the impostor bake if there's one
+void UpdateObjectParams(App* app)
+{
+    app->staticObjectIdx = app->entities.size();
+    app->impostorBakeObjectIdx = app->staticObjectIdx + 1;
+    const u32 objectCount = app->impostorBakeObjectIdx + (app->impostorBakeIdx != UINT32_MAX ? IMPOSTOR_GRID * IMPOSTOR_GRID : 0);
+
+    if (app->objectBuffer.size < ObjectParamsBlock::size * objectCount)
+    {
+        glDeleteBuffers(1, &app->objectBuffer.handle);
+        app->objectBuffer = CreateStorageBuffer(ObjectParamsBlock::size * objectCount * 2);
+    }
+    ReserveDrawIndices(app, objectCount);
+
+    std::vector<BlockWriter<ObjectParamsBlock>> objects;
+    objects.reserve(objectCount);
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        Entity& entity = app->entities[i];
+        entity.objectIdx = i;
+        objects.push_back(GetObjectParamsBlock(entity.worldMatrix, app->camera.GetJitteredViewProjection() * entity.worldMatrix,
+            app->camera.GetViewProjection() * entity.worldMatrix, app->prevViewProjection * entity.prevWorldMatrix));
+    }
+
+    // The static batches are already in world space
+    objects.push_back(GetObjectParamsBlock(glm::mat4(1.0f), app->camera.GetJitteredViewProjection(), app->camera.GetViewProjection(), app->prevViewProjection));
+
+    // The frames of the impostor bake look at the model's bounding sphere from twice its radius, in model space
+    if (app->impostorBakeIdx != UINT32_MAX)
+    {
+        const Mesh& mesh = app->meshes[app->models[app->impostors[app->impostorBakeIdx].modelIdx].meshIdx];
+        const vec3 center = mesh.boundsCenter;
+        const f32 radius = mesh.boundsRadius;
+
+        const glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, radius, radius * 3.0f);
+        for (u32 y = 0; y < IMPOSTOR_GRID; ++y)
+        {
+            for (u32 x = 0; x < IMPOSTOR_GRID; ++x)
+            {
+                // Same basis as the frames in impostor.glsl
+                const vec3 direction = GetImpostorFrameDirection(x, y);
+                const vec3 worldUp = glm::abs(direction.y) > 0.999f ? vec3(0.0f, 0.0f, 1.0f) : vec3(0.0f, 1.0f, 0.0f);
+                const vec3 up = glm::cross(direction, glm::normalize(glm::cross(worldUp, direction)));
+                const glm::mat4 viewProjection = projection * glm::lookAt(center + direction * radius * 2.0f, center, up);
+                objects.push_back(GetObjectParamsBlock(glm::mat4(1.0f), viewProjection, viewProjection, viewProjection));
+            }
+        }
+    }
+
+    MapBuffer(app->objectBuffer, GL_WRITE_ONLY);
+    PushBlockArray(app->objectBuffer, objects.data(), objects.size());
+    UnmapBuffer(app->objectBuffer);
+}
+
+void Update(App* app)
+{
+    // You can handle app->input keyboard/mouse here
+    app->camera.Update(app->input, app->deltaTime);
+
+    app->frameIndex++;
+    app->renderTargetPool->BeginFrame(app->frameIndex);
+
+    ReloadChangedAssets(app);
+    UpdateProgramCompiles(app);
+
+    UpdateDynamicResolution(app);
+
+    if (app->resizePending || app->fbo1->GetSize() != GetRenderSize(app))
+    {
+        ResizeRenderTargets(app);
+    }
+
+    // A different sub-pixel offset every frame, the debug views stay still
+    if (app->taa && app->textureToRender == TextureToRender::FINAL_RENDER)
+    {
+        const u32 sample = app->frameIndex % TAA_JITTER_SAMPLES + 1;
+        app->camera.SetJitter(vec2(Camera::Halton(sample, 2), Camera::Halton(sample, 3)) - 0.5f, app->fbo1->GetSize());
+    }
+    else
+    {
+        app->camera.SetJitter(vec2(0.0f), app->fbo1->GetSize());
+        app->taaHistoryValid = false;
+    }
+
+    UpdateDepthPrepass(app);
+
+    for (int i = 0; i < app->entities.size(); ++i)
+    {
+        Entity& entity = app->entities[i];
+        entity.moved = entity.worldMatrix != entity.prevWorldMatrix;
+    }
+
+    UpdatePointShadowSlots(app);
+    UpdateStaticBatches(app);
+
+    std::vector<BlockWriter<LightBlock>> lightBlocks(app->lights.size());
+    for (u32 i = 0; i < app->lights.size(); ++i)
+    {
+        lightBlocks[i] = GetLightBlock(app->lights[i]);
+    }
+
+    // Global Params. The uniform block only has room for the first MAX_UBO_LIGHTS lights,
+    // the full list goes to the light storage buffer below
+    const u32 uboLightCount = glm::min((u32)app->lights.size(), (u32)MAX_UBO_LIGHTS);
+
+    BlockWriter<GlobalParamsBlock> globalParams;
+    globalParams.Set<GlobalParamsBlock::CAMERA_POSITION>(app->camera.GetPosition());
+    globalParams.Set<GlobalParamsBlock::LIGHT_COUNT>(uboLightCount);
+    globalParams.SetArray<GlobalParamsBlock::LIGHTS>(lightBlocks.data(), uboLightCount);
+
+    MapBuffer(app->uniformBuffer, GL_WRITE_ONLY);
+    app->globalParamsOffset = app->uniformBuffer.head;
+    PushBlock(app->uniformBuffer, globalParams);
+    app->globalParamsSize = app->uniformBuffer.head - app->globalParamsOffset;
+    UnmapBuffer(app->uniformBuffer);
+
+    // Light list
+    const u32 lightsBufferSize = LightListBlock::size + LightBlock::size * app->lights.size();
+    if (app->lightsBuffer.size < lightsBufferSize)
+    {
+        glDeleteBuffers(1, &app->lightsBuffer.handle);
+        app->lightsBuffer = CreateStorageBuffer(lightsBufferSize * 2);
+    }
+
+    BlockWriter<LightListBlock> lightList;
+    lightList.Set<LightListBlock::LIGHT_COUNT>((u32)app->lights.size());
+
+    MapBuffer(app->lightsBuffer, GL_WRITE_ONLY);
+    PushBlock(app->lightsBuffer, lightList);
+    PushBlockArray(app->lightsBuffer, lightBlocks.data(), lightBlocks.size());
+    UnmapBuffer(app->lightsBuffer);
+
+    UpdateImpostors(app);
+    UpdateObjectParams(app);
+    UpdateLods(app);
+    UpdateClusterDraws(app);
+
+    if (app->renderMode == RenderMode::VISIBILITY)
+        UpdateVisibilityDraws(app);
+}
+
+GLuint FindVAO(App* app, Mesh& mesh, u32 submeshIndex, const Program& program)
+{
+    Submesh& submesh = mesh.submeshes[submeshIndex];
+
+    for (u32 i = 0; i < submesh.vaos.size(); ++i)
+    {
+        if (submesh.vaos[i].programHandle == GetVertexProgram(program))
+            return submesh.vaos[i].handle;
+    }
+
+    GLuint vaoHandle;
+    {
+        glGenVertexArrays(1, &vaoHandle);
+        glBindVertexArray(vaoHandle);
+
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+
+        for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
+        {
+            if (program.vertexInputLayout.attributes[i].location == DRAW_INDEX_LOCATION)
+                continue;
+
+            bool attributeWasLinked = false;
+
+            for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j)
+            {
+                if (program.vertexInputLayout.attributes[i].location == submesh.vertexBufferLayout.attributes[j].location)
+                {
+                    const u32 index = submesh.vertexBufferLayout.attributes[j].location;
+                    const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
+                    const u32 offset = submesh.vertexOffset + submesh.vertexBufferLayout.attributes[j].offset;
+                    const u32 stride = submesh.vertexBufferLayout.stride;
+
+                    glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
+                    glEnableVertexAttribArray(index);
+
+                    attributeWasLinked = true;
+                    break;
+                }
+            }
+
+            assert(attributeWasLinked);
+        }
+
+        BindDrawIndexAttribute(app);
+    }
+
+    glBindVertexArray(0);
+
+    VertexArray vao = { vaoHandle, GetVertexProgram(program) };
+    submesh.vaos.push_back(vao);
+    return vaoHandle;
+}
+
+// Position only input at location 0, any program that reads nothing else can use it
+GLuint FindPositionVAO(App* app, Mesh& mesh, u32 submeshIndex)
+{
+    Submesh& submesh = mesh.submeshes[submeshIndex];
+    if (submesh.positionVao)
+        return submesh.positionVao;
+
+    glGenVertexArrays(1, &submesh.positionVao);
+    glBindVertexArray(submesh.positionVao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.positionBufferHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)(u64)submesh.positionOffset);
+    glEnableVertexAttribArray(0);
+    BindDrawIndexAttribute(app);
+
+    glBindVertexArray(0);
+    return submesh.positionVao;
+}
+
+void RenderPointShadows(App* app)
+{
+    app->shadowPassesLastFrame = 0;
+
+    // Shadow maps are cached, they stay dirty until they can be drawn with the real program
+    Program& programShadow = app->programs[app->pointShadowIdx];
+    if (!programShadow.ready)
+        return;
+
+    bool programBound = false;
+
+    for (u32 l = 0; l < app->lights.size(); ++l)
+    {
+        Light& light = app->lights[l];
+        if (!light.shadowDirty || light.shadowSlot == UINT32_MAX)
+            continue;
+
+        if (!programBound)
+        {
+            UseProgram(programShadow);
+            glEnable(GL_DEPTH_TEST);
+            programBound = true;
+        }
+
+        app->shadowAtlas->BindSlot(light.shadowSlot);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, light.radius);
+        const vec3& pos = light.position;
+        glm::mat4 shadowMatrices[6] =
+        {
+            projection * glm::lookAt(pos, pos + vec3( 1.0f,  0.0f,  0.0f), vec3(0.0f, -1.0f,  0.0f)),
+            projection * glm::lookAt(pos, pos + vec3(-1.0f,  0.0f,  0.0f), vec3(0.0f, -1.0f,  0.0f)),
+            projection * glm::lookAt(pos, pos + vec3( 0.0f,  1.0f,  0.0f), vec3(0.0f,  0.0f,  1.0f)),
+            projection * glm::lookAt(pos, pos + vec3( 0.0f, -1.0f,  0.0f), vec3(0.0f,  0.0f, -1.0f)),
+            projection * glm::lookAt(pos, pos + vec3( 0.0f,  0.0f,  1.0f), vec3(0.0f, -1.0f,  0.0f)),
+            projection * glm::lookAt(pos, pos + vec3( 0.0f,  0.0f, -1.0f), vec3(0.0f, -1.0f,  0.0f)),
+        };
+
+        SetUniform(programShadow, "shadowMatrices", shadowMatrices, 6);
+        SetUniform(programShadow, "lightPosition", light.position);
+        SetUniform(programShadow, "farPlane", light.radius);
+
+        for (u32 e = 0; e < app->entities.size(); ++e)
+        {
+            Entity& entity = app->entities[e];
+            if (!EntityIntersectsSphere(app, entity, entity.worldMatrix, light.position, light.radius))
+                continue;
+
+            Model& model = app->models[entity.modelIndex];
+            Mesh& mesh = app->meshes[model.meshIdx];
+
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            {
+                GLuint vao = FindVAO(app, mesh, i, programShadow);
+                glBindVertexArray(vao);
+
+                Submesh& submesh = mesh.submeshes[i];
+                DrawObject(GL_UNSIGNED_INT, submesh.lods[0].indexCount, submesh.indexOffset, entity.objectIdx);
+            }
+        }
+        glBindVertexArray(0);
+
+        light.shadowPosition = light.position;
+        light.shadowRadius = light.radius;
+        light.shadowDirty = false;
+        app->shadowPassesLastFrame++;
+    }
+
+    if (programBound)
+    {
+        glUseProgram(0);
+        app->shadowAtlas->Unbind();
+    }
+}
+
+// Frame graph resources of the current frame (see Render)
+struct FrameResources
+{
+    FrameGraphResource shadowMaps;
+
+    // G-buffer
+    FrameGraphResource normals;
+    FrameGraphResource albedo;
+    FrameGraphResource bright;
+    FrameGraphResource velocity;
+    FrameGraphResource depth;
+
+    FrameGraphResource forwardColor; // the only color target of the forward pass, linear HDR
+    FrameGraphResource visibility;   // R32UI triangle IDs, see VISIBILITY_TRIANGLE_BITS
+    FrameGraphResource clusterDraws; // only orders (and culls) the cluster culling pass
+    FrameGraphResource impostorAtlases; // only orders the impostor bake before the G-buffer
+    FrameGraphResource bloomSource;  // bright color, or the forward color that the prefilter thresholds
+
+    FrameGraphResource bloom[BLOOM_MIP_COUNT]; // bloom[0] is half resolution and ends up with the whole chain
+
+    FrameGraphResource reservoirsTemporal;
+    FrameGraphResource reservoirHistory;
+    FrameGraphResource stochasticLighting;
+
+    // Reduced resolution deferred lighting
+    FrameGraphResource lightingNormals;
+    FrameGraphResource lightingDepth;
+    FrameGraphResource lightingEdges; // R8, 1 where the block doesn't share one surface
+    FrameGraphResource lighting;
+
+    FrameGraphResource sceneColor; // linear HDR, the forward color in forward mode
+
+    // TAA, resolved into the history target the next frame reads
+    FrameGraphResource taaHistory;
+    FrameGraphResource taaResolved;
+    FrameGraphResource resolvedColor; // what the post pass reads, taaResolved or sceneColor
+
+    FrameGraphResource postOutput;
+
+    FrameGraphResource backbuffer;
+    FrameGraphResource backbufferDepth;
+};
+
+// Binds the G-buffer to the texture units given by GBufferAttachment, depth goes after the colors
+void BindGBufferTextures(FrameGraph& graph, const FrameResources& res)
+{
+    const FrameGraphResource attachments[] = { res.normals, res.albedo, res.bright, res.velocity, res.depth };
+    for (u32 i = 0; i < ARRAY_COUNT(attachments); ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, graph.GetTexture(attachments[i]));
+    }
+}
+
+// Tests every meshlet of the cluster culled draws against the frustum and its normal cone, one
+// workgroup per meshlet, and copies the triangles of the visible ones into the draw's index range
+void RenderClusterCulling(App* app)
+{
+    const Program& programCull = app->programs[app->clusterCullIdx];
+    UseProgram(programCull);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, app->clusterIndexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, app->clusterDrawBuffer.handle);
+
+    SetUniform(programCull, "viewProjection", app->camera.GetViewProjection());
+    SetUniform(programCull, "cameraPosition", app->camera.GetPosition());
+
+    for (const Entity& entity : app->entities)
+    {
+        if (entity.clusterDrawIdx == UINT32_MAX)
+            continue;
+
+        // The cone only stays a bound of the normals under rotations and uniform scales
+        const vec3 scale = vec3(glm::length(vec3(entity.worldMatrix[0])), glm::length(vec3(entity.worldMatrix[1])), glm::length(vec3(entity.worldMatrix[2])));
+        const f32 maxScale = glm::max(scale.x, glm::max(scale.y, scale.z));
+        const f32 minScale = glm::min(scale.x, glm::min(scale.y, scale.z));
+        SetUniform(programCull, "worldMatrix", entity.worldMatrix);
+        SetUniform(programCull, "maxScale", maxScale);
+        SetUniform(programCull, "coneCulling", (i32)(maxScale - minScale <= maxScale * 1e-3f));
+
+        const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mesh.meshletBufferHandle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, mesh.indexBufferHandle);
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const Submesh& submesh = mesh.submeshes[i];
+            const SubmeshLod& lod = GetSubmeshLod(submesh, entity.lod);
+            SetUniform(programCull, "meshletOffset", submesh.meshletOffset + lod.firstMeshlet);
+            SetUniform(programCull, "sourceFirstIndex", submesh.indexOffset / (u32)sizeof(u32));
+            SetUniform(programCull, "drawIdx", entity.clusterDrawIdx + i);
+            glDispatchCompute(lod.meshletCount, 1, 1);
+        }
+    }
+
+    // Read as indices and draw commands
+    glMemoryBarrier(GL_ELEMENT_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    glUseProgram(0);
+}
+
+// Draws the entity's level of the submesh, or what the cluster culling left of it, with its vertex array bound
+void DrawSubmesh(App* app, const Entity& entity, const Mesh& mesh, u32 submeshIndex)
+{
+    const Submesh& submesh = mesh.submeshes[submeshIndex];
+    if (entity.clusterDrawIdx == UINT32_MAX)
+    {
+        const SubmeshLod& lod = GetSubmeshLod(submesh, entity.lod);
+        DrawObject(GL_UNSIGNED_INT, lod.indexCount, submesh.indexOffset + lod.firstIndex * sizeof(u32), entity.objectIdx);
+        return;
+    }
+
+    // The element buffer is vertex array state, the mesh's goes back afterwards
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->clusterIndexBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->clusterDrawBuffer.handle);
+    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u64)((entity.clusterDrawIdx + submeshIndex) * CLUSTER_DRAW_COMMAND_SIZE));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+}
+
+// The static batches in the frustum with the bound program, binding the albedo of each material when asked to
+void DrawStaticBatches(App* app, bool bindAlbedo)
+{
+    if (app->staticBatchDrawCount == 0)
+        return;
+
+    glBindVertexArray(app->staticVao);
+
+    u32 boundMaterialIdx = UINT32_MAX;
+    for (const StaticBatch& batch : app->staticBatches)
+    {
+        if (!batch.visible)
+            continue;
+
+        if (bindAlbedo && batch.materialIdx != boundMaterialIdx)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, app->textures[app->materials[batch.materialIdx].albedoTextureIdx].handle);
+            boundMaterialIdx = batch.materialIdx;
+        }
+        DrawObject(GL_UNSIGNED_INT, batch.indexCount, batch.firstIndex * sizeof(u32), app->staticObjectIdx);
+    }
+
+    glBindVertexArray(0);
+}
+
+// Entities whose fragments can discard (relief mapping, impostors) keep writing their own depth in the geometry pass.
+// The static batches are drawn apart.
+bool DrawsInDepthPrepass(const Entity& entity)
+{
+    return !entity.relief && !entity.impostor && !entity.batched;
+}
+
+// Depth of the opaque entities, from the position only vertex stream
+void RenderDepthPrepass(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    graph.BindRenderTargets({}, res.depth);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    Program& programPrepass = app->programs[app->depthPrepassIdx];
+    UseProgram(programPrepass);
+
+    for (const Entity& entity : app->entities)
+    {
+        if (!DrawsInDepthPrepass(entity))
+            continue;
+
+        Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            glBindVertexArray(FindPositionVAO(app, mesh, i));
+            DrawSubmesh(app, entity, mesh, i);
+        }
+    }
+
+    DrawStaticBatches(app, false);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// The scene entities with the geometry pass variant of their program, into whatever targets are bound.
+// After the visibility buffer only the entities it leaves out are drawn.
+void DrawEntities(App* app, ShaderFeatures features, bool skipVisibilityBuffer = false)
+{
+    // The TAA accumulation makes up for a shorter relief march
+    const bool temporalLayers = app->taa && app->textureToRender == TextureToRender::FINAL_RENDER;
+    const f32 layerScale = temporalLayers ? app->taaReliefLayerScale : 1.0f;
+
+    // Fragments that pass the depth test, read back in UpdateDepthPrepass
+    const bool measureOverdraw = !app->overdrawQueryPending && !skipVisibilityBuffer;
+    if (measureOverdraw)
+    {
+        glBeginQuery(GL_SAMPLES_PASSED, app->overdrawQuery);
+        app->overdrawQueryPending = true;
+        app->overdrawQueryPrepass = app->depthPrepassActive;
+    }
+    
+    for (int i = 0; i < app->entities.size(); ++i)
+    {
+        Entity& entity = app->entities[i];
+        if (skipVisibilityBuffer && DrawsInVisibilityBuffer(entity))
+            continue;
+        if (entity.impostor || entity.batched)
+            continue;
+
+        // After the pre-pass only the closest surface of each pixel passes, and gets shaded once
+        const bool depthFromPrepass = app->depthPrepassActive && DrawsInDepthPrepass(entity);
+        glDepthFunc(depthFromPrepass ? GL_EQUAL : GL_LESS);
+        glDepthMask(depthFromPrepass ? GL_FALSE : GL_TRUE);
+
+        u32 programIdx = GetProgramVariant(app, entity.relief ? app->reliefIdx : app->deferredIdx, features);
+        Program& program = app->programs[programIdx];
+        UseProgram(program);
+
+        SetUniform(program, "shadowMaps", 7);
+
+        Model& model = app->models[entity.modelIndex];
+        Mesh& mesh = app->meshes[model.meshIdx];
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            GLuint vao = FindVAO(app, mesh, i, program);
+            glBindVertexArray(vao);
+
+            u32 submeshMaterialIdx = model.materialIdx[i];
+            Material& submeshMaterial = app->materials[submeshMaterialIdx];
+
+            SetUniform(program, "uTexture", 0);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
+            if (entity.relief)
+            {
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, app->textures[app->diffuseWallTexIdx].handle);
+                SetUniform(program, "uTexture", 0);
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, app->textures[app->normalMapTexIdx].handle);
+                SetUniform(program, "normalTexture", 1);
+                glActiveTexture(GL_TEXTURE2);
+                glBindTexture(GL_TEXTURE_2D, app->textures[app->depthMapTexIdx].handle);
+                SetUniform(program, "depthTexture", 2);
+                
+                SetUniform(program, "minLayers", glm::max(app->minLayers * layerScale, 1.0f));
+                SetUniform(program, "maxLayers", glm::max(app->maxLayers * layerScale, 1.0f));
+                SetUniform(program, "heightScale", app->heightScale);
+                SetUniform(program, "temporalLayers", (GLint)temporalLayers);
+                SetUniform(program, "frameIndex", (u32)app->frameIndex);
+            }
+
+            SetUniform(program, "viewPos", app->camera.GetPosition());
+
+            DrawSubmesh(app, entity, mesh, i);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        glBindVertexArray(0);
+    }
+
+    // The visibility buffer already has the static entities
+    if (!skipVisibilityBuffer && app->staticBatchDrawCount > 0)
+    {
+        glDepthFunc(app->depthPrepassActive ? GL_EQUAL : GL_LESS);
+        glDepthMask(app->depthPrepassActive ? GL_FALSE : GL_TRUE);
+
+        Program& program = app->programs[GetProgramVariant(app, app->deferredIdx, features)];
+        UseProgram(program);
+        SetUniform(program, "shadowMaps", 7);
+        SetUniform(program, "uTexture", 0);
+        SetUniform(program, "viewPos", app->camera.GetPosition());
+
+        DrawStaticBatches(app, true);
+    }
+    glUseProgram(0);
+
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    if (measureOverdraw)
+        glEndQuery(GL_SAMPLES_PASSED);
+}
+
+// The light sources drawn as unlit shapes
+void DrawLights(App* app, ShaderFeatures features)
+{
+    Program& programLights = app->programs[GetProgramVariant(app, app->lightsIdx, features)];
+    UseProgram(programLights);
+
+    for (int i = 0; programLights.ready && i < app->lights.size(); ++i)
+    {
+        Light& light = app->lights[i];
+
+        glm::mat4 modelMatrix = glm::translate(light.position);
+        modelMatrix = glm::scale(modelMatrix, vec3(0.4));
+
+        SetUniform(programLights, "modelMatrix", modelMatrix);
+        SetUniform(programLights, "color", light.color);
+        SetUniform(programLights, "viewProjectionMatrix", app->camera.GetJitteredViewProjection());
+        SetUniform(programLights, "currViewProjectionMatrix", app->camera.GetViewProjection());
+        SetUniform(programLights, "prevViewProjectionMatrix", app->prevViewProjection);
+
+        if (light.type == LightType::POINT)
+        {
+            Model& model = app->models[app->sphereIdx];
+            Mesh& mesh = app->meshes[model.meshIdx];
+
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            {
+                GLuint vao = FindVAO(app, mesh, i, programLights);
+                glBindVertexArray(vao);
+
+                u32 submeshMaterialIdx = model.materialIdx[i];
+                Material& submeshMaterial = app->materials[submeshMaterialIdx];
+
+                Submesh& submesh = mesh.submeshes[i];
+                glDrawElements(GL_TRIANGLES, submesh.lods[0].indexCount, GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+            }
+            glBindVertexArray(0);
+        }
+        else if (light.type == LightType::DIRECTIONAL)
+        {
+            glBindVertexArray(app->vao);
+            glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+            glBindVertexArray(0);
+        }
+    }
+    glUseProgram(0);
+}
+
+// Renders the model of the impostor baked this frame into every frame of its atlas with the G-buffer
+// program, each one with its own object params (see UpdateObjectParams)
+void BakeImpostor(App* app)
+{
+    Impostor& impostor = app->impostors[app->impostorBakeIdx];
+    Model& model = app->models[impostor.modelIdx];
+    Mesh& mesh = app->meshes[model.meshIdx];
+
+    impostor.atlas->Bind();
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+
+    Program& program = app->programs[GetProgramVariant(app, app->deferredIdx, 0)];
+    UseProgram(program);
+    SetUniform(program, "uTexture", 0);
+    SetUniform(program, "shadowMaps", 7);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+    for (u32 frame = 0; frame < IMPOSTOR_GRID * IMPOSTOR_GRID; ++frame)
+    {
+        glViewport((frame % IMPOSTOR_GRID) * IMPOSTOR_FRAME_SIZE, (frame / IMPOSTOR_GRID) * IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE);
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            glBindVertexArray(FindVAO(app, mesh, i, program));
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, app->textures[app->materials[model.materialIdx[i]].albedoTextureIdx].handle);
+
+            Submesh& submesh = mesh.submeshes[i];
+            DrawObject(GL_UNSIGNED_INT, submesh.lods[0].indexCount, submesh.indexOffset, app->impostorBakeObjectIdx + frame);
+        }
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glDisable(GL_FRAMEBUFFER_SRGB);
+    impostor.atlas->Unbind();
+
+    impostor.dirty = false;
+}
+
+// The entities past the impostor distance, one camera facing quad each sampling the atlas of their model
+void DrawImpostors(App* app)
+{
+    if (app->impostorCount == 0)
+        return;
+
+    Program& program = app->programs[app->impostorIdx];
+    UseProgram(program);
+    SetUniform(program, "atlasNormals", 0);
+    SetUniform(program, "atlasAlbedo", 1);
+    SetUniform(program, "atlasDepth", 2);
+    SetUniform(program, "frameGrid", (i32)IMPOSTOR_GRID);
+
+    // Filtered normals and albedo, the depth is only averaged where the frames cover the pixel
+    glBindSampler(0, app->linearClampSampler);
+    glBindSampler(1, app->linearClampSampler);
+    glBindVertexArray(app->vao);
+
+    for (const Entity& entity : app->entities)
     {
-        AlignHead(app->uniformBuffer, app->uniformBlockAlignment);
-        Entity& entity = app->entities[i];
-        glm::mat4 worldViewProj = app->camera.GetViewProjection() * entity.worldMatrix;
+        if (!entity.impostor)
+            continue;
 
-        entity.localParamsOffset = app->uniformBuffer.head;
-        PushMat4(app->uniformBuffer, entity.worldMatrix);
-        PushMat4(app->uniformBuffer, worldViewProj);
-        entity.localParamsSize = app->uniformBuffer.head - entity.localParamsOffset;
+        Impostor& impostor = app->impostors[FindImpostor(app, entity.modelIndex)];
+        const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        SetUniform(program, "boundsCenter", mesh.boundsCenter);
+        SetUniform(program, "boundsRadius", mesh.boundsRadius);
+        SetUniform(program, "atlasUVScale", impostor.atlas->GetUVScale());
+
+        for (u32 i = 0; i < 3; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, i < 2 ? impostor.atlas->GetColorAttachment(i) : impostor.atlas->GetDepthAttachment());
+        }
+
+        DrawObject(GL_UNSIGNED_SHORT, sizeof(indices) / sizeof(u16), 0, entity.objectIdx);
     }
-    
-    UnmapBuffer(app->uniformBuffer);
+
+    glBindVertexArray(0);
+    glBindSampler(0, 0);
+    glBindSampler(1, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+void RenderGBuffer(App* app, FrameGraph& graph, const FrameResources& res)
 {
-    Submesh& submesh = mesh.submeshes[submeshIndex];
+    graph.BindRenderTargets({ res.normals, res.albedo, res.bright, res.velocity }, res.depth);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(app->depthPrepassActive ? GL_COLOR_BUFFER_BIT : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    for (u32 i = 0; i < submesh.vaos.size(); ++i)
+    // Albedo and bright color are sRGB targets, encode on write
+    glEnable(GL_FRAMEBUFFER_SRGB);
+
+    glEnable(GL_DEPTH_TEST);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+    DrawEntities(app, 0);
+    DrawImpostors(app);
+    DrawLights(app, 0);
+
+    glDisable(GL_FRAMEBUFFER_SRGB);
+}
+
+// Forward shading straight into one linear HDR target, none of the G-buffer attachments are written
+void RenderForward(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    graph.BindRenderTargets({ res.forwardColor }, res.depth);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(app->depthPrepassActive ? GL_COLOR_BUFFER_BIT : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glEnable(GL_DEPTH_TEST);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+    app->shadowAtlas->BindTexture(7);
+
+    DrawEntities(app, SHADER_FEATURE_FORWARD);
+    DrawLights(app, SHADER_FEATURE_FORWARD);
+}
+
+// Triangle IDs and depth of the entities in the visibility buffer, from the position only stream
+void RenderVisibility(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    graph.BindRenderTargets({ res.visibility }, res.depth);
+    glDepthMask(GL_TRUE);
+    const GLuint backgroundId = VISIBILITY_BACKGROUND_ID;
+    glClearBufferuiv(GL_COLOR, 0, &backgroundId);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+
+    Program& programVisibility = app->programs[app->visibilityIdx];
+    UseProgram(programVisibility);
+    SetUniform(programVisibility, "triangleBits", (u32)VISIBILITY_TRIANGLE_BITS);
+
+    // Same order as UpdateVisibilityDraws
+    u32 drawId = 0;
+    for (const Entity& entity : app->entities)
     {
-        if (submesh.vaos[i].handle == program.handle)
-            return submesh.vaos[i].handle;
+        if (!DrawsInVisibilityBuffer(entity))
+            continue;
+
+        Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            glBindVertexArray(FindPositionVAO(app, mesh, i));
+            SetUniform(programVisibility, "drawId", drawId++);
+
+            Submesh& submesh = mesh.submeshes[i];
+            DrawObject(GL_UNSIGNED_INT, submesh.lods[0].indexCount, submesh.indexOffset, entity.objectIdx);
+        }
     }
 
-    GLuint vaoHandle;
-    {
-        glGenVertexArrays(1, &vaoHandle);
-        glBindVertexArray(vaoHandle);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+// Fetches the triangle of every pixel, interpolates its attributes and shades it into the scene color.
+// Samplers can't be indexed per pixel, so each dispatch binds VISIBILITY_TEXTURE_SLOTS albedo textures
+// and shades the pixels whose draw uses one of them. The first one also clears the background.
+void RenderVisibilityResolve(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    const ivec2 size = graph.GetSize(res.sceneColor);
 
-        for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
-        {
-            bool attributeWasLinked = false;
+    const Program& programResolve = app->programs[app->visibilityResolveIdx];
+    UseProgram(programResolve);
 
-            for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j)
-            {
-                if (program.vertexInputLayout.attributes[i].location == submesh.vertexBufferLayout.attributes[j].location)
-                {
-                    const u32 index = submesh.vertexBufferLayout.attributes[j].location;
-                    const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-                    const u32 offset = submesh.vertexBufferLayout.attributes[j].offset;
-                    const u32 stride = submesh.vertexBufferLayout.stride;
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, app->visibilityVertexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, app->visibilityIndexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, app->visibilityDrawBuffer.handle);
 
-                    glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
-                    glEnableVertexAttribArray(index);
+    glActiveTexture(GL_TEXTURE0 + VISIBILITY_TEXTURE_SLOTS);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.visibility));
+    app->shadowAtlas->BindTexture(VISIBILITY_TEXTURE_SLOTS + 1);
+    glBindImageTexture(0, graph.GetTexture(res.sceneColor), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R11F_G11F_B10F);
 
-                    attributeWasLinked = true;
-                    break;
-                }
-            }
+    SetUniform(programResolve, "visibility", VISIBILITY_TEXTURE_SLOTS);
+    SetUniform(programResolve, "shadowMaps", VISIBILITY_TEXTURE_SLOTS + 1);
+    for (i32 i = 0; i < VISIBILITY_TEXTURE_SLOTS; ++i)
+    {
+        SetUniform(programResolve, ("albedoTextures[" + std::to_string(i) + "]").c_str(), i);
+    }
+    SetUniform(programResolve, "viewProjection", app->camera.GetJitteredViewProjection());
+    SetUniform(programResolve, "size", vec2(size));
+    SetUniform(programResolve, "triangleBits", (u32)VISIBILITY_TRIANGLE_BITS);
 
-            assert(attributeWasLinked);
+    const u32 textureCount = glm::max((u32)app->visibilityTextures.size(), 1u);
+    for (u32 firstSlot = 0; firstSlot < textureCount; firstSlot += VISIBILITY_TEXTURE_SLOTS)
+    {
+        for (u32 i = 0; i < VISIBILITY_TEXTURE_SLOTS; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, firstSlot + i < app->visibilityTextures.size() ? app->visibilityTextures[firstSlot + i] : 0);
         }
+
+        SetUniform(programResolve, "firstTextureSlot", firstSlot);
+        glDispatchCompute((size.x + 7) / 8, (size.y + 7) / 8, 1);
     }
 
+    // Drawn over and sampled afterwards
+    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R11F_G11F_B10F);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(0);
+}
+
+// What the visibility buffer leaves out (relief entities and lights), shaded forward over the resolve
+void RenderVisibilityForward(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    graph.BindRenderTargets({ res.sceneColor }, res.depth);
+
+    glEnable(GL_DEPTH_TEST);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+    app->shadowAtlas->BindTexture(7);
+
+    DrawEntities(app, SHADER_FEATURE_FORWARD, true);
+    DrawLights(app, SHADER_FEATURE_FORWARD);
+}
+
+void RenderBloom(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(app->vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindSampler(0, app->linearClampSampler);
+
+    auto drawLevel = [app, &graph](const Program& program, FrameGraphResource source, FrameGraphResource target)
+    {
+        graph.BindRenderTargets({ target });
+        SetUniform(program, "sourceUVScale", graph.GetUVScale(source));
+        glBindTexture(GL_TEXTURE_2D, graph.GetTexture(source));
+        glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+    };
+
+    // Threshold while going to half resolution
+    Program& programPrefilter = app->programs[app->bloomPrefilterIdx];
+    UseProgram(programPrefilter);
+    SetUniform(programPrefilter, "threshold", app->bloomThreshold);
+    SetUniform(programPrefilter, "knee", app->bloomKnee);
+    drawLevel(programPrefilter, res.bloomSource, res.bloom[0]);
+
+    Program& programDownsample = app->programs[app->bloomDownsampleIdx];
+    UseProgram(programDownsample);
+    for (u32 i = 1; i < BLOOM_MIP_COUNT; ++i)
+        drawLevel(programDownsample, res.bloom[i - 1], res.bloom[i]);
+
+    // Each level is added onto the one above, bloom[0] ends up with all of them
+    Program& programUpsample = app->programs[app->bloomUpsampleIdx];
+    UseProgram(programUpsample);
+    SetUniform(programUpsample, "filterRadius", app->bloomRadius);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (u32 i = BLOOM_MIP_COUNT - 1; i > 0; --i)
+        drawLevel(programUpsample, res.bloom[i], res.bloom[i - 1]);
+    glDisable(GL_BLEND);
+
+    glBindSampler(0, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// Initial candidates + temporal reuse of last frame's final reservoirs
+void RenderReservoirsTemporal(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    glDisable(GL_DEPTH_TEST);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, app->lightsBuffer.handle);
+    glBindVertexArray(app->vao);
+
+    BindGBufferTextures(graph, res);
+
+    Program& programTemporal = app->programs[app->restirTemporalIdx];
+    UseProgram(programTemporal);
+    graph.BindRenderTargets({ res.reservoirsTemporal });
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.reservoirHistory));
+
+    SetUniform(programTemporal, "normals", GBUFFER_NORMALS);
+    SetUniform(programTemporal, "colors", GBUFFER_ALBEDO);
+    SetUniform(programTemporal, "depth", GBUFFER_COLOR_COUNT);
+    SetUniform(programTemporal, "inverseViewProjection", glm::inverse(app->camera.GetJitteredViewProjection()));
+    SetUniform(programTemporal, "uvScale", graph.GetUVScale(res.depth));
+    SetUniform(programTemporal, "reservoirs", 3);
+    SetUniform(programTemporal, "frameIndex", (u32)app->frameIndex);
+    SetUniform(programTemporal, "prevViewProjection", app->prevViewProjection);
+    SetUniform(programTemporal, "candidateCount", app->lightCandidates);
+    SetUniform(programTemporal, "temporalReuse", (GLint)app->temporalReuse);
+
+    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+
     glBindVertexArray(0);
+    glUseProgram(0);
+}
 
-    VertexArray vao = { vaoHandle, program.handle };
-    submesh.vaos.push_back(vao);
-    return vaoHandle;
+// Spatial reuse + shading of the selected light
+void RenderReservoirsSpatial(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    glDisable(GL_DEPTH_TEST);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, app->lightsBuffer.handle);
+    glBindVertexArray(app->vao);
+
+    BindGBufferTextures(graph, res);
+
+    Program& programSpatial = app->programs[app->restirSpatialIdx];
+    UseProgram(programSpatial);
+    graph.BindRenderTargets({ res.reservoirHistory, res.stochasticLighting });
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.reservoirsTemporal));
+    app->shadowAtlas->BindTexture(7);
+
+    SetUniform(programSpatial, "normals", GBUFFER_NORMALS);
+    SetUniform(programSpatial, "colors", GBUFFER_ALBEDO);
+    SetUniform(programSpatial, "depth", GBUFFER_COLOR_COUNT);
+    SetUniform(programSpatial, "inverseViewProjection", glm::inverse(app->camera.GetJitteredViewProjection()));
+    SetUniform(programSpatial, "uvScale", graph.GetUVScale(res.depth));
+    SetUniform(programSpatial, "reservoirs", 3);
+    SetUniform(programSpatial, "shadowMaps", 7);
+    SetUniform(programSpatial, "frameIndex", (u32)app->frameIndex);
+    SetUniform(programSpatial, "spatialSamples", app->spatialSamples);
+    SetUniform(programSpatial, "spatialRadius", app->spatialRadius);
+
+    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// Picks one pixel of every block for the reduced resolution lighting and flags the blocks that straddle an edge
+void RenderLightingDownsample(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    graph.BindRenderTargets({ res.lightingNormals, res.lightingEdges }, res.lightingDepth);
+
+    // Every texel writes its depth
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindVertexArray(app->vao);
+
+    BindGBufferTextures(graph, res);
+
+    Program& programDownsample = app->programs[app->lightingDownsampleIdx];
+    UseProgram(programDownsample);
+    SetUniform(programDownsample, "normals", GBUFFER_NORMALS);
+    SetUniform(programDownsample, "colors", GBUFFER_ALBEDO);
+    SetUniform(programDownsample, "depth", GBUFFER_COLOR_COUNT);
+    SetUniform(programDownsample, "factor", app->lightingDownscale);
+    SetUniform(programDownsample, "size", vec2(graph.GetSize(res.depth)));
+    SetUniform(programDownsample, "inverseViewProjection", glm::inverse(app->camera.GetJitteredViewProjection()));
+    SetUniform(programDownsample, "uvScale", graph.GetUVScale(res.depth));
+
+    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+
+    glDepthFunc(GL_LESS);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// The deferred light loop over the downsampled G-buffer, without the albedo
+void RenderReducedLighting(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    graph.BindRenderTargets({ res.lighting });
+    glDisable(GL_DEPTH_TEST);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindVertexArray(app->vao);
+
+    u32 programIdx = GetProgramVariant(app, app->finalQuadIdx, SHADER_FEATURE_LIGHTING_ONLY);
+    Program& programLighting = app->programs[programIdx];
+    UseProgram(programLighting);
+
+    glActiveTexture(GL_TEXTURE0 + GBUFFER_NORMALS);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.lightingNormals));
+    glActiveTexture(GL_TEXTURE0 + GBUFFER_COLOR_COUNT);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.lightingDepth));
+    app->shadowAtlas->BindTexture(7);
+
+    SetUniform(programLighting, "normals", GBUFFER_NORMALS);
+    SetUniform(programLighting, "depth", GBUFFER_COLOR_COUNT);
+    SetUniform(programLighting, "shadowMaps", 7);
+    SetUniform(programLighting, "inverseViewProjection", glm::inverse(app->camera.GetJitteredViewProjection()));
+    SetUniform(programLighting, "uvScale", graph.GetUVScale(res.lightingDepth));
+
+    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// Deferred lighting into the scene color, or one of the G-buffer debug views straight to the backbuffer
+void RenderComposite(App* app, FrameGraph& graph, const FrameResources& res, bool stochasticActive, bool reducedLighting)
+{
+    if (app->textureToRender == TextureToRender::FINAL_RENDER)
+    {
+        graph.BindRenderTargets({ res.sceneColor });
+        glDisable(GL_DEPTH_TEST);
+    }
+    else
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+        glClearColor(0.0, 0.0, 0.0, 1.0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    ShaderFeatures features = 0;
+    if (stochasticActive)
+        features |= SHADER_FEATURE_STOCHASTIC;
+    if (reducedLighting)
+        features |= SHADER_FEATURE_REDUCED_LIGHTING;
+    switch (app->textureToRender)
+    {
+        case TextureToRender::POSITIONS: features |= SHADER_FEATURE_DEBUG_POSITIONS; break;
+        case TextureToRender::NORMALS:   features |= SHADER_FEATURE_DEBUG_NORMALS; break;
+        case TextureToRender::ALBEDO:    features |= SHADER_FEATURE_DEBUG_ALBEDO; break;
+        case TextureToRender::DEPTH:     features |= SHADER_FEATURE_DEBUG_DEPTH; break;
+        default:;
+    }
+
+    u32 programIdx = GetProgramVariant(app, app->renderMode == RenderMode::FORWARD ? app->quadForwardIdx : app->finalQuadIdx, features);
+    Program& programQuad = app->programs[programIdx];
+    UseProgram(programQuad);
+    glBindVertexArray(app->vao);
+
+    BindGBufferTextures(graph, res);
+
+    // Culled inputs have no texture, nothing samples them
+    app->shadowAtlas->BindTexture(7);
+
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.stochasticLighting));
+
+    if (reducedLighting)
+    {
+        glActiveTexture(GL_TEXTURE11);
+        glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.lightingNormals));
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.lightingDepth));
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.lighting));
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.lightingEdges));
+
+        SetUniform(programQuad, "lightingNormals", 11);
+        SetUniform(programQuad, "lightingDepth", 12);
+        SetUniform(programQuad, "lighting", 9);
+        SetUniform(programQuad, "lightingEdges", 10);
+        SetUniform(programQuad, "lightingSize", vec2(graph.GetSize(res.lighting)));
+    }
+
+    SetUniform(programQuad, "normals", GBUFFER_NORMALS);
+    SetUniform(programQuad, "colors", GBUFFER_ALBEDO);
+    SetUniform(programQuad, "depth", GBUFFER_COLOR_COUNT);
+    SetUniform(programQuad, "inverseViewProjection", glm::inverse(app->camera.GetJitteredViewProjection()));
+    SetUniform(programQuad, "uvScale", graph.GetUVScale(res.depth));
+    SetUniform(programQuad, "shadowMaps", 7);
+    SetUniform(programQuad, "stochasticLighting", 8);
+
+    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// Blends the jittered scene color with the reprojected history, into the other history target.
+// Without a velocity target (forward) every pixel is reprojected with the camera motion alone.
+void RenderTaaResolve(App* app, FrameGraph& graph, const FrameResources& res, bool objectMotion)
+{
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(app->vao);
+
+    Program& programResolve = app->programs[app->taaResolveIdx];
+    UseProgram(programResolve);
+    graph.BindRenderTargets({ res.taaResolved });
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.sceneColor));
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.taaHistory));
+    glBindSampler(1, app->linearClampSampler);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.velocity));
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.depth));
+
+    // The history keeps the sub-rect of the render size it was resolved at, which
+    // the dynamic resolution may have changed since
+    const vec2 historyUVScale = vec2(app->taaHistorySize) / vec2(graph.GetSize(res.taaHistory)) * graph.GetUVScale(res.taaHistory);
+
+    SetUniform(programResolve, "sceneColor", 0);
+    SetUniform(programResolve, "history", 1);
+    SetUniform(programResolve, "velocity", 2);
+    SetUniform(programResolve, "depth", 3);
+    SetUniform(programResolve, "uvScale", graph.GetUVScale(res.sceneColor));
+    SetUniform(programResolve, "historyUVScale", historyUVScale);
+    // Depth comes from the jittered G-buffer, so positions are rebuilt with the same jitter
+    SetUniform(programResolve, "inverseViewProjection", glm::inverse(app->camera.GetJitteredViewProjection()));
+    SetUniform(programResolve, "prevViewProjection", app->prevViewProjection);
+    SetUniform(programResolve, "feedback", app->taaFeedback);
+    SetUniform(programResolve, "historyValid", (GLint)app->taaHistoryValid);
+    SetUniform(programResolve, "objectMotion", (GLint)objectMotion);
+
+    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+
+    glBindSampler(1, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// Exposure, bloom, tone mapping and sRGB encoding of the scene color in one compute
+// dispatch, which also gathers the luminance histogram. A second single group
+// dispatch adapts the exposure the next frame uses.
+void RenderPost(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    const ivec2 size = graph.GetSize(res.resolvedColor);
+
+    u32 programIdx = GetProgramVariant(app, app->postIdx, app->hdr ? SHADER_FEATURE_HDR : 0);
+    const Program& programPost = app->programs[programIdx];
+    const Program& programAdapt = app->programs[app->exposureAdaptIdx];
+
+    // Compute programs have no fallback, until they're ready the scene color is copied as is
+    if (!programPost.ready || !programAdapt.ready)
+    {
+        graph.BindRenderTargets({ res.resolvedColor });
+        GLint sceneFramebuffer;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &sceneFramebuffer);
+
+        graph.BindRenderTargets({ res.postOutput });
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFramebuffer);
+        glBlitFramebuffer(0, 0, size.x, size.y, 0, 0, size.x, size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        return;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, app->exposureBuffer.handle);
+
+    UseProgram(programPost);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.resolvedColor));
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.bloom[0]));
+    glBindSampler(1, app->linearClampSampler);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, app->tonemapLUT);
+    glBindImageTexture(0, graph.GetTexture(res.postOutput), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+    SetUniform(programPost, "sceneColor", 0);
+    SetUniform(programPost, "bloom", 1);
+    SetUniform(programPost, "tonemapLUT", 2);
+    SetUniform(programPost, "size", vec2(size));
+    SetUniform(programPost, "bloomUVScale", graph.GetUVScale(res.bloom[0]));
+    SetUniform(programPost, "bloomIntensity", app->bloomIntensity);
+    SetUniform(programPost, "lutMinLog", TONEMAP_LUT_MIN_LOG);
+    SetUniform(programPost, "lutLogRange", TONEMAP_LUT_MAX_LOG - TONEMAP_LUT_MIN_LOG);
+    SetUniform(programPost, "minLogLuminance", EXPOSURE_MIN_LOG_LUMINANCE);
+    SetUniform(programPost, "logLuminanceRange", EXPOSURE_MAX_LOG_LUMINANCE - EXPOSURE_MIN_LOG_LUMINANCE);
+
+    glDispatchCompute((size.x + 15) / 16, (size.y + 15) / 16, 1);
+    // The upscale samples postOutput as a texture, the blit reads it through a framebuffer
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    UseProgram(programAdapt);
+    SetUniform(programAdapt, "minLogLuminance", EXPOSURE_MIN_LOG_LUMINANCE);
+    SetUniform(programAdapt, "logLuminanceRange", EXPOSURE_MAX_LOG_LUMINANCE - EXPOSURE_MIN_LOG_LUMINANCE);
+    SetUniform(programAdapt, "pixelCount", f32(size.x * size.y));
+    SetUniform(programAdapt, "deltaTime", app->deltaTime);
+    SetUniform(programAdapt, "adaptationSpeed", app->exposureAdaptationSpeed);
+    SetUniform(programAdapt, "exposureCompensation", app->exposureCompensation);
+
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glBindSampler(1, 0);
+    glUseProgram(0);
+}
+
+// Final image to the window. At the window size it's a copy, otherwise it goes through
+// the spatial upscale (also while a resize settles and the targets lag behind).
+void RenderPresent(App* app, FrameGraph& graph, const FrameResources& res)
+{
+    const ivec2 postSize = graph.GetSize(res.postOutput);
+    const Program& programUpscale = app->programs[app->upscaleIdx];
+
+    if (postSize == app->displaySize || !programUpscale.ready)
+    {
+        graph.BindRenderTargets({ res.postOutput });
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, postSize.x, postSize.y, 0, 0, app->displaySize.x, app->displaySize.y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(app->vao);
+
+    UseProgram(programUpscale);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, graph.GetTexture(res.postOutput));
+    glBindSampler(0, app->linearClampSampler);
+
+    SetUniform(programUpscale, "image", 0);
+    SetUniform(programUpscale, "uvScale", graph.GetUVScale(res.postOutput));
+    SetUniform(programUpscale, "sharpness", app->upscaleSharpness);
+
+    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
+
+    glBindSampler(0, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
 }
 
 void Render(App* app)
@@ -646,230 +3129,269 @@ void Render(App* app)
                 //   (...and make its texture sample from unit 0)
                 // - bind the vao
                 // - glDrawElements() !!!
-                glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-                
-                app->fbo1->Bind();
-                glClearColor(0.0, 0.0, 0.0, 1.0);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                FrameGraph& graph = *app->frameGraph;
+                graph.Reset();
+
+                const bool finalRender = app->textureToRender == TextureToRender::FINAL_RENDER;
+
+                // Forward and the visibility buffer shade without the G-buffer, their debug views still render it.
+                // The visibility buffer renders deferred until its programs are compiled.
+                const bool visibilityReady = app->programs[app->visibilityIdx].ready && app->programs[app->visibilityResolveIdx].ready;
+                const bool forward = app->renderMode == RenderMode::FORWARD && finalRender;
+                const bool visibility = app->renderMode == RenderMode::VISIBILITY && finalRender && visibilityReady;
+                const bool deferred = !forward && !visibility;
+                const bool stochasticActive = app->stochasticLighting && deferred && finalRender;
+                const bool reducedLighting = app->lightingDownscale > 1 && deferred && finalRender && !stochasticActive;
+                const bool taaActive = app->taa && finalRender && app->programs[app->taaResolveIdx].ready;
+
+                // Resources
+                FrameResources res;
+                Framebuffer* gbuffer = app->fbo1;
+                const ivec2 size = gbuffer->GetSize();
+                const ivec2 allocatedSize = gbuffer->GetAllocatedSize();
+
+                // Only used to order (and cull) the shadow pass
+                res.shadowMaps = graph.ImportTexture("Point shadow maps", 0, FramebufferTextureFormat::NONE, ivec2(SHADOW_CUBE_SIZE), ivec2(SHADOW_CUBE_SIZE));
+                res.clusterDraws = graph.ImportTexture("Cluster draws", 0, FramebufferTextureFormat::NONE, ivec2(1), ivec2(1));
+                res.impostorAtlases = graph.ImportTexture("Impostor atlases", 0, FramebufferTextureFormat::NONE, ivec2(1), ivec2(1));
+
+                res.normals = graph.CreateTexture("Normals", FramebufferTextureFormat::RG16_SNORM, size, allocatedSize);
+                res.albedo = graph.CreateTexture("Albedo", FramebufferTextureFormat::SRGBA8, size, allocatedSize);
+                res.bright = graph.CreateTexture("Bright color", FramebufferTextureFormat::SRGBA8, size, allocatedSize);
+                res.velocity = graph.CreateTexture("Velocity", FramebufferTextureFormat::RG16F, size, allocatedSize);
+                res.depth = graph.ImportTexture("Depth", gbuffer->GetDepthAttachment(), FramebufferTextureFormat::DEPTH24, size, allocatedSize);
+                res.visibility = graph.CreateTexture("Visibility", FramebufferTextureFormat::R32UI, size, allocatedSize);
+
+                // Transient targets share the G-buffer allocation size so every screen target uses the same uvScale
+                static const char* const bloomNames[BLOOM_MIP_COUNT] = { "Bloom 1/2", "Bloom 1/4", "Bloom 1/8", "Bloom 1/16", "Bloom 1/32" };
+                for (u32 i = 0; i < BLOOM_MIP_COUNT; ++i)
+                {
+                    const i32 shift = i + 1;
+                    const ivec2 levelSize = glm::max((size + ivec2((1 << shift) - 1)) >> shift, ivec2(1));
+                    res.bloom[i] = graph.CreateTexture(bloomNames[i], FramebufferTextureFormat::R11F_G11F_B10F, levelSize, allocatedSize >> shift);
+                }
 
-                glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+                res.reservoirsTemporal = graph.CreateTexture("Temporal reservoirs", FramebufferTextureFormat::RGBA32F, size, allocatedSize);
+                res.reservoirHistory = graph.ImportTexture("Reservoir history", app->fboReservoirHistory->GetColorAttachment(), FramebufferTextureFormat::RGBA32F,
+                    app->fboReservoirHistory->GetSize(), app->fboReservoirHistory->GetAllocatedSize());
+                res.stochasticLighting = graph.CreateTexture("Stochastic lighting", FramebufferTextureFormat::R11F_G11F_B10F, size, allocatedSize);
+
+                // One texel per lightingDownscale x lightingDownscale block, allocated sizes are powers of 2 so they divide evenly
+                const ivec2 lightingSize = (size + ivec2(app->lightingDownscale - 1)) / app->lightingDownscale;
+                const ivec2 lightingAllocatedSize = allocatedSize / app->lightingDownscale;
+                res.lightingNormals = graph.CreateTexture("Lighting normals", FramebufferTextureFormat::RG16_SNORM, lightingSize, lightingAllocatedSize);
+                res.lightingDepth = graph.CreateTexture("Lighting depth", FramebufferTextureFormat::DEPTH24, lightingSize, lightingAllocatedSize);
+                res.lightingEdges = graph.CreateTexture("Lighting edges", FramebufferTextureFormat::R8, lightingSize, lightingAllocatedSize);
+                res.lighting = graph.CreateTexture("Reduced lighting", FramebufferTextureFormat::R11F_G11F_B10F, lightingSize, lightingAllocatedSize);
+
+                // Forward shading already ends up in a linear HDR target
+                res.forwardColor = graph.CreateTexture("Forward color", FramebufferTextureFormat::R11F_G11F_B10F, size, allocatedSize);
+                res.sceneColor = forward ? res.forwardColor : graph.CreateTexture("Scene color", FramebufferTextureFormat::R11F_G11F_B10F, size, allocatedSize);
+                res.bloomSource = deferred ? res.bright : res.sceneColor;
+
+                // Both histories follow the render size, the previous one's content may be from another size (see RenderTaaResolve)
+                Framebuffer* taaHistory = app->fboTaaHistory[app->taaHistoryIndex];
+                Framebuffer* taaResolved = app->fboTaaHistory[1 - app->taaHistoryIndex];
+                res.taaHistory = graph.ImportTexture("TAA history", taaHistory->GetColorAttachment(), FramebufferTextureFormat::RGBA16, taaHistory->GetSize(), taaHistory->GetAllocatedSize());
+                res.taaResolved = graph.ImportTexture("TAA resolved", taaResolved->GetColorAttachment(), FramebufferTextureFormat::RGBA16, taaResolved->GetSize(), taaResolved->GetAllocatedSize());
+                res.resolvedColor = taaActive ? res.taaResolved : res.sceneColor;
+
+                res.postOutput = graph.CreateTexture("Post output", FramebufferTextureFormat::RGBA8, size, allocatedSize);
+
+                res.backbuffer = graph.ImportBackbuffer("Backbuffer", app->displaySize);
+                res.backbufferDepth = graph.ImportBackbuffer("Backbuffer depth", app->displaySize);
+
+                // Passes
+                graph.AddPass("Point shadows", {}, { res.shadowMaps }, [app](FrameGraph&)
+                {
+                    RenderPointShadows(app);
+                });
 
-                glEnable(GL_DEPTH_TEST);
+                // The passes drawing the entities with DrawSubmesh read the culled draws
+                std::vector<FrameGraphResource> clusterReads;
+                if (app->clusterCullingActive)
+                {
+                    clusterReads.push_back(res.clusterDraws);
+                    graph.AddPass("Cluster culling", {}, { res.clusterDraws }, [app](FrameGraph&)
+                    {
+                        RenderClusterCulling(app);
+                    });
+                }
 
-                glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-                
-                for (int i = 0; i < app->entities.size(); ++i)
+                if (app->depthPrepassActive)
                 {
-                    Entity& entity = app->entities[i];
-                    Program program;
+                    graph.AddPass("Depth pre-pass", clusterReads, { res.depth }, [app, &res](FrameGraph& graph)
+                    {
+                        RenderDepthPrepass(app, graph, res);
+                    });
+                }
 
-                    if (!entity.relief)
+                // Debug views show the G-buffer in every mode, so they go through the deferred geometry pass
+                std::vector<FrameGraphResource> geometryReads = clusterReads;
+                if (app->depthPrepassActive)
+                    geometryReads.push_back(res.depth);
+                if (app->impostorBakeIdx != UINT32_MAX)
+                {
+                    geometryReads.push_back(res.impostorAtlases);
+                    graph.AddPass("Impostor bake", {}, { res.impostorAtlases }, [app](FrameGraph&)
                     {
-                        program = app->programs[app->deferredIdx];
-                    }
-                    else
+                        BakeImpostor(app);
+                    });
+                }
+                if (forward)
+                {
+                    geometryReads.push_back(res.shadowMaps);
+                    graph.AddPass("Forward", geometryReads, { res.forwardColor, res.depth }, [app, &res](FrameGraph& graph)
                     {
-                        program = app->programs[app->reliefIdx];
-                    }
-                    glUseProgram(program.handle);
-
-                    GLuint location = glGetUniformLocation(program.handle, "renderMode");
-                    glUniform1i(location, (GLint)app->renderMode);
-
-                    glBindBufferRange(GL_UNIFORM_BUFFER, 1, app->uniformBuffer.handle, entity.localParamsOffset, entity.localParamsSize);
-
-                    Model& model = app->models[entity.modelIndex];
-                    Mesh& mesh = app->meshes[model.meshIdx];
-
-                    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+                        RenderForward(app, graph, res);
+                    });
+                }
+                else if (visibility)
+                {
+                    graph.AddPass("Visibility", {}, { res.visibility, res.depth }, [app, &res](FrameGraph& graph)
                     {
-                        GLuint vao = FindVAO(mesh, i, program);
-                        glBindVertexArray(vao);
+                        RenderVisibility(app, graph, res);
+                    });
 
-                        u32 submeshMaterialIdx = model.materialIdx[i];
-                        Material& submeshMaterial = app->materials[submeshMaterialIdx];
+                    graph.AddPass("Visibility resolve", { res.visibility, res.shadowMaps }, { res.sceneColor }, [app, &res](FrameGraph& graph)
+                    {
+                        RenderVisibilityResolve(app, graph, res);
+                    });
 
-                        location = glGetUniformLocation(program.handle, "uTexture");
-                        glUniform1i(location, 0);
-                        glActiveTexture(GL_TEXTURE0);
-                        glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-                        if (entity.relief)
-                        {
-                            glActiveTexture(GL_TEXTURE0);
-                            glBindTexture(GL_TEXTURE_2D, app->textures[app->diffuseWallTexIdx].handle);
-                            glUniform1i(location, 0);
-                            glActiveTexture(GL_TEXTURE1);
-                            glBindTexture(GL_TEXTURE_2D, app->textures[app->normalMapTexIdx].handle);
-                            location = glGetUniformLocation(program.handle, "normalTexture");
-                            glUniform1i(location, 1);
-                            glActiveTexture(GL_TEXTURE2);
-                            glBindTexture(GL_TEXTURE_2D, app->textures[app->depthMapTexIdx].handle);
-                            location = glGetUniformLocation(program.handle, "depthTexture");
-                            glUniform1i(location, 2);
-                            
-                            location = glGetUniformLocation(program.handle, "minLayers");
-                            glUniform1f(location, app->minLayers);
-                            location = glGetUniformLocation(program.handle, "maxLayers");
-                            glUniform1f(location, app->maxLayers);
-                            location = glGetUniformLocation(program.handle, "heightScale");
-                            glUniform1f(location, app->heightScale);
-                        }
-
-                        location = glGetUniformLocation(program.handle, "viewPos");
-                        glUniform3fv(location, 1, glm::value_ptr(app->camera.GetPosition()));
-
-                        Submesh& submesh = mesh.submeshes[i];
-                        glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                        glActiveTexture(GL_TEXTURE0);
-                    }
-                    glBindVertexArray(0);
+                    graph.AddPass("Visibility forward", { res.sceneColor, res.depth, res.shadowMaps }, { res.sceneColor, res.depth }, [app, &res](FrameGraph& graph)
+                    {
+                        RenderVisibilityForward(app, graph, res);
+                    });
+                }
+                else
+                {
+                    graph.AddPass("G-buffer", geometryReads, { res.normals, res.albedo, res.bright, res.velocity, res.depth }, [app, &res](FrameGraph& graph)
+                    {
+                        RenderGBuffer(app, graph, res);
+                    });
                 }
-                glUseProgram(0);
-
-                // Light Pass
-                Program& programLights = app->programs[app->lightsIdx];
-                glUseProgram(programLights.handle);
 
-                for (int i = 0; i < app->lights.size(); ++i)
+                // The mip chain is sampled inside the pass going down and up, so every level is read too
+                std::vector<FrameGraphResource> bloomReads(res.bloom, res.bloom + BLOOM_MIP_COUNT);
+                bloomReads.push_back(res.bloomSource);
+                graph.AddPass("Bloom", bloomReads, std::vector<FrameGraphResource>(res.bloom, res.bloom + BLOOM_MIP_COUNT), [app, &res](FrameGraph& graph)
                 {
-                    Light& light = app->lights[i];
+                    RenderBloom(app, graph, res);
+                });
 
-                    glm::mat4 modelMatrix = glm::translate(light.position);
-                    modelMatrix = glm::scale(modelMatrix, vec3(0.4));
+                graph.AddPass("Reservoirs temporal", { res.normals, res.albedo, res.depth, res.reservoirHistory }, { res.reservoirsTemporal }, [app, &res](FrameGraph& graph)
+                {
+                    RenderReservoirsTemporal(app, graph, res);
+                });
 
-                    GLuint location = glGetUniformLocation(programLights.handle, "modelMatrix");
-                    glUniformMatrix4fv(location, 1, false, glm::value_ptr(modelMatrix));
-                    location = glGetUniformLocation(programLights.handle, "color");
-                    glUniform3fv(location, 1, glm::value_ptr(light.color));
-                    location = glGetUniformLocation(programLights.handle, "viewProjectionMatrix");
-                    glUniformMatrix4fv(location, 1, false, glm::value_ptr(app->camera.GetViewProjection()));
+                graph.AddPass("Reservoirs spatial", { res.normals, res.albedo, res.depth, res.shadowMaps, res.reservoirsTemporal }, { res.reservoirHistory, res.stochasticLighting },
+                    [app, &res](FrameGraph& graph)
+                {
+                    RenderReservoirsSpatial(app, graph, res);
+                });
 
-                    if (light.type == LightType::POINT)
+                if (finalRender)
+                {
+                    if (reducedLighting)
                     {
-                        Model& model = app->models[app->sphereIdx];
-                        Mesh& mesh = app->meshes[model.meshIdx];
-
-                        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+                        graph.AddPass("Lighting downsample", { res.normals, res.albedo, res.depth }, { res.lightingNormals, res.lightingEdges, res.lightingDepth },
+                            [app, &res](FrameGraph& graph)
                         {
-                            GLuint vao = FindVAO(mesh, i, programLights);
-                            glBindVertexArray(vao);
-
-                            u32 submeshMaterialIdx = model.materialIdx[i];
-                            Material& submeshMaterial = app->materials[submeshMaterialIdx];
+                            RenderLightingDownsample(app, graph, res);
+                        });
 
-                            Submesh& submesh = mesh.submeshes[i];
-                            glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                        }
-                        glBindVertexArray(0);
+                        graph.AddPass("Reduced lighting", { res.lightingNormals, res.lightingDepth, res.shadowMaps }, { res.lighting }, [app, &res](FrameGraph& graph)
+                        {
+                            RenderReducedLighting(app, graph, res);
+                        });
                     }
-                    else if (light.type == LightType::DIRECTIONAL)
+
+                    if (deferred)
                     {
-                        glBindVertexArray(app->vao);
-                        glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
-                        glBindVertexArray(0);
+                        std::vector<FrameGraphResource> compositeReads = { res.normals, res.albedo, res.depth, res.shadowMaps };
+                        if (stochasticActive)
+                            compositeReads.push_back(res.stochasticLighting);
+                        if (reducedLighting)
+                            compositeReads.insert(compositeReads.end(), { res.lightingNormals, res.lightingDepth, res.lightingEdges, res.lighting });
+                        graph.AddPass("Composite", compositeReads, { res.sceneColor }, [app, &res, stochasticActive, reducedLighting](FrameGraph& graph)
+                        {
+                            RenderComposite(app, graph, res, stochasticActive, reducedLighting);
+                        });
                     }
-                }
-                glUseProgram(0);
-                app->fbo1->Unbind();
-
-                // Bloom Pass
-                bool horizontal = true, first_iteration = true;
-                int amount = 10;
-                Program& programBloom = app->programs[app->bloomIdx];
-                glUseProgram(programBloom.handle);
-                for (unsigned int i = 0; i < amount; i++)
-                {
-                    horizontal == true ? app->fboBloom1->Bind() : app->fboBloom2->Bind();
 
-                    glClearColor(0.0, 0.0, 0.0, 1.0);
-                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                    glDisable(GL_DEPTH_TEST);
+                    if (taaActive)
+                    {
+                        std::vector<FrameGraphResource> taaReads = { res.sceneColor, res.taaHistory, res.depth };
+                        if (deferred)
+                            taaReads.push_back(res.velocity);
+                        graph.AddPass("TAA resolve", taaReads, { res.taaResolved }, [app, &res, deferred](FrameGraph& graph)
+                        {
+                            RenderTaaResolve(app, graph, res, deferred);
+                        });
+                    }
 
-                    GLuint location = glGetUniformLocation(programBloom.handle, "horizontal");
-                    glUniform1i(location, horizontal);
-                    location = glGetUniformLocation(programBloom.handle, "image");
-                    glUniform1i(location, 0);
+                    graph.AddPass("Post", { res.resolvedColor, res.bloom[0] }, { res.postOutput }, [app, &res](FrameGraph& graph)
+                    {
+                        RenderPost(app, graph, res);
+                    });
 
-                    glActiveTexture(GL_TEXTURE0);
-                    if (first_iteration)
+                    graph.AddPass("Present", { res.postOutput }, { res.backbuffer }, [app, &res](FrameGraph& graph)
+                    {
+                        RenderPresent(app, graph, res);
+                    });
+                }
+                else
+                {
+                    // Debug views only read the attachment they show
+                    std::vector<FrameGraphResource> debugReads;
+                    switch (app->textureToRender)
                     {
-                        u32 fbo = app->fbo1->GetColorAttachment(3);
-                        glBindTexture(GL_TEXTURE_2D, fbo);
+                        case TextureToRender::POSITIONS: debugReads = { res.depth }; break;
+                        case TextureToRender::NORMALS:   debugReads = { res.normals }; break;
+                        case TextureToRender::ALBEDO:    debugReads = { res.albedo }; break;
+                        case TextureToRender::DEPTH:     debugReads = { res.depth }; break;
+                        default:;
                     }
-                    else
+                    graph.AddPass("Debug view", debugReads, { res.backbuffer }, [app, &res](FrameGraph& graph)
                     {
-                        if (horizontal)
-                        {
-                            app->fboBloom2->BindColorTextures();
-                        }
-                        else
-                        {
-                            app->fboBloom1->BindColorTextures();
-                        }
-                    }                
-                    
-                    glBindVertexArray(app->vao);
-                    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
-                    glBindVertexArray(0);
-
-                    horizontal = !horizontal;
-                    if (first_iteration)
-                        first_iteration = false;
-                    
+                        RenderComposite(app, graph, res, false, false);
+                    });
                 }
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
-                glUseProgram(0);
 
-                glClearColor(0.0, 0.0, 0.0, 1.0);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                
-                glEnable(GL_DEPTH_TEST);
+                // Nothing drawn after the frame graph reads the default depth buffer at the
+                // moment, so this pass is culled until some pass reads backbufferDepth
+                graph.AddPass("Depth blit", { res.depth }, { res.backbufferDepth }, [app, &res](FrameGraph& graph)
+                {
+                    // The G-buffer can lag behind the window size while a resize settles
+                    const ivec2 gbufferSize = graph.GetSize(res.depth);
+                    graph.BindRenderTargets({}, res.depth);
+                    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
+                    glBlitFramebuffer(0, 0, gbufferSize.x, gbufferSize.y, 0, 0, app->displaySize.x, app->displaySize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                });
+
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_BUFFER_BINDING, app->objectBuffer.handle);
+
+                graph.Compile();
+                app->gpuProfiler->BeginFrame();
+                graph.Execute();
+                app->gpuProfiler->EndFrame();
+
+                for (u32 i = 0; i < app->entities.size(); ++i)
+                {
+                    app->entities[i].prevWorldMatrix = app->entities[i].worldMatrix;
+                }
+                app->prevViewProjection = app->camera.GetViewProjection();
 
-                Program programQuad;
-                if (app->renderMode == RenderMode::FORWARD)
+                if (taaActive)
                 {
-                    programQuad = app->programs[app->quadForwardIdx];
-                    glUseProgram(programQuad.handle);
+                    app->taaHistoryIndex = 1 - app->taaHistoryIndex;
+                    app->taaHistorySize = size;
+                    app->taaHistoryValid = true;
                 }
                 else
                 {
-                    programQuad = app->programs[app->finalQuadIdx];
-                    glUseProgram(programQuad.handle);
+                    app->taaHistoryValid = false;
                 }
-                glBindVertexArray(app->vao);
-
-                app->fbo1->BindColorTextures();
-                app->fbo1->BindDepthTexture();
-
-                glActiveTexture(GL_TEXTURE6);
-                glBindTexture(GL_TEXTURE_2D, app->fboBloom2->GetColorAttachment());
-
-                GLuint location = glGetUniformLocation(programQuad.handle, "positions");
-                glUniform1i(location, 0);
-                location = glGetUniformLocation(programQuad.handle, "normals");
-                glUniform1i(location, 1);
-                location = glGetUniformLocation(programQuad.handle, "colors");
-                glUniform1i(location, 2);
-                location = glGetUniformLocation(programQuad.handle, "forwardColor");
-                glUniform1i(location, 4);
-                location = glGetUniformLocation(programQuad.handle, "depth");
-                glUniform1i(location, 5);
-                location = glGetUniformLocation(programQuad.handle, "bloom");
-                glUniform1i(location, 6);
-                location = glGetUniformLocation(programQuad.handle, "renderMode");
-                glUniform1i(location, (GLint)app->textureToRender);
-
-                location = glGetUniformLocation(programQuad.handle, "hdrActive");
-                glUniform1i(location, (GLint)app->hdr);
-
-                glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(u16), GL_UNSIGNED_SHORT, 0);
-                glBindVertexArray(0);
-                glUseProgram(0);
-
-                glBindFramebuffer(GL_READ_FRAMEBUFFER, app->fbo1->GetID());
-                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
-                glBlitFramebuffer(0, 0, app->displaySize.x, app->displaySize.y, 0, 0, app->displaySize.x, app->displaySize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
             }
             break;
 
@@ -8,7 +8,16 @@
 #include "RenderStructs.h"
 #include "Camera.h"
 #include "Framebuffer.h"
+#include "ShadowAtlas.h"
+#include "RenderTargetPool.h"
+#include "FrameGraph.h"
+#include "ProgramCache.h"
+#include "ProgramCompiler.h"
+#include "FileWatcher.h"
+#include "GpuProfiler.h"
+#include "BufferLayout.h"
 #include <glad/glad.h>
+#include <map>
 
 struct Image
 {
@@ -24,13 +33,50 @@ struct Texture
     std::string filepath;
 };
 
+// Compile time features of a program. Each one adds a "#define FEATURE_..." to
+// the source, and every combination in use is compiled as its own variant.
+enum ShaderFeature
+{
+    SHADER_FEATURE_FORWARD          = 1 << 0, // shade in the geometry pass (deferred otherwise)
+    SHADER_FEATURE_HDR              = 1 << 1, // auto exposure and tone mapping in the post pass (clamped otherwise)
+    SHADER_FEATURE_STOCHASTIC       = 1 << 2, // reservoir lighting instead of the light loop
+    SHADER_FEATURE_DEBUG_POSITIONS  = 1 << 3,
+    SHADER_FEATURE_DEBUG_NORMALS    = 1 << 4,
+    SHADER_FEATURE_DEBUG_ALBEDO     = 1 << 5,
+    SHADER_FEATURE_DEBUG_DEPTH      = 1 << 6,
+    SHADER_FEATURE_LIGHTING_ONLY    = 1 << 7, // light sum without the albedo, for the reduced resolution pass
+    SHADER_FEATURE_REDUCED_LIGHTING = 1 << 8, // upsample the reduced resolution lighting
+    SHADER_FEATURE_COUNT            = 9,
+
+    SHADER_FEATURE_DEBUG_VIEWS      = SHADER_FEATURE_DEBUG_POSITIONS | SHADER_FEATURE_DEBUG_NORMALS | SHADER_FEATURE_DEBUG_ALBEDO | SHADER_FEATURE_DEBUG_DEPTH
+};
+
+typedef u32 ShaderFeatures;
+
 struct Program
 {
-    GLuint             handle;
+    GLuint             handle; // the fragment stage when separable, the fallback's until ready
     std::string        filepath;
     std::string        programName;
     VertexShaderLayout vertexInputLayout;
-    u64                lastWriteTimestamp; // What is this for?
+    u64                lastWriteTimestamp; // when the source was last (re)loaded
+
+    // Permutations
+    ShaderFeatures                features;          // the ones this variant was compiled with
+    ShaderFeatures                supportedFeatures; // the ones the source reacts to
+    std::map<ShaderFeatures, u32> variants;          // program index of each compiled variant (base program only)
+
+    // Background compilation, until it's ready the handle is the fallback program's (0 if there's none)
+    bool ready;
+    u32  fallbackIdx;
+
+    // Separable programs draw through a pipeline. The vertex stage is compiled by the
+    // base program and shared by all its variants, which only add a fragment stage.
+    bool   separable;
+    u32    baseIdx;
+    GLuint vertexStage;
+    GLuint fragmentStage;
+    GLuint pipeline;
 };
 
 enum Mode
@@ -42,7 +88,8 @@ enum Mode
 enum class RenderMode
 {
     FORWARD = 0,
-    DEFERRED = 1
+    DEFERRED = 1,
+    VISIBILITY = 2  // triangle IDs and depth, shaded once per pixel by a compute resolve
 };
 
 enum class TextureToRender
@@ -54,6 +101,31 @@ enum class TextureToRender
     DEPTH = 4
 };
 
+enum class DepthPrepassMode
+{
+    OFF = 0,
+    ON = 1,
+    AUTO = 2 // on while it saves enough fragments, see DEPTH_PREPASS_SAVING_THRESHOLD
+};
+
+enum class Tonemapper
+{
+    REINHARD = 0,
+    ACES = 1
+};
+
+// Color targets of the G-buffer and the texture units they're bound to, the depth
+// texture follows them. They're transient textures of the frame graph, fbo1 only
+// keeps the depth, so the forward and visibility buffer paths never allocate them.
+enum GBufferAttachment
+{
+    GBUFFER_NORMALS = 0,  // octahedral encoded, RG16_SNORM
+    GBUFFER_ALBEDO = 1,   // sRGB, alpha is 1 for lit surfaces
+    GBUFFER_BRIGHT = 2,   // sRGB, bloom input
+    GBUFFER_VELOCITY = 3, // RG16F, screen space motion since the last frame in UV units
+    GBUFFER_COLOR_COUNT = 4
+};
+
 struct OpenGLInfo
 {
     std::string glVersion;
@@ -69,12 +141,38 @@ struct Entity
     vec3 rotation;
     vec3 scale;
     glm::mat4 worldMatrix;
+    glm::mat4 prevWorldMatrix;
     
     u32 modelIndex;
-    u32 localParamsOffset;
-    u32 localParamsSize;
+    u32 objectIdx; // of its object params, the base instance of its draws
 
     bool relief;
+    bool moved;
+
+    u32 clusterDrawIdx; // command of its first submesh in the cluster culling output, UINT32_MAX when drawn whole
+    u32 lod;            // level of detail of its submeshes, see UpdateLods
+    bool impostor;      // drawn as the impostor of its model this frame, see UpdateImpostors
+    bool isStatic;      // never moves, can be merged into the static batches
+    bool batched;       // drawn by the static batches, see BuildStaticBatches
+    f32 unbatchedTimer; // > 0 while a static entity that moved is drawn on its own, see UpdateStaticBatches
+};
+
+struct Impostor
+{
+    u32 modelIdx;
+    Framebuffer* atlas; // normals, albedo and depth of every frame
+    bool dirty;         // baked again before it's drawn
+};
+
+// The triangles of one material in one chunk, a range of the merged index buffer
+struct StaticBatch
+{
+    u32 materialIdx;
+    u32 firstIndex;
+    u32 indexCount;
+    vec3 boundsMin; // world space
+    vec3 boundsMax;
+    bool visible;   // in this frame's frustum
 };
 
 struct Buffer
@@ -92,12 +190,128 @@ enum class LightType
     POINT = 1
 };
 
+#define MAX_UBO_LIGHTS 16
+
+// Light in the shaders, 80 bytes in both packings
+struct LightBlock : Block<BlockPacking::STD430, i32, vec3, vec3, vec3, f32, i32>
+{
+    enum { TYPE, COLOR, DIRECTION, POSITION, RADIUS, SHADOW_SLOT };
+    static constexpr const char* memberNames[] = { "type", "color", "direction", "position", "radius", "shadowSlot" };
+};
+
+// Camera position and the first MAX_UBO_LIGHTS lights, uniform binding 0
+struct GlobalParamsBlock : Block<BlockPacking::STD140, vec3, u32, Array<LightBlock, MAX_UBO_LIGHTS>>
+{
+    enum { CAMERA_POSITION, LIGHT_COUNT, LIGHTS };
+    static constexpr const char* memberNames[] = { "uCameraPosition", "uLightCount", "uLights" };
+    static constexpr const char* blockName = "GlobalParams";
+    static constexpr GLenum blockInterface = GL_UNIFORM_BLOCK;
+};
+
+// Every light, storage binding 2. The lights follow the header with PushBlockArray.
+struct LightListBlock : Block<BlockPacking::STD430, u32, Array<LightBlock, 0>>
+{
+    enum { LIGHT_COUNT, LIGHTS };
+    static constexpr const char* memberNames[] = { "uLightListCount", "uLightList" };
+    static constexpr const char* blockName = "LightList";
+    static constexpr GLenum blockInterface = GL_SHADER_STORAGE_BLOCK;
+};
+
+// Bloom levels from 1/2 down to 1/32 of the screen
+#define BLOOM_MIP_COUNT 5
+
+// Auto exposure, log2 luminance range of the histogram (bin 0 holds the darker pixels)
+#define LUMINANCE_HISTOGRAM_BINS 256
+#define EXPOSURE_MIN_LOG_LUMINANCE -10.0f
+#define EXPOSURE_MAX_LOG_LUMINANCE 4.0f
+
+// Packed floats keep 6 mantissa bits in red and green and 5 in blue, so truncating stays under 2^-5
+#define R11F_G11F_B10F_MAX_RELATIVE_ERROR (1.0f / 32.0f)
+
+// Tone mapping LUT, indexed by log2 of the exposed color
+#define TONEMAP_LUT_SIZE 32
+#define TONEMAP_LUT_MIN_LOG -12.0f
+#define TONEMAP_LUT_MAX_LOG 6.0f
+
+// Dynamic resolution, range of the render scale over the window size
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.5f
+#define DYNAMIC_RESOLUTION_MAX_SCALE 1.0f
+
+// Temporal anti-aliasing, length of the Halton(2, 3) jitter sequence
+#define TAA_JITTER_SAMPLES 8
+
+// Depth pre-pass heuristic. The auto mode keeps the pre-pass while the geometry pass shades this many
+// times more fragments without it, and renders a frame the other way every so often to measure again.
+#define DEPTH_PREPASS_SAVING_THRESHOLD 1.3f
+#define DEPTH_PREPASS_REMEASURE_FRAMES 240
+
+// Visibility buffer IDs, the draw index above the triangle bits and the triangle of the draw below
+// them. Background pixels keep the clear value.
+#define VISIBILITY_TRIANGLE_BITS 23
+#define VISIBILITY_BACKGROUND_ID 0xFFFFFFFFu
+
+// Albedo textures bound per resolve dispatch, there's one dispatch for every group of this many
+#define VISIBILITY_TEXTURE_SLOTS 8
+
+// std430 draw record of the visibility resolve: world and normal matrix, first index and texture slot (padded)
+#define VISIBILITY_DRAW_SIZE 144
+
+// Levels of detail, a level is used while its simplification error projects to less than the
+// allowed error in pixels. Going coarser needs it to fit this fraction of it, so they don't flicker.
+#define MESH_LOD_HYSTERESIS 0.75f
+
+// Impostor atlases, the model rendered from IMPOSTOR_GRID x IMPOSTOR_GRID directions laid out with an
+// octahedral mapping of the sphere, one IMPOSTOR_FRAME_SIZE square frame per direction
+#define IMPOSTOR_GRID 8
+#define IMPOSTOR_FRAME_SIZE 128
+
+// Static batching, the static entities are grouped in cubes of this size (world units). Merged vertices
+// are position, normal, texture coordinates, tangent and bitangent, at locations 0 to 4.
+#define STATIC_BATCH_CHUNK_SIZE 16.0f
+#define STATIC_BATCH_VERTEX_FLOATS 14
+
+// Seconds a static entity that moved has to stay still before it goes back into the batches
+#define STATIC_BATCH_SETTLE_TIME 1.0f
+
+// Per object params: world, jittered world view projection, unjittered and last frame's.
+// The vertex shaders index them with the attribute at DRAW_INDEX_LOCATION, an instanced attribute
+// whose value is the draw's base instance.
+struct ObjectParamsBlock : Block<BlockPacking::STD430, glm::mat4, glm::mat4, glm::mat4, glm::mat4>
+{
+    enum { WORLD_MATRIX, WORLD_VIEW_PROJECTION, CURR_WORLD_VIEW_PROJECTION, PREV_WORLD_VIEW_PROJECTION };
+    static constexpr const char* memberNames[] = { "worldMatrix", "worldViewProjectionMatrix", "currWorldViewProjectionMatrix", "prevWorldViewProjectionMatrix" };
+};
+
+struct ObjectsBlock : Block<BlockPacking::STD430, Array<ObjectParamsBlock, 0>>
+{
+    static constexpr const char* memberNames[] = { "uObjects" };
+    static constexpr const char* blockName = "Objects";
+    static constexpr GLenum blockInterface = GL_SHADER_STORAGE_BLOCK;
+};
+
+#define OBJECT_BUFFER_BINDING 1
+#define DRAW_INDEX_LOCATION 5
+
+// Cluster culling output, one DrawElementsIndirectCommand (5 u32) per culled draw
+#define CLUSTER_DRAW_COMMAND_SIZE 20
+
+// Seconds without resize events before the render targets grow
+#define RESIZE_SETTLE_TIME 0.25f
+
 struct Light
 {
     LightType type;
     vec3 color;
     vec3 direction;
     vec3 position;
+
+    // Point light shadows
+    f32 radius = 15.0f;
+    bool castShadows = true;
+    u32 shadowSlot = UINT32_MAX;
+    bool shadowDirty = false;
+    vec3 shadowPosition;
+    f32 shadowRadius = 0.0f;
 };
 
 struct Vertex3V2V
@@ -140,15 +354,35 @@ struct App
     std::vector<Mesh> meshes;
     std::vector<Model> models;
     std::vector<Program> programs;
+    ProgramCache* programCache;
+    ProgramCompiler* programCompiler;
+    FileWatcher* fileWatcher;
 
     // program indices
     u32 texturedGeometryProgramIdx;
     u32 deferredIdx;
     u32 finalQuadIdx;
     u32 lightsIdx;
-    u32 bloomIdx;
+    u32 bloomPrefilterIdx;
+    u32 bloomDownsampleIdx;
+    u32 bloomUpsampleIdx;
     u32 quadForwardIdx;
+    u32 lightingDownsampleIdx;
+    u32 upscaleIdx;
+    u32 taaResolveIdx;
+    u32 depthPrepassIdx;
+    u32 visibilityIdx;
+    u32 visibilityResolveIdx;
+    u32 clusterCullIdx;
+    u32 impostorIdx;
+    u32 postIdx;
+    u32 exposureAdaptIdx;
     u32 reliefIdx;
+    u32 pointShadowIdx;
+    u32 restirTemporalIdx;
+    u32 restirSpatialIdx;
+    u32 fallbackMeshIdx;
+    u32 fallbackQuadIdx;
     
     // texture indices
     u32 diceTexIdx;
@@ -188,18 +422,134 @@ struct App
 
     Buffer uniformBuffer;
     Buffer cBuffer;
+    Buffer lightsBuffer;
+    Buffer exposureBuffer; // luminance histogram and adapted exposure, only the GPU reads it
+    Buffer objectBuffer;   // object params of the entities, the static batches and the impostor bake, in that order
+    GLuint drawIndexBuffer; // 0, 1, 2... read once per instance, as many as objects
+    u32 drawIndexCapacity;
     u32 globalParamsOffset;
     u32 globalParamsSize;
 
+    RenderTargetPool* renderTargetPool;
+    FrameGraph* frameGraph;
+    GpuProfiler* gpuProfiler;
+
     Framebuffer* fbo1;
-    
-    Framebuffer* fboBloom1;
-    Framebuffer* fboBloom2;
+
+    // Stochastic light sampling, final reservoirs kept for the next frame's temporal reuse
+    Framebuffer* fboReservoirHistory;
+    glm::mat4 prevViewProjection; // without the TAA jitter
+
+    // TAA history, the resolve reads one and writes the other, they swap every frame
+    Framebuffer* fboTaaHistory[2];
+    u32 taaHistoryIndex = 0;       // the one holding last frame's result
+    ivec2 taaHistorySize;          // render size it was resolved at
+    bool taaHistoryValid = false;
+
+    ShadowAtlas* shadowAtlas;
+    u64 frameIndex = 0;
+    u32 shadowPassesLastFrame = 0;
+
+    // Window resizes are applied once the size settles (see ResizeRenderTargets)
+    bool resizePending = false;
+    f32 resizeSettleTimer = 0.0f;
+
+    // Render targets cover displaySize * renderScale, the upscale pass stretches the result over the window
+    bool dynamicResolution = false;
+    f32 renderScale = 1.0f;
+    f32 gpuBudgetMilliseconds = 16.0f;
+    f32 upscaleSharpness = 0.2f;
 
     TextureToRender textureToRender;
     RenderMode renderMode;
 
     bool hdr = true;
+    Tonemapper tonemapper = Tonemapper::ACES;
+    GLuint tonemapLUT; // 3D texture, rebuilt when the tone mapper changes
+    f32 exposureCompensation = 0.0f;
+    f32 exposureAdaptationSpeed = 1.5f;
+
+    // Bilinear, clamped to edge. Pooled render targets are nearest, the bloom chain relies on filtering
+    GLuint linearClampSampler;
+    f32 bloomThreshold = 0.6f;
+    f32 bloomKnee = 0.3f;
+    f32 bloomIntensity = 0.5f;
+    f32 bloomRadius = 1.0f;
+
+    // Jittered projection and temporal resolve. The accumulation also lets the relief
+    // march get away with a fraction of its layers, offset differently every frame.
+    bool taa = true;
+    f32 taaFeedback = 0.9f;
+    f32 taaReliefLayerScale = 0.5f;
+
+    // Depth only pass before the geometry, which is then shaded with an equal depth test
+    DepthPrepassMode depthPrepass = DepthPrepassMode::AUTO;
+    bool depthPrepassActive = false;
+
+    // Overdraw of the geometry pass, fragments that passed the depth test per rendered pixel. Measured
+    // with an occlusion query that's read when the GPU is done with it, kept apart with and without the pre-pass.
+    GLuint overdrawQuery;
+    bool overdrawQueryPending = false;
+    bool overdrawQueryPrepass = false;
+    f32 overdrawWithoutPrepass = 0.0f; // 0 until measured
+    f32 overdrawWithPrepass = 0.0f;
+    u64 overdrawRemeasureFrame = 0;
+
+    // Visibility buffer. The resolve fetches the triangles from one vertex and one index buffer for
+    // the whole scene, rebuilt when a model (re)loads, and the draws from a list made every frame.
+    GLuint visibilityVertexBuffer = 0; // position + u, normal + v
+    GLuint visibilityIndexBuffer = 0;  // already offset to the vertices of their submesh
+    bool visibilityGeometryDirty = true;
+    Buffer visibilityDrawBuffer;
+    u32 visibilityDrawCount = 0;
+    std::vector<GLuint> visibilityTextures; // albedo textures, the draws refer to them by slot
+
+    // Levels of detail picked per entity from its projected size
+    bool lodSelection = true;
+    f32 lodPixelError = 1.0f;
+    u32 lodTriangleCount = 0;         // drawn by the entities at their level, before the cluster culling
+    u32 fullDetailTriangleCount = 0;  // the same at full detail
+
+    // Cluster culling. A compute pass tests the meshlets of every draw against the frustum and their
+    // normal cone, and appends the triangles that survive to one index buffer drawn indirectly.
+    bool clusterCulling = true;
+    bool clusterCullingActive = false;
+    Buffer clusterDrawBuffer;       // the GPU adds the triangle counts to the commands
+    GLuint clusterIndexBuffer = 0;
+    u32 clusterIndexBufferSize = 0;
+    u32 clusterDrawCount = 0;
+    u32 clusterMeshletCount = 0;
+
+    // Static batching. The static entities are pre-transformed to world space into one vertex and index
+    // buffer, grouped by material and spatial chunk, and drawn with one call per batch in the frustum.
+    bool staticBatching = true;
+    bool staticBatchesDirty = true;
+    GLuint staticVertexBuffer = 0;
+    GLuint staticIndexBuffer = 0;
+    GLuint staticVao = 0;
+    std::vector<StaticBatch> staticBatches;
+    u32 staticObjectIdx = 0; // their object params, an identity world matrix
+    u32 staticEntityCount = 0;
+    u32 staticBatchDrawCount = 0;
+
+    // Impostors. Entities further than impostorDistance draw one quad sampling an atlas of their model
+    // baked from many directions, into the G-buffer. One atlas is baked per frame, when first needed.
+    bool impostorRendering = true;
+    bool impostorsActive = false;
+    f32 impostorDistance = 40.0f;
+    std::vector<Impostor> impostors;
+    u32 impostorBakeIdx = UINT32_MAX; // the one baked this frame
+    u32 impostorBakeObjectIdx = 0;    // object params of its first frame, the others follow
+    u32 impostorCount = 0;
+
+    // Deferred light loop at 1/lightingDownscale resolution (1, 2 or 4), edges stay at full rate
+    i32 lightingDownscale = 1;
+
+    bool stochasticLighting = false;
+    bool temporalReuse = true;
+    i32 lightCandidates = 8;
+    i32 spatialSamples = 4;
+    f32 spatialRadius = 12.0f;
 
     float minLayers = 10.0f;
     float maxLayers = 32.0f;
@@ -216,4 +566,14 @@ void Update(App* app);
 
 void Render(App* app);
 
-u32 LoadTexture2D(App* app, const char* filepath);
\ No newline at end of file
+// Called on every window resize event, the render targets are resized later
+void RequestResize(App* app, int width, int height);
+
+// Size the render targets follow, the window size scaled by the dynamic resolution
+ivec2 GetRenderSize(App* app);
+
+u32 LoadTexture2D(App* app, const char* filepath);
+
+// Program index of the variant with these features (the unsupported ones are ignored), compiled on first use.
+// Compiling pushes into app->programs, so get the variant before taking references to programs.
+u32 GetProgramVariant(App* app, u32 programIdx, ShaderFeatures features);
\ No newline at end of file
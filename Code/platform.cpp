@@ -31,6 +31,9 @@
 u8* GlobalFrameArenaMemory = NULL;
 u32 GlobalFrameArenaHead = 0;
 
+// Hidden window whose context shares objects with the main one, for background threads
+GLFWwindow* SharedContextWindow = NULL;
+
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
 	fprintf(stderr, "glfw failed with error %d: %s\n", errorCode, errorMessage);
@@ -111,11 +114,7 @@ void OnGlfwResizeFramebuffer(GLFWwindow* window, int width, int height)
         return;
 
     App* app = (App*)glfwGetWindowUserPointer(window);
-    app->displaySize = vec2(width, height);
-    app->fbo1->Resize(width, height);
-    app->fboBloom1->Resize(width, height);
-    app->fboBloom2->Resize(width, height);
-    app->camera.Resize(width, height);
+    RequestResize(app, width, height);
 }
 
 void OnGlfwCloseWindow(GLFWwindow* window)
@@ -152,6 +151,14 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
         return -1;
     }
 
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    SharedContextWindow = glfwCreateWindow(1, 1, WINDOW_TITLE, NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!SharedContextWindow)
+    {
+        ELOG("Couldn't create the shared context, programs will compile on the main thread\n");
+    }
+
     glfwSetWindowUserPointer(window, &app);
 
     glfwSetMouseButtonCallback(window, OnGlfwMouseEvent);
@@ -273,6 +280,9 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 
     free(GlobalFrameArenaMemory);
 
+    // Joins the compile worker before glfwTerminate destroys the context it runs on
+    delete app.programCompiler;
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
 
@@ -283,6 +293,21 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
     return 0;
 }
 
+bool IsSharedContextAvailable()
+{
+    return SharedContextWindow != NULL;
+}
+
+void MakeSharedContextCurrent()
+{
+    glfwMakeContextCurrent(SharedContextWindow);
+}
+
+void ReleaseCurrentContext()
+{
+    glfwMakeContextCurrent(NULL);
+}
+
 u32 Strlen(const char* string)
 {
     u32 len = 0;
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <float.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -92,6 +93,15 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Makes current in the calling thread a hidden context that shares objects with the
+ * main one, so programs or textures can be created from a background thread.
+ */
+bool IsSharedContextAvailable();
+void MakeSharedContextCurrent();
+// Detaches the calling thread's context, a context can't be destroyed while current in another thread
+void ReleaseCurrentContext();
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
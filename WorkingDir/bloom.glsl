@@ -1,7 +1,10 @@
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
-#ifdef BLOOM
+// Progressive bloom: the prefilter thresholds the bright color while going
+// to half resolution, the downsamples halve it down to 1/32 and the upsamples
+// add each level back onto the one above with additive blending.
+#if defined(BLOOM_PREFILTER) || defined(BLOOM_DOWNSAMPLE) || defined(BLOOM_UPSAMPLE)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -11,6 +14,7 @@ layout(location=2) in vec2 aTexCoord;
 //layout(location=3) in vec3 aTangent;
 //layout(location=4) in vec3 aBiTangent;
 
+// Normalized over the rendered size of the target, the viewport covers just that
 out vec2 vTexCoord;
 
 void main()
@@ -25,35 +29,105 @@ in vec2 vTexCoord;
 
 layout(location = 0) out vec4 oColor;
 
-uniform bool horizontal;
-uniform sampler2D image;
-uniform float weight[5] = float[] (0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
+layout(location = 0) uniform sampler2D image;
 
-uniform float lokkieras;
+// Rendered sub-rect of the source level
+uniform vec2 sourceUVScale;
+
+// Keeps the bilinear taps inside the rendered sub-rect
+vec3 SampleImage(vec2 uv, vec2 texelSize)
+{
+    return texture(image, clamp(uv, 0.5 * texelSize, sourceUVScale - 0.5 * texelSize)).rgb;
+}
+
+#if defined(BLOOM_PREFILTER) || defined(BLOOM_DOWNSAMPLE)
+
+uniform float threshold;
+uniform float knee;
+
+float Luminance(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Weights a group by its brightness so single bright texels don't flicker
+vec3 KarisAverage(vec3 a, vec3 b, vec3 c, vec3 d)
+{
+    vec4 w = 1.0 / (1.0 + vec4(Luminance(a), Luminance(b), Luminance(c), Luminance(d)));
+    return (a * w.x + b * w.y + c * w.z + d * w.w) / (w.x + w.y + w.z + w.w);
+}
+
+// Quadratic soft knee around the threshold
+vec3 Prefilter(vec3 color)
+{
+    float brightness = max(color.r, max(color.g, color.b));
+    float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+    soft = soft * soft / (4.0 * knee + 0.00001);
+    float contribution = max(soft, brightness - threshold) / max(brightness, 0.00001);
+    return color * contribution;
+}
 
 void main()
 {
-    vec2 tex_offset = 1.0 / textureSize(image, 0); // gets size of single texel
-    vec3 result = texture(image, vTexCoord).rgb * weight[0]; // current fragment's contribution
-    if(horizontal)
-    {
-        for(int i = 1; i < 5; ++i)
-        {
-            result += texture(image, vTexCoord + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-            result += texture(image, vTexCoord - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-        }
-    }
-    else
-    {
-        for(int i = 1; i < 5; ++i)
-        {
-            result += texture(image, vTexCoord + vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-            result += texture(image, vTexCoord - vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-        }
-    }
+    vec2 texelSize = 1.0 / textureSize(image, 0);
+    vec2 uv = vTexCoord * sourceUVScale;
+
+    // 13 bilinear taps covering a 6x6 texel footprint, as five overlapping 2x2 boxes
+    vec3 a = SampleImage(uv + texelSize * vec2(-2.0,  2.0), texelSize);
+    vec3 b = SampleImage(uv + texelSize * vec2( 0.0,  2.0), texelSize);
+    vec3 c = SampleImage(uv + texelSize * vec2( 2.0,  2.0), texelSize);
+    vec3 d = SampleImage(uv + texelSize * vec2(-2.0,  0.0), texelSize);
+    vec3 e = SampleImage(uv, texelSize);
+    vec3 f = SampleImage(uv + texelSize * vec2( 2.0,  0.0), texelSize);
+    vec3 g = SampleImage(uv + texelSize * vec2(-2.0, -2.0), texelSize);
+    vec3 h = SampleImage(uv + texelSize * vec2( 0.0, -2.0), texelSize);
+    vec3 i = SampleImage(uv + texelSize * vec2( 2.0, -2.0), texelSize);
+    vec3 j = SampleImage(uv + texelSize * vec2(-1.0,  1.0), texelSize);
+    vec3 k = SampleImage(uv + texelSize * vec2( 1.0,  1.0), texelSize);
+    vec3 l = SampleImage(uv + texelSize * vec2(-1.0, -1.0), texelSize);
+    vec3 m = SampleImage(uv + texelSize * vec2( 1.0, -1.0), texelSize);
+
+#if defined(BLOOM_PREFILTER)
+    vec3 result = KarisAverage(j, k, l, m) * 0.5
+                + KarisAverage(a, b, d, e) * 0.125
+                + KarisAverage(b, c, e, f) * 0.125
+                + KarisAverage(d, e, g, h) * 0.125
+                + KarisAverage(e, f, h, i) * 0.125;
+    result = Prefilter(result);
+#else
+    vec3 result = e * 0.125
+                + (a + c + g + i) * 0.03125
+                + (b + d + f + h) * 0.0625
+                + (j + k + l + m) * 0.125;
+#endif
+
     oColor = vec4(result, 1.0);
 }
 
+#elif defined(BLOOM_UPSAMPLE)
+
+// In source texels
+uniform float filterRadius;
+
+void main()
+{
+    vec2 texelSize = 1.0 / textureSize(image, 0);
+    vec2 uv = vTexCoord * sourceUVScale;
+    vec4 offset = texelSize.xyxy * vec4(1.0, 1.0, -1.0, 0.0) * filterRadius;
+
+    // 3x3 tent filter
+    vec3 result = SampleImage(uv, texelSize) * 4.0;
+    result += (SampleImage(uv - offset.wy, texelSize) + SampleImage(uv + offset.zw, texelSize) +
+               SampleImage(uv + offset.xw, texelSize) + SampleImage(uv + offset.wy, texelSize)) * 2.0;
+    result += SampleImage(uv - offset.xy, texelSize) + SampleImage(uv - offset.zy, texelSize) +
+              SampleImage(uv + offset.zy, texelSize) + SampleImage(uv + offset.xy, texelSize);
+
+    // Blended additively onto the level above
+    oColor = vec4(result / 16.0, 1.0);
+}
+
+#endif
+
 #endif
 #endif
 
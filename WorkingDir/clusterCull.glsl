@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Cluster culling. One workgroup per meshlet of a draw: the first invocation
+// tests the meshlet's bounding sphere against the frustum and its normal cone
+// against the camera position, and reserves room in the draw's index range if
+// it's visible. Then every invocation copies one triangle. The draw command's
+// count ends up with the indices of the visible meshlets only.
+#ifdef CLUSTER_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// MESHLET_MAX_TRIANGLES fit in a workgroup
+layout(local_size_x = 128) in;
+
+struct Meshlet
+{
+    vec4 sphere;    // center, radius
+    vec4 cone;      // axis, cutoff
+    uint firstIndex;
+    uint indexCount;
+    uint pad0;
+    uint pad1;
+};
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    uint baseVertex;
+    uint baseInstance;
+};
+
+layout(binding = 4, std430) readonly buffer Meshlets
+{
+    Meshlet meshlets[];
+};
+
+layout(binding = 5, std430) readonly buffer SourceIndices
+{
+    uint sourceIndices[];
+};
+
+layout(binding = 6, std430) writeonly buffer CulledIndices
+{
+    uint culledIndices[];
+};
+
+layout(binding = 7, std430) buffer DrawCommands
+{
+    DrawCommand commands[];
+};
+
+uniform mat4 viewProjection;   // without the TAA jitter
+uniform vec3 cameraPosition;
+uniform mat4 worldMatrix;
+uniform float maxScale;        // of the world matrix, for the sphere radius
+uniform int coneCulling;       // 0 under non-uniform scales, the cone doesn't bound the normals anymore
+uniform uint meshletOffset;    // first meshlet of the submesh
+uniform uint sourceFirstIndex; // first index of the submesh in the mesh index buffer
+uniform uint drawIdx;
+
+shared bool visible;
+shared uint outputIndex;
+
+bool SphereInFrustum(vec3 center, float radius)
+{
+    // Planes from the rows of the view projection, w +- x, y, z
+    vec4 rowW = vec4(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    for (int i = 0; i < 3; ++i)
+    {
+        vec4 row = vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        vec4 planes[2] = vec4[2](rowW + row, rowW - row);
+        for (int j = 0; j < 2; ++j)
+        {
+            if (dot(planes[j].xyz, center) + planes[j].w < -radius * length(planes[j].xyz))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Every triangle of the cluster faces away when the camera is inside the flipped cone (see ComputeMeshletBounds)
+bool ConeBackfacing(vec3 center, float radius, vec3 axis, float cutoff)
+{
+    vec3 toCenter = center - cameraPosition;
+    return dot(toCenter, axis) >= cutoff * length(toCenter) + radius;
+}
+
+void main()
+{
+    Meshlet meshlet = meshlets[meshletOffset + gl_WorkGroupID.x];
+
+    if (gl_LocalInvocationIndex == 0u)
+    {
+        vec3 center = vec3(worldMatrix * vec4(meshlet.sphere.xyz, 1.0));
+        float radius = meshlet.sphere.w * maxScale;
+        vec3 axis = normalize(mat3(worldMatrix) * meshlet.cone.xyz);
+
+        visible = SphereInFrustum(center, radius) && !(coneCulling != 0 && ConeBackfacing(center, radius, axis, meshlet.cone.w));
+        if (visible)
+            outputIndex = commands[drawIdx].firstIndex + atomicAdd(commands[drawIdx].count, meshlet.indexCount);
+    }
+
+    memoryBarrierShared();
+    barrier();
+
+    uint index = gl_LocalInvocationIndex * 3u;
+    if (!visible || index >= meshlet.indexCount)
+        return;
+
+    for (uint i = 0u; i < 3u; ++i)
+    {
+        culledIndices[outputIndex + index + i] = sourceIndices[sourceFirstIndex + meshlet.firstIndex + index + i];
+    }
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
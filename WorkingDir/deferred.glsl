@@ -13,12 +13,17 @@ layout(location=2) in vec2 aTexCoord;
 
 out vec2 vTexCoord;
 
+// Rendered sub-rect of the pooled render targets
+uniform vec2 uvScale;
+
 struct Light
 {
     int type;
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
@@ -28,15 +33,9 @@ layout(binding = 0, std140) uniform GlobalParams
     Light uLights[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
-{
-    mat4 uWorldMatrix;
-    mat4 uWorldViewProjectionMatrix;
-};
-
 void main()
 {
-    vTexCoord = aTexCoord;
+    vTexCoord = aTexCoord * uvScale;
     gl_Position = vec4(aPosition, 1.0);
 }
 
@@ -48,19 +47,27 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 in vec2 vTexCoord;
 
-layout(location = 0) uniform sampler2D positions;
-layout(location = 1) uniform sampler2D normals;
-layout(location = 2) uniform sampler2D colors;
-layout(location = 4) uniform sampler2D forwardColor;
-layout(location = 5) uniform sampler2D depth;
-layout(location = 6) uniform sampler2D bloom;
+layout(location = 0) uniform sampler2D normals;
+layout(location = 1) uniform sampler2D colors;
+layout(location = 4) uniform sampler2D depth;
+layout(location = 7) uniform samplerCubeArray shadowMaps;
+layout(location = 8) uniform sampler2D stochasticLighting;
+
+// Reduced resolution lighting and the G-buffer it was shaded from
+layout(location = 11) uniform sampler2D lightingNormals;
+layout(location = 12) uniform sampler2D lightingDepth;
+layout(location = 9) uniform sampler2D lighting;
+layout(location = 10) uniform sampler2D lightingEdges;
+uniform vec2 lightingSize; // rendered area, in texels
 
-uniform int renderMode;
-uniform int hdrActive;
+uniform mat4 inverseViewProjection;
+uniform vec2 uvScale;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
@@ -71,6 +78,21 @@ layout(binding = 0, std140) uniform GlobalParams
 
 layout(location = 0) out vec4 oColor;
 
+vec3 DecodeNormal(vec2 f)
+{
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+// World position from the depth buffer
+vec3 ReconstructPosition(vec2 uv, float depthValue)
+{
+    vec4 world = inverseViewProjection * vec4(vec3(uv / uvScale, depthValue) * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+
 vec3 CalcDirectionalLight(Light dirLight, vec3 normal, vec3 viewDirection)
 {
 	vec3 lightDir = normalize(dirLight.direction);
@@ -91,6 +113,22 @@ vec3 CalcDirectionalLight(Light dirLight, vec3 normal, vec3 viewDirection)
 	return diffuse + ambient + specular;
 }
 
+float CalcPointShadow(Light pointLight, vec3 fragPos)
+{
+    if (pointLight.shadowSlot < 0)
+        return 1.0;
+
+    vec3 lightToFrag = fragPos - pointLight.position;
+    float currentDepth = length(lightToFrag) / pointLight.radius;
+    if (currentDepth >= 1.0)
+        return 1.0;
+
+    float closestDepth = texture(shadowMaps, vec4(lightToFrag, float(pointLight.shadowSlot))).r;
+    const float bias = 0.005;
+
+    return currentDepth - bias > closestDepth ? 0.0 : 1.0;
+}
+
 vec3 CalcPointLight(Light pointLight, vec3 normal, vec3 viewDirection, vec3 fragPos)
 {
 	vec3 ambient = vec3(0.1);
@@ -107,70 +145,146 @@ vec3 CalcPointLight(Light pointLight, vec3 normal, vec3 viewDirection, vec3 frag
 	
 	float distance = length(pointLight.position - fragPos);
 	float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * (distance * distance));
+	float shadow = CalcPointShadow(pointLight, fragPos);
 
 	ambient  *= attenuation; 
-	diffuse  *= attenuation;
-	specular *= attenuation;     
+	diffuse  *= attenuation * shadow;
+	specular *= attenuation * shadow;     
 
 	return diffuse + ambient + specular;
 }
-void main()
+
+// Joint bilateral filter of the one-light-per-pixel lighting, guided by the G-buffer
+vec3 DenoiseStochasticLighting(vec3 fragPos, vec3 normal)
 {
-    if (renderMode == 0)
+    vec2 texelSize = 1.0 / vec2(textureSize(stochasticLighting, 0));
+    float viewDistance = length(uCameraPosition - fragPos);
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    for (int y = -1; y <= 1; ++y)
     {
-        vec3 color = texture(colors, vTexCoord).rgb;
-        vec3 positionFrag = texture(positions, vTexCoord).rgb;
-        vec3 normalFrag = normalize(texture(normals, vTexCoord).rgb);
+        for (int x = -1; x <= 1; ++x)
+        {
+            vec2 uv = min(vTexCoord + vec2(x, y) * 2.0 * texelSize, uvScale - 0.5 * texelSize);
+            if (texture(colors, uv).a < 0.5)
+                continue;
+            vec3 sampleNormal = DecodeNormal(texture(normals, uv).rg);
+            vec3 samplePos = ReconstructPosition(uv, texture(depth, uv).r);
 
-        vec3 viewDir = normalize(uCameraPosition - positionFrag);
+            float normalWeight = pow(max(dot(sampleNormal, normal), 0.0), 32.0);
+            float planeDistance = abs(dot(samplePos - fragPos, normal)) / (0.05 * viewDistance);
+            float weight = normalWeight * exp(-planeDistance * planeDistance) * ((x == 0 && y == 0) ? 2.0 : 1.0);
 
-        vec3 result;
-        for (int i = 0; i < uLightCount; ++i)
-        {
-            if (uLights[i].type == 0)
-            {
-                result += CalcDirectionalLight(uLights[i], normalFrag, viewDir) * color;
-            }
-            else if (uLights[i].type == 1)
-            {
-                result += CalcPointLight(uLights[i], normalFrag, viewDir, positionFrag) * color;
-            }
+            sum += texture(stochasticLighting, uv).rgb * weight;
+            weightSum += weight;
         }
+    }
 
-        if (hdrActive == 0)
+    return weightSum > 0.0 ? sum / weightSum : texture(stochasticLighting, vTexCoord).rgb;
+}
+
+// Sum of every light, without the albedo
+vec3 ShadeLights(vec3 normal, vec3 viewDirection, vec3 fragPos)
+{
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < uLightCount; ++i)
+    {
+        if (uLights[i].type == 0)
         {
-            const float gamma = 2.2;
-  
-            // reinhard tone mapping
-            vec3 mapped = result / (result + vec3(1.0));
-            // gamma correction 
-            mapped = pow(mapped, vec3(1.0 / gamma));
-  
-            oColor = vec4(mapped, 1.0);
-            oColor += vec4(texture(bloom, vTexCoord).rgb, 1.0);
+            result += CalcDirectionalLight(uLights[i], normal, viewDirection);
         }
-        else
+        else if (uLights[i].type == 1)
         {
-            oColor += vec4(result, 1.0);
-            oColor += vec4(texture(bloom, vTexCoord).rgb, 1.0);
+            result += CalcPointLight(uLights[i], normal, viewDirection, fragPos);
         }
     }
-    else if (renderMode == 1)
-    {
-        oColor = vec4(texture(positions, vTexCoord).rgb, 1.0);
-    }
-    else if (renderMode == 2)
+    return result;
+}
+
+// Joint bilateral upsample of the reduced resolution lighting: the bilinear weights of the
+// 4 nearest texels, scaled by how well their geometry matches this pixel's. Returns false
+// on the edges the downsample flagged and where no texel matches, those are shaded here.
+bool UpsampleLighting(vec3 fragPos, vec3 normal, out vec3 result)
+{
+    vec2 texelPos = vTexCoord / uvScale * lightingSize - 0.5;
+    ivec2 base = ivec2(floor(texelPos));
+    vec2 f = texelPos - vec2(base);
+    float viewDistance = length(uCameraPosition - fragPos);
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    for (int i = 0; i < 4; ++i)
     {
-        oColor = vec4(texture(normals, vTexCoord).rgb, 1.0);
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), ivec2(lightingSize) - 1);
+        if (texelFetch(lightingEdges, texel, 0).r > 0.5)
+            return false;
+
+        // Same screen position, in the full resolution texture coordinates ReconstructPosition takes
+        vec2 uv = (vec2(texel) + 0.5) / lightingSize * uvScale;
+        vec3 samplePos = ReconstructPosition(uv, texelFetch(lightingDepth, texel, 0).r);
+        vec3 sampleNormal = DecodeNormal(texelFetch(lightingNormals, texel, 0).rg);
+
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float normalWeight = pow(max(dot(sampleNormal, normal), 0.0), 32.0);
+        float planeDistance = abs(dot(samplePos - fragPos, normal)) / (0.05 * viewDistance);
+        float weight = bilinear.x * bilinear.y * normalWeight * exp(-planeDistance * planeDistance);
+
+        sum += texelFetch(lighting, texel, 0).rgb * weight;
+        weightSum += weight;
     }
-    else if (renderMode == 3)
+
+    result = sum / max(weightSum, 1e-4);
+    return weightSum > 1e-3;
+}
+
+void main()
+{
+#if defined(FEATURE_DEBUG_POSITIONS)
+    oColor = vec4(ReconstructPosition(vTexCoord, texture(depth, vTexCoord).r), 1.0);
+#elif defined(FEATURE_DEBUG_NORMALS)
+    oColor = vec4(DecodeNormal(texture(normals, vTexCoord).rg), 1.0);
+#elif defined(FEATURE_DEBUG_ALBEDO)
+    oColor = vec4(texture(colors, vTexCoord).rgb, 1.0);
+#elif defined(FEATURE_DEBUG_DEPTH)
+    oColor = vec4(vec3(texture(depth, vTexCoord).r), 1.0);
+#else
+#if defined(FEATURE_LIGHTING_ONLY)
+    // Reduced resolution pass, lit everywhere and the composite applies the albedo
+    vec4 albedo = vec4(1.0);
+#else
+    vec4 albedo = texture(colors, vTexCoord);
+#endif
+    vec3 color = albedo.rgb;
+    vec3 positionFrag = ReconstructPosition(vTexCoord, texture(depth, vTexCoord).r);
+    vec3 normalFrag = DecodeNormal(texture(normals, vTexCoord).rg);
+
+    vec3 viewDir = normalize(uCameraPosition - positionFrag);
+
+    vec3 result = vec3(0.0);
+    if (albedo.a < 0.5)
     {
-        oColor = vec4(texture(colors, vTexCoord).rgb, 1.0);
+        // Unlit pixels (background and light gizmos)
+        result = color;
     }
-    else if (renderMode == 4)
+    else
     {
-        oColor = vec4(vec3(texture(depth, vTexCoord).r), 1.0);
+#if defined(FEATURE_STOCHASTIC)
+        result = DenoiseStochasticLighting(positionFrag, normalFrag) * color;
+#elif defined(FEATURE_REDUCED_LIGHTING)
+        vec3 lightingFrag;
+        if (!UpsampleLighting(positionFrag, normalFrag, lightingFrag))
+            lightingFrag = ShadeLights(normalFrag, viewDir, positionFrag);
+        result = lightingFrag * color;
+#else
+        result = ShadeLights(normalFrag, viewDir, positionFrag) * color;
+#endif
     }
+
+    // Linear HDR, the post pass does exposure, bloom and tone mapping
+    oColor = vec4(result, 1.0);
+#endif
 }
 
 #endif
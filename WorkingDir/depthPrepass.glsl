@@ -0,0 +1,48 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Depth only pass ahead of the G-buffer / forward pass, which then shades
+// each pixel once with an equal depth test. Reads only the position stream.
+// gl_Position is invariant here and in the programs drawn after it, so the
+// depths match exactly.
+#ifdef DEPTH_PREPASS
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=5) in uint aDrawIdx; // the draw's base instance, see BindDrawIndexAttribute
+
+struct ObjectParams
+{
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;     // jittered when TAA is on
+    mat4 currWorldViewProjectionMatrix; // without the jitter, for the velocity
+    mat4 prevWorldViewProjectionMatrix; // last frame's, also without the jitter
+};
+
+layout(binding = 1, std430) readonly buffer Objects
+{
+    ObjectParams uObjects[];
+};
+
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = uObjects[aDrawIdx].worldViewProjectionMatrix * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main()
+{
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
@@ -0,0 +1,114 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Placeholders drawn while the real programs compile in the background.
+// They're tiny so they're compiled synchronously at startup.
+#ifdef FALLBACK_MESH
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=1) in vec3 aNormal;
+layout(location=5) in uint aDrawIdx; // the draw's base instance, see BindDrawIndexAttribute
+
+out vec3 vNormal;
+out vec4 vCurrClip;
+out vec4 vPrevClip;
+
+struct ObjectParams
+{
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;     // jittered when TAA is on
+    mat4 currWorldViewProjectionMatrix; // without the jitter, for the velocity
+    mat4 prevWorldViewProjectionMatrix; // last frame's, also without the jitter
+};
+
+layout(binding = 1, std430) readonly buffer Objects
+{
+    ObjectParams uObjects[];
+};
+
+// Same depth as the depth pre-pass, which the equal test relies on
+invariant gl_Position;
+
+void main()
+{
+    ObjectParams object = uObjects[aDrawIdx];
+
+    vNormal = mat3(object.worldMatrix) * aNormal;
+    vCurrClip = object.currWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    vPrevClip = object.prevWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    gl_Position = object.worldViewProjectionMatrix * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec3 vNormal;
+in vec4 vCurrClip;
+in vec4 vPrevClip;
+
+#if defined(FEATURE_FORWARD)
+layout(location = 0) out vec4 oColor;
+#else
+layout(location = 0) out vec4 normals;
+layout(location = 1) out vec4 colors;
+layout(location = 2) out vec4 brightColor;
+layout(location = 3) out vec2 velocity;
+#endif
+
+vec2 OctWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 EncodeNormal(vec3 n)
+{
+    n /= (abs(n.x) + abs(n.y) + abs(n.z));
+    n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+    return n.xy;
+}
+
+void main()
+{
+    // Flat grey so the scene keeps its shape
+#if defined(FEATURE_FORWARD)
+    oColor = vec4(0.5, 0.5, 0.5, 1.0);
+#else
+    normals = vec4(EncodeNormal(normalize(vNormal)), 0.0, 0.0);
+    colors = vec4(0.5, 0.5, 0.5, 1.0);
+    brightColor = vec4(0.0, 0.0, 0.0, 1.0);
+    velocity = (vCurrClip.xy / vCurrClip.w - vPrevClip.xy / vPrevClip.w) * 0.5;
+#endif
+}
+
+#endif
+#endif
+
+#ifdef FALLBACK_QUAD
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+
+void main()
+{
+    gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+layout(location = 0) out vec4 oColor;
+
+void main()
+{
+    oColor = vec4(0.0, 0.0, 0.0, 1.0);
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
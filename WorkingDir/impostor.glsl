@@ -0,0 +1,228 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Impostors. A camera facing quad in front of the model's bounding sphere
+// samples the atlas baked from octahedrally distributed directions (see
+// BakeImpostor), blending the four frames closest to the view direction, and
+// writes the G-buffer as if the mesh had been drawn.
+#ifdef IMPOSTOR
+
+// Octahedral mapping of the frame directions with y up, the same as GetImpostorFrameDirection
+vec3 DecodeFrameDirection(vec2 uv)
+{
+    vec2 e = uv * 2.0 - 1.0;
+    vec3 direction = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+    if (direction.y < 0.0)
+        direction.xz = (1.0 - abs(direction.zx)) * vec2(direction.x >= 0.0 ? 1.0 : -1.0, direction.z >= 0.0 ? 1.0 : -1.0);
+    return normalize(direction);
+}
+
+vec2 EncodeFrameDirection(vec3 direction)
+{
+    direction /= abs(direction.x) + abs(direction.y) + abs(direction.z);
+    vec2 e = direction.xz;
+    if (direction.y < 0.0)
+        e = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
+struct ObjectParams
+{
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;     // jittered when TAA is on
+    mat4 currWorldViewProjectionMatrix; // without the jitter, for the velocity
+    mat4 prevWorldViewProjectionMatrix; // last frame's, also without the jitter
+};
+
+layout(binding = 1, std430) readonly buffer Objects
+{
+    ObjectParams uObjects[];
+};
+
+// Camera basis of a frame looking from that direction, the same as the bake's
+void FrameBasis(vec3 direction, out vec3 right, out vec3 up)
+{
+    vec3 worldUp = abs(direction.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    right = normalize(cross(worldUp, direction));
+    up = cross(direction, right);
+}
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=5) in uint aDrawIdx; // the draw's base instance, see BindDrawIndexAttribute
+
+struct Light
+{
+    int type;
+    vec3 color;
+    vec3 direction;
+    vec3 position;
+    float radius;
+    int shadowSlot;
+};
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+    vec3 uCameraPosition;
+    unsigned int uLightCount;
+    Light uLights[16];
+};
+
+
+uniform vec3 boundsCenter; // model space
+uniform float boundsRadius;
+
+out vec3 vPosition; // model space, on the quad
+flat out uint vDrawIdx;
+flat out vec3 vCameraPosition;
+flat out mat3 vNormalMatrix;
+
+void main()
+{
+    ObjectParams object = uObjects[aDrawIdx];
+
+    vDrawIdx = aDrawIdx;
+    vCameraPosition = vec3(inverse(object.worldMatrix) * vec4(uCameraPosition, 1.0));
+    vNormalMatrix = mat3(transpose(inverse(object.worldMatrix)));
+
+    vec3 right, up;
+    vec3 toCamera = normalize(vCameraPosition - boundsCenter);
+    FrameBasis(toCamera, right, up);
+
+    // Tangent to the front of the bounding sphere, at that size it covers its silhouette from anywhere outside it
+    vPosition = boundsCenter + (toCamera + right * aPosition.x + up * aPosition.y) * boundsRadius;
+    gl_Position = object.worldViewProjectionMatrix * vec4(vPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec3 vPosition;
+flat in uint vDrawIdx;
+flat in vec3 vCameraPosition;
+flat in mat3 vNormalMatrix;
+
+layout(location = 0) uniform sampler2D atlasNormals;
+layout(location = 1) uniform sampler2D atlasAlbedo;
+layout(location = 2) uniform sampler2D atlasDepth;
+
+
+uniform vec2 atlasUVScale; // rendered sub-rect of the atlas textures
+uniform int frameGrid;     // frames per side
+uniform vec3 boundsCenter;
+uniform float boundsRadius;
+
+layout(location = 0) out vec4 normals;
+layout(location = 1) out vec4 colors;
+layout(location = 2) out vec4 brightColor;
+layout(location = 3) out vec2 velocity;
+
+vec2 ComputeVelocity(vec4 currClip, vec4 prevClip)
+{
+    return (currClip.xy / currClip.w - prevClip.xy / prevClip.w) * 0.5;
+}
+
+vec2 OctWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 EncodeNormal(vec3 n)
+{
+    n /= (abs(n.x) + abs(n.y) + abs(n.z));
+    n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+    return n.xy;
+}
+
+vec3 DecodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+    return normalize(n);
+}
+
+void main()
+{
+    vec3 rayDirection = normalize(vPosition - vCameraPosition);
+
+    // The four frames around the direction the model is seen from, with bilinear weights.
+    // Frames past the edges of the grid are clamped instead of following the octahedral fold.
+    vec2 gridPosition = EncodeFrameDirection(normalize(vCameraPosition - boundsCenter)) * float(frameGrid) - 0.5;
+    vec2 baseFrame = floor(gridPosition);
+    vec2 blend = gridPosition - baseFrame;
+
+    vec3 albedoSum = vec3(0.0);
+    vec3 normalSum = vec3(0.0);
+    vec3 positionSum = vec3(0.0);
+    float coverage = 0.0;
+    float sampledWeight = 0.0;
+    float positionWeight = 0.0;
+    for (int i = 0; i < 4; ++i)
+    {
+        vec2 corner = vec2(i & 1, i >> 1);
+        vec2 cornerWeights = mix(1.0 - blend, blend, corner);
+        float weight = cornerWeights.x * cornerWeights.y;
+        vec2 frame = clamp(baseFrame + corner, vec2(0.0), vec2(frameGrid - 1));
+
+        vec3 direction = DecodeFrameDirection((frame + 0.5) / float(frameGrid));
+        vec3 right, up;
+        FrameBasis(direction, right, up);
+
+        // Where the pixel's ray crosses the frame's plane through the center
+        float facing = dot(rayDirection, direction);
+        if (facing > -1e-3)
+            continue;
+        vec3 planePosition = vPosition + rayDirection * (dot(boundsCenter - vPosition, direction) / facing) - boundsCenter;
+        vec2 frameUV = vec2(dot(planePosition, right), dot(planePosition, up)) / (2.0 * boundsRadius) + 0.5;
+        if (any(lessThan(frameUV, vec2(0.0))) || any(greaterThan(frameUV, vec2(1.0))))
+            continue;
+
+        vec2 uv = (frame + frameUV) / float(frameGrid) * atlasUVScale;
+        vec4 albedo = texture(atlasAlbedo, uv);
+        float depth = texture(atlasDepth, uv).r;
+
+        // Filtered albedo is already weighted by its coverage
+        albedoSum += albedo.rgb * weight;
+        normalSum += DecodeNormal(texture(atlasNormals, uv).rg) * albedo.a * weight;
+        coverage += albedo.a * weight;
+        sampledWeight += weight;
+
+        // Depth 1 is the clear value, nothing of the model in that texel. The bake's depth range
+        // is [radius, 3 * radius] from the frame's camera, 2 * radius away from the center.
+        if (depth < 1.0)
+        {
+            positionSum += (planePosition + direction * boundsRadius * (1.0 - 2.0 * depth)) * weight;
+            positionWeight += weight;
+        }
+    }
+
+    if (coverage < 0.5 * sampledWeight || positionWeight == 0.0)
+        discard;
+
+    ObjectParams object = uObjects[vDrawIdx];
+    vec3 position = boundsCenter + positionSum / positionWeight;
+    vec4 clip = object.worldViewProjectionMatrix * vec4(position, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+    // The baked normals went through mesh.glsl with an identity world matrix, only
+    // entities that are just translated get exactly what their mesh would write
+    normals = vec4(EncodeNormal(normalize(vNormalMatrix * normalSum)), 0.0, 0.0);
+    velocity = ComputeVelocity(object.currWorldViewProjectionMatrix * vec4(position, 1.0), object.prevWorldViewProjectionMatrix * vec4(position, 1.0));
+
+    colors = vec4(albedoSum / coverage, 1.0);
+
+    float brightness = dot(colors.rgb, vec3(0.2126, 0.7152, 0.0722));
+    if(brightness > 0.0)
+        brightColor = vec4(colors.rgb, 1.0);
+    else
+        brightColor = vec4(0.0, 0.0, 0.0, 1.0);
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef LIGHTING_DOWNSAMPLE
+
+// G-buffer for the reduced resolution lighting. Each texel keeps the depth and
+// normal of one full resolution pixel of its block (the closest lit one), so the
+// upsample compares against real geometry instead of an average of surfaces.
+// Blocks whose pixels don't agree are flagged as edges and shaded at full rate.
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+
+void main()
+{
+    gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+struct Light
+{
+    int type;
+    vec3 color;
+    vec3 direction;
+    vec3 position;
+    float radius;
+    int shadowSlot;
+};
+
+layout(location = 0) uniform sampler2D normals;
+layout(location = 1) uniform sampler2D colors;
+layout(location = 4) uniform sampler2D depth;
+
+uniform int factor;        // full resolution pixels per texel side
+uniform vec2 size;         // rendered area of the G-buffer
+uniform mat4 inverseViewProjection;
+uniform vec2 uvScale;
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+    vec3 uCameraPosition;
+    unsigned int uLightCount;
+    Light uLights[16];
+};
+
+layout(location = 0) out vec2 oNormal;
+layout(location = 1) out float oEdge;
+
+vec3 DecodeNormal(vec2 f)
+{
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+// World position from the depth buffer
+vec3 ReconstructPosition(vec2 uv, float depthValue)
+{
+    vec4 world = inverseViewProjection * vec4(vec3(uv / uvScale, depthValue) * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+
+void main()
+{
+    ivec2 origin = ivec2(gl_FragCoord.xy) * factor;
+    vec2 textureSizeF = vec2(textureSize(depth, 0));
+
+    float closestDepth = 1.0;
+    vec2 closestNormal = vec2(0.0, 0.0);
+    float minDistance = 1e20;
+    float maxDistance = 0.0;
+    vec3 firstNormal = vec3(0.0);
+    float minNormalDot = 1.0;
+    int litCount = 0;
+    int count = 0;
+
+    for (int y = 0; y < factor; ++y)
+    {
+        for (int x = 0; x < factor; ++x)
+        {
+            ivec2 pixel = min(origin + ivec2(x, y), ivec2(size) - 1);
+            if (texelFetch(colors, pixel, 0).a < 0.5)
+            {
+                ++count;
+                continue;
+            }
+
+            float depthValue = texelFetch(depth, pixel, 0).r;
+            vec2 encodedNormal = texelFetch(normals, pixel, 0).rg;
+            vec3 normal = DecodeNormal(encodedNormal);
+            float distance = length(ReconstructPosition((vec2(pixel) + 0.5) / textureSizeF, depthValue) - uCameraPosition);
+
+            if (litCount == 0)
+                firstNormal = normal;
+            minNormalDot = min(minNormalDot, dot(normal, firstNormal));
+            minDistance = min(minDistance, distance);
+            maxDistance = max(maxDistance, distance);
+
+            if (depthValue < closestDepth)
+            {
+                closestDepth = depthValue;
+                closestNormal = encodedNormal;
+            }
+
+            ++litCount;
+            ++count;
+        }
+    }
+
+    // Mixed lit and unlit pixels, a depth step or a crease
+    bool edge = (litCount > 0 && litCount < count) || maxDistance - minDistance > 0.05 * minDistance || minNormalDot < 0.9;
+
+    oNormal = closestNormal;
+    oEdge = edge ? 1.0 : 0.0;
+    gl_FragDepth = closestDepth;
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
@@ -17,6 +17,8 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
@@ -26,18 +28,21 @@ layout(binding = 0, std140) uniform GlobalParams
     Light uLights[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
-{
-    mat4 uWorldMatrix;
-    mat4 uWorldViewProjectionMatrix;
-};
-
 uniform mat4 viewProjectionMatrix;
+uniform mat4 currViewProjectionMatrix; // without the TAA jitter
+uniform mat4 prevViewProjectionMatrix;
 uniform mat4 modelMatrix;
 
+out vec4 vCurrClip;
+out vec4 vPrevClip;
+
 void main()
 {
-    gl_Position = viewProjectionMatrix * modelMatrix * vec4(aPosition, 1.0);
+    // Lights don't keep a previous transform, only the camera moves them on screen
+    vec4 worldPosition = modelMatrix * vec4(aPosition, 1.0);
+    vCurrClip = currViewProjectionMatrix * worldPosition;
+    vPrevClip = prevViewProjectionMatrix * worldPosition;
+    gl_Position = viewProjectionMatrix * worldPosition;
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -48,15 +53,35 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
+#if defined(FEATURE_FORWARD)
 layout(location=0) out vec4 oColor;
+#else
+// G-buffer outputs, the light is drawn unlit (albedo alpha 0)
+layout(location=0) out vec4 normals;
+layout(location=1) out vec4 colors;
+layout(location=2) out vec4 brightColor;
+layout(location=3) out vec2 velocity;
+#endif
+
+in vec4 vCurrClip;
+in vec4 vPrevClip;
 
 uniform vec3 color;
 
 void main()
 {
+#if defined(FEATURE_FORWARD)
     oColor = vec4(color, 1.0);
+#else
+    normals = vec4(0.0);
+    colors = vec4(color, 0.0);
+    brightColor = vec4(color, 1.0);
+    velocity = (vCurrClip.xy / vCurrClip.w - vPrevClip.xy / vPrevClip.w) * 0.5;
+#endif
 }
 
 #endif
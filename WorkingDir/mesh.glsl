@@ -10,6 +10,7 @@ layout(location=1) in vec3 aNormal;
 layout(location=2) in vec2 aTexCoord;
 layout(location=3) in vec3 aTangent;
 layout(location=4) in vec3 aBiTangent;
+layout(location=5) in uint aDrawIdx; // the draw's base instance, see BindDrawIndexAttribute
 
 out vec2 vTexCoord;
 out vec3 vPosition;
@@ -18,6 +19,8 @@ out vec3 vTangentViewPos;
 out vec3 vNormal;
 out vec3 vViewDir;
 out mat3 tbn;
+out vec4 vCurrClip;
+out vec4 vPrevClip;
 
 struct Light
 {
@@ -25,6 +28,8 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
@@ -34,28 +39,42 @@ layout(binding = 0, std140) uniform GlobalParams
     Light uLights[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
+struct ObjectParams
 {
-    mat4 uWorldMatrix;
-    mat4 uWorldViewProjectionMatrix;
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;     // jittered when TAA is on
+    mat4 currWorldViewProjectionMatrix; // without the jitter, for the velocity
+    mat4 prevWorldViewProjectionMatrix; // last frame's, also without the jitter
 };
 
+layout(binding = 1, std430) readonly buffer Objects
+{
+    ObjectParams uObjects[];
+};
+
+// Same depth as the depth pre-pass, which the equal test relies on
+invariant gl_Position;
+
 void main()
 {
-    vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+    ObjectParams object = uObjects[aDrawIdx];
+
+    vPosition = vec3(object.worldMatrix * vec4(aPosition, 1.0));
     vTexCoord = aTexCoord;
-    vNormal = mat3(transpose(inverse(uWorldMatrix))) * aNormal;
+    vNormal = mat3(transpose(inverse(object.worldMatrix))) * aNormal;
     vViewDir = uCameraPosition - vPosition;
 
-    vec3 t = normalize(mat3(uWorldMatrix) * aTangent);
-    vec3 b = normalize(mat3(uWorldMatrix) * aBiTangent);
-    vec3 n = normalize(mat3(uWorldMatrix) * aNormal);
+    vec3 t = normalize(mat3(object.worldMatrix) * aTangent);
+    vec3 b = normalize(mat3(object.worldMatrix) * aBiTangent);
+    vec3 n = normalize(mat3(object.worldMatrix) * aNormal);
     tbn = transpose(mat3(t, b, n));
 
     vTangentViewPos = tbn * uCameraPosition;
     vTangentFragPos = tbn * vPosition;
 
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    vCurrClip = object.currWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    vPrevClip = object.prevWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    gl_Position = object.worldViewProjectionMatrix * vec4(aPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -66,6 +85,8 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 in vec2 vTexCoord;
@@ -75,12 +96,13 @@ in vec3 vViewDir;
 in vec3 vTangentFragPos;
 in vec3 vTangentViewPos;
 in mat3 tbn;
+in vec4 vCurrClip;
+in vec4 vPrevClip;
 
 layout(location = 0) uniform sampler2D uTexture;
 layout(location = 1) uniform sampler2D normalTexture;
 layout(location = 2) uniform sampler2D depthTexture;
-
-uniform int renderMode;
+layout(location = 7) uniform samplerCubeArray shadowMaps;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
@@ -89,11 +111,34 @@ layout(binding = 0, std140) uniform GlobalParams
     Light uLights[16];
 };
 
-layout(location = 0) out vec4 positions;
-layout(location = 1) out vec4 normals;
-layout(location = 2) out vec4 colors;
-layout(location = 3) out vec4 brightColor;
-layout(location = 4) out vec4 forwardColor;
+#if defined(FEATURE_FORWARD)
+// Forward shading goes straight to the HDR scene color, no G-buffer
+layout(location = 0) out vec4 oColor;
+#else
+layout(location = 0) out vec4 normals;
+layout(location = 1) out vec4 colors;
+layout(location = 2) out vec4 brightColor;
+layout(location = 3) out vec2 velocity;
+#endif
+
+// Screen space motion since the last frame, in UV units
+vec2 ComputeVelocity(vec4 currClip, vec4 prevClip)
+{
+    return (currClip.xy / currClip.w - prevClip.xy / prevClip.w) * 0.5;
+}
+
+// Octahedral normal encoding for the RG16_SNORM G-buffer target
+vec2 OctWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 EncodeNormal(vec3 n)
+{
+    n /= (abs(n.x) + abs(n.y) + abs(n.z));
+    n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+    return n.xy;
+}
 
 vec3 CalcDirectionalLight(vec3 direction, vec3 color, vec3 vPosition, vec3 vNormal)
 {
@@ -116,7 +161,23 @@ vec3 CalcDirectionalLight(vec3 direction, vec3 color, vec3 vPosition, vec3 vNorm
     return (ambient + diffuse + specular);
 }
 
-vec3 CalcPointLight(vec3 position, vec3 color, vec3 fragPosition, vec3 normal)
+float CalcPointShadow(Light pointLight, vec3 fragPos)
+{
+    if (pointLight.shadowSlot < 0)
+        return 1.0;
+
+    vec3 lightToFrag = fragPos - pointLight.position;
+    float currentDepth = length(lightToFrag) / pointLight.radius;
+    if (currentDepth >= 1.0)
+        return 1.0;
+
+    float closestDepth = texture(shadowMaps, vec4(lightToFrag, float(pointLight.shadowSlot))).r;
+    const float bias = 0.005;
+
+    return currentDepth - bias > closestDepth ? 0.0 : 1.0;
+}
+
+vec3 CalcPointLight(vec3 position, vec3 color, vec3 fragPosition, vec3 normal, float shadow)
 {
     float ambientStrength = 0.1;
     vec3 ambient = ambientStrength * color;
@@ -138,43 +199,45 @@ vec3 CalcPointLight(vec3 position, vec3 color, vec3 fragPosition, vec3 normal)
     float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * (distance * distance));
 
     ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
+    diffuse *= attenuation * shadow;
+    specular *= attenuation * shadow;
 
     return (ambient + diffuse + specular);
 }
 
 void main()
 { 
-    positions = vec4(vPosition, 1.0);
     vec3 normal = normalize(vNormal * 2.0 - 1.0);
-    normals = vec4(normal, 1.0);
+    vec3 albedo = texture(uTexture, vTexCoord).rgb;
+
+#if defined(FEATURE_FORWARD)
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < uLightCount; ++i)
+    {
+        if (uLights[i].type == 0)
+        {
+            result += CalcDirectionalLight(uLights[i].direction, uLights[i].color, vPosition, normal) * albedo;
+        }
+        else if (uLights[i].type == 1)
+        {
+            float shadow = CalcPointShadow(uLights[i], vPosition);
+            result += CalcPointLight(uLights[i].position, uLights[i].color, vPosition, normal, shadow) * albedo;
+        }
 
-    colors = vec4(texture(uTexture, vTexCoord).rgb, 1.0);
+    }
+    oColor = vec4(result, 1.0);
+#else
+    normals = vec4(EncodeNormal(normal), 0.0, 0.0);
+    velocity = ComputeVelocity(vCurrClip, vPrevClip);
+
+    colors = vec4(albedo, 1.0);
     
     float brightness = dot(colors.rgb, vec3(0.2126, 0.7152, 0.0722));
     if(brightness > 0.0)
         brightColor = vec4(colors.rgb, 1.0);
     else
         brightColor = vec4(0.0, 0.0, 0.0, 1.0);
-
-    if (renderMode == 0)
-    {
-        vec3 result;
-        for (int i = 0; i < uLightCount; ++i)
-        {
-            if (uLights[i].type == 0)
-            {
-                result += CalcDirectionalLight(uLights[i].direction, uLights[i].color, vPosition, normal) * colors.rgb;
-            }
-            else if (uLights[i].type == 1)
-            {
-                result += CalcPointLight(uLights[i].position, uLights[i].color, vPosition, normal) * colors.rgb;
-            }
-
-        }
-        forwardColor = vec4(result, 1.0);
-    }
+#endif
 }
 
 #endif
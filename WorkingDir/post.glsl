@@ -0,0 +1,145 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#if defined(POST) || defined(EXPOSURE_ADAPT)
+
+// HDR scene color to display. POST applies the exposure, adds the bloom, tone
+// maps through the 3D LUT and encodes sRGB in one pass over the pixels, while
+// it builds the luminance histogram of the frame. EXPOSURE_ADAPT turns the
+// histogram into the exposure of the next frame, it never leaves the GPU.
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+#define HISTOGRAM_BINS 256
+
+layout(binding = 3, std430) buffer Exposure
+{
+    uint histogram[HISTOGRAM_BINS];
+    float exposure;
+    float adaptedLuminance;
+};
+
+// log2 luminance range covered by bins 1 to 255, bin 0 keeps the black pixels
+uniform float minLogLuminance;
+uniform float logLuminanceRange;
+
+#if defined(POST)
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(location = 0) uniform sampler2D sceneColor;
+layout(location = 1) uniform sampler2D bloom;
+layout(location = 2) uniform sampler3D tonemapLUT;
+layout(binding = 0, rgba8) uniform writeonly image2D outputImage;
+
+uniform vec2 size;         // rendered area of the scene color, the output has the same
+uniform vec2 bloomUVScale; // the bloom is half resolution, with its own sub-rect
+uniform float bloomIntensity;
+
+// The LUT is indexed by log2 of the exposed color
+uniform float lutMinLog;
+uniform float lutLogRange;
+
+shared uint localHistogram[HISTOGRAM_BINS];
+
+uint LuminanceBin(float luminance)
+{
+    if (luminance < exp2(minLogLuminance))
+        return 0;
+
+    float t = clamp((log2(luminance) - minLogLuminance) / logLuminanceRange, 0.0, 1.0);
+    return uint(t * 254.0 + 1.0);
+}
+
+vec3 Tonemap(vec3 color)
+{
+    float lutSize = float(textureSize(tonemapLUT, 0).x);
+    vec3 t = clamp((log2(max(color, vec3(1e-8))) - lutMinLog) / lutLogRange, 0.0, 1.0);
+    return texture(tonemapLUT, t * ((lutSize - 1.0) / lutSize) + 0.5 / lutSize).rgb;
+}
+
+vec3 LinearToSRGB(vec3 color)
+{
+    vec3 low = color * 12.92;
+    vec3 high = 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055;
+    return mix(high, low, lessThanEqual(color, vec3(0.0031308)));
+}
+
+void main()
+{
+    localHistogram[gl_LocalInvocationIndex] = 0;
+    barrier();
+
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(pixel, ivec2(size))))
+    {
+        vec3 color = texelFetch(sceneColor, pixel, 0).rgb;
+        atomicAdd(localHistogram[LuminanceBin(dot(color, vec3(0.2126, 0.7152, 0.0722)))], 1);
+
+        vec2 uv = (vec2(pixel) + 0.5) / size;
+        color += texture(bloom, uv * bloomUVScale).rgb * bloomIntensity;
+
+#if defined(FEATURE_HDR)
+        color = Tonemap(color * exposure);
+#endif
+        imageStore(outputImage, pixel, vec4(LinearToSRGB(clamp(color, 0.0, 1.0)), 1.0));
+    }
+
+    // One global atomic per bin and group instead of one per pixel
+    barrier();
+    uint count = localHistogram[gl_LocalInvocationIndex];
+    if (count > 0)
+        atomicAdd(histogram[gl_LocalInvocationIndex], count);
+}
+
+#else // EXPOSURE_ADAPT
+
+layout(local_size_x = HISTOGRAM_BINS) in;
+
+uniform float pixelCount;
+uniform float deltaTime;
+uniform float adaptationSpeed;
+uniform float exposureCompensation; // in stops
+
+shared float weightedBins[HISTOGRAM_BINS];
+
+void main()
+{
+    uint bin = gl_LocalInvocationIndex;
+    uint count = histogram[bin];
+    weightedBins[bin] = float(count) * float(bin);
+    histogram[bin] = 0; // ready for the next frame
+    barrier();
+
+    for (uint stride = HISTOGRAM_BINS / 2; stride > 0; stride >>= 1)
+    {
+        if (bin < stride)
+            weightedBins[bin] += weightedBins[bin + stride];
+        barrier();
+    }
+
+    if (bin == 0)
+    {
+        // Average over the lit pixels, bin 0 contributes nothing to the weighted sum
+        float litPixels = max(pixelCount - float(count), 1.0);
+        float averageBin = weightedBins[0] / litPixels;
+        float averageLuminance = exp2((averageBin - 1.0) / 254.0 * logLuminanceRange + minLogLuminance);
+        if (litPixels <= 1.0)
+            averageLuminance = adaptedLuminance;
+
+        adaptedLuminance += (averageLuminance - adaptedLuminance) * (1.0 - exp(-deltaTime * adaptationSpeed));
+
+        // Middle grey for the average luminance
+        exposure = 0.18 / max(adaptedLuminance, 1e-4) * exp2(exposureCompensation);
+    }
+}
+
+#endif
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
@@ -13,9 +13,12 @@ layout(location=2) in vec2 aTexCoord;
 
 out vec2 vTexCoord;
 
+// Rendered sub-rect of the pooled render targets
+uniform vec2 uvScale;
+
 void main()
 {
-    vTexCoord = aTexCoord;
+    vTexCoord = aTexCoord * uvScale;
     gl_Position = vec4(aPosition, 1.0);
 }
 
@@ -29,17 +32,16 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
-layout(location = 0) uniform sampler2D positions;
-layout(location = 1) uniform sampler2D normals;
-layout(location = 2) uniform sampler2D colors;
-layout(location = 4) uniform sampler2D forwardColor;
-layout(location = 5) uniform sampler2D depth;
-layout(location = 6) uniform sampler2D bloom;
+layout(location = 0) uniform sampler2D normals;
+layout(location = 1) uniform sampler2D colors;
+layout(location = 4) uniform sampler2D depth;
 
-uniform int renderMode;
-uniform int hdrActive;
+uniform mat4 inverseViewProjection;
+uniform vec2 uvScale;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
@@ -50,45 +52,35 @@ layout(binding = 0, std140) uniform GlobalParams
 
 layout(location = 0) out vec4 oColor;
 
+vec3 DecodeNormal(vec2 f)
+{
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+// World position from the depth buffer
+vec3 ReconstructPosition(vec2 uv, float depthValue)
+{
+    vec4 world = inverseViewProjection * vec4(vec3(uv / uvScale, depthValue) * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+
 void main()
 {
-    if (renderMode == 0)
-    {
-        vec3 colorFinal = texture(forwardColor, vTexCoord).rgb;
-        if (hdrActive == 0)
-        {
-            const float gamma = 2.2;
-  
-            // reinhard tone mapping
-            vec3 mapped = colorFinal / (colorFinal + vec3(1.0));
-            // gamma correction 
-            mapped = pow(mapped, vec3(1.0 / gamma));
-  
-            oColor = vec4(mapped, 1.0);
-            oColor += vec4(texture(bloom, vTexCoord).rgb, 1.0);
-        }
-        else
-        {
-            oColor += vec4(colorFinal, 1.0);
-            oColor += vec4(texture(bloom, vTexCoord).rgb, 1.0);
-        }
-    }
-    if (renderMode == 1)
-    {
-        oColor = vec4(texture(positions, vTexCoord).rgb, 1.0);
-    }
-    if (renderMode == 2)
-    {
-        oColor = vec4(texture(normals, vTexCoord).rgb, 1.0);
-    }
-    if (renderMode == 3)
-    {
-        oColor = vec4(texture(colors, vTexCoord).rgb, 1.0);
-    }
-    if (renderMode == 4)
-    {
-        oColor = vec4(vec3(texture(depth, vTexCoord).r), 1.0);
-    }
+#if defined(FEATURE_DEBUG_POSITIONS)
+    oColor = vec4(ReconstructPosition(vTexCoord, texture(depth, vTexCoord).r), 1.0);
+#elif defined(FEATURE_DEBUG_NORMALS)
+    oColor = vec4(DecodeNormal(texture(normals, vTexCoord).rg), 1.0);
+#elif defined(FEATURE_DEBUG_ALBEDO)
+    oColor = vec4(texture(colors, vTexCoord).rgb, 1.0);
+#elif defined(FEATURE_DEBUG_DEPTH)
+    oColor = vec4(vec3(texture(depth, vTexCoord).r), 1.0);
+#else
+    // The final render is shaded in the geometry pass and never comes through here
+    oColor = vec4(texture(colors, vTexCoord).rgb, 1.0);
+#endif
 }
 
 #endif
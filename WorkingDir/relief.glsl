@@ -11,6 +11,8 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
@@ -20,10 +22,17 @@ layout(binding = 0, std140) uniform GlobalParams
     Light uLights[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
+struct ObjectParams
 {
-    mat4 uWorldMatrix;
-    mat4 uWorldViewProjectionMatrix;
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;     // jittered when TAA is on
+    mat4 currWorldViewProjectionMatrix; // without the jitter, for the velocity
+    mat4 prevWorldViewProjectionMatrix; // last frame's, also without the jitter
+};
+
+layout(binding = 1, std430) readonly buffer Objects
+{
+    ObjectParams uObjects[];
 };
 
 layout(location=0) in vec3 aPosition;
@@ -31,6 +40,7 @@ layout(location=1) in vec3 aNormal;
 layout(location=2) in vec2 aTexCoord;
 layout(location=3) in vec3 aTangent;
 layout(location=4) in vec3 aBiTangent;
+layout(location=5) in uint aDrawIdx; // the draw's base instance, see BindDrawIndexAttribute
 
 out vec3 fragPos;
 out vec2 texCoords;
@@ -42,16 +52,21 @@ out vec3 t;
 out vec3 b;
 out vec3 n;
 
+out vec4 vCurrClip;
+out vec4 vPrevClip;
+
 uniform vec3 viewPos;
 
 void main()
 {
-    fragPos = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+    ObjectParams object = uObjects[aDrawIdx];
+
+    fragPos = vec3(object.worldMatrix * vec4(aPosition, 1.0));
 	texCoords = aTexCoord;
 
-	vec3 T = normalize(mat3(uWorldMatrix) * aTangent);
-	vec3 B = normalize(mat3(uWorldMatrix) * aBiTangent);
-	vec3 N = normalize(mat3(uWorldMatrix) * aNormal);
+	vec3 T = normalize(mat3(object.worldMatrix) * aTangent);
+	vec3 B = normalize(mat3(object.worldMatrix) * aBiTangent);
+	vec3 N = normalize(mat3(object.worldMatrix) * aNormal);
 	tbn = mat3(T, B, N);
 
     t = T;
@@ -61,9 +76,11 @@ void main()
     tangentViewPos = tbn * viewPos;
 	tangentFragPos = tbn * fragPos;
 	
-	//vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
+	//vNormal = vec3(object.worldMatrix * vec4(aNormal, 0.0));
 	
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	vCurrClip = object.currWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	vPrevClip = object.prevWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = object.worldViewProjectionMatrix * vec4(aPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -78,21 +95,30 @@ in vec3 t;
 in vec3 b;
 in vec3 n;
 
+in vec4 vCurrClip;
+in vec4 vPrevClip;
+
 layout(location = 0) uniform sampler2D uTexture;
 layout(location = 1) uniform sampler2D normalTexture;
 layout(location = 2) uniform sampler2D depthTexture;
+layout(location = 7) uniform samplerCubeArray shadowMaps;
 
-uniform int renderMode;
 uniform float minLayers;
 uniform float maxLayers;
 uniform float heightScale;
 
+// With TAA the march starts at a different depth every frame and pixel, so fewer layers average out
+uniform int temporalLayers;
+uniform uint frameIndex;
+
 struct Light
 {
     int type;
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
@@ -102,11 +128,39 @@ layout(binding = 0, std140) uniform GlobalParams
     Light uLights[16];
 };
 
-layout(location = 0) out vec4 positions;
-layout(location = 1) out vec4 normals;
-layout(location = 2) out vec4 colors;
-layout(location = 3) out vec4 brightColor;
-layout(location = 4) out vec4 forwardColor;
+#if defined(FEATURE_FORWARD)
+// Forward shading goes straight to the HDR scene color, no G-buffer
+layout(location = 0) out vec4 oColor;
+#else
+layout(location = 0) out vec4 normals;
+layout(location = 1) out vec4 colors;
+layout(location = 2) out vec4 brightColor;
+layout(location = 3) out vec2 velocity;
+#endif
+
+// Screen space motion since the last frame, in UV units
+vec2 ComputeVelocity(vec4 currClip, vec4 prevClip)
+{
+    return (currClip.xy / currClip.w - prevClip.xy / prevClip.w) * 0.5;
+}
+
+// Octahedral normal encoding for the RG16_SNORM G-buffer target
+vec2 OctWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 EncodeNormal(vec3 n)
+{
+    n /= (abs(n.x) + abs(n.y) + abs(n.z));
+    n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+    return n.xy;
+}
+
+float InterleavedGradientNoise(vec2 pixel)
+{
+    return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
 
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 {
@@ -119,6 +173,12 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 	vec2 deltaTexCoords = P / numLayers;
 
 	vec2 currentTexCoords = texCoords;
+	if (temporalLayers != 0)
+	{
+		float offset = fract(InterleavedGradientNoise(gl_FragCoord.xy) + float(frameIndex % 64u) * 0.618034);
+		currentLayerDepth = offset * layerDepth;
+		currentTexCoords -= offset * deltaTexCoords;
+	}
 	float currentDepthMapValue = texture(depthTexture, currentTexCoords).r;
 
 	while(currentLayerDepth < currentDepthMapValue)
@@ -159,6 +219,22 @@ vec3 CalcDirectionalLight(Light dirLight, vec3 normal, vec3 viewDirection)
 	return diffuse + ambientLight + specularLight;
 }
 
+float CalcPointShadow(Light pointLight, vec3 fragPos)
+{
+    if (pointLight.shadowSlot < 0)
+        return 1.0;
+
+    vec3 lightToFrag = fragPos - pointLight.position;
+    float currentDepth = length(lightToFrag) / pointLight.radius;
+    if (currentDepth >= 1.0)
+        return 1.0;
+
+    float closestDepth = texture(shadowMaps, vec4(lightToFrag, float(pointLight.shadowSlot))).r;
+    const float bias = 0.005;
+
+    return currentDepth - bias > closestDepth ? 0.0 : 1.0;
+}
+
 vec3 CalcPointLight(Light pointLight, vec3 normal, vec3 viewDirection)
 {
 	vec3 lightDir = normalize((pointLight.position * tbn) - tangentFragPos);
@@ -177,10 +253,11 @@ vec3 CalcPointLight(Light pointLight, vec3 normal, vec3 viewDirection)
 
 	float distance = length(pointLight.position - fragPos);
 	float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * (distance * distance));
+	float shadow = CalcPointShadow(pointLight, fragPos);
 
 	ambientLight *= attenuation; 
-	diffuse *= attenuation;
-	specularLight *= attenuation;   
+	diffuse *= attenuation * shadow;
+	specularLight *= attenuation * shadow;   
 
 	return diffuse + ambientLight + specularLight;
 }
@@ -200,23 +277,21 @@ void main()
 
     vec3 color = texture(uTexture, newTexCoords).rgb;
 
-    if (renderMode == 0)
+#if defined(FEATURE_FORWARD)
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < uLightCount; ++i)
     {
-        vec3 result;
-        for (int i = 0; i < uLightCount; ++i)
+        if (uLights[i].type == 0)
         {
-            if (uLights[i].type == 0)
-            {
-                result += CalcDirectionalLight(uLights[i], normal, viewDir) * color;
-            }
-            else if (uLights[i].type == 1)
-            {
-                result += CalcPointLight(uLights[i], normal, viewDir) * color;
-            }
+            result += CalcDirectionalLight(uLights[i], normal, viewDir) * color;
+        }
+        else if (uLights[i].type == 1)
+        {
+            result += CalcPointLight(uLights[i], normal, viewDir) * color;
         }
-        forwardColor = vec4(result, 1.0);
     }
-
+    oColor = vec4(result, 1.0);
+#else
     colors = vec4(color.rgb, 1.0);
     
     float brightness = dot(colors.rgb, vec3(0.2126, 0.7152, 0.0722));
@@ -225,8 +300,9 @@ void main()
     else
         brightColor = vec4(0.0, 0.0, 0.0, 1.0);
 
-    positions = vec4(fragPos, 1.0);
-    normals = vec4(b, 1.0);
+    normals = vec4(EncodeNormal(normalize(b)), 0.0, 0.0);
+    velocity = ComputeVelocity(vCurrClip, vPrevClip);
+#endif
 
     //specularColor.rgb = texture(uTexture, newTexCoords).rgb;
 }
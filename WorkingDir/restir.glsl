@@ -0,0 +1,340 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#if defined(RESTIR_TEMPORAL) || defined(RESTIR_SPATIAL)
+
+// Weighted reservoir sampling over the whole light list. Each pixel keeps a
+// reservoir (selected light, weight sum, sample count, unbiased weight) that is
+// reused temporally (reprojected from the previous frame) and spatially (from
+// nearby pixels with similar geometry), so only one light is shaded per pixel.
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+//layout(location=1) in vec3 aNormal;
+layout(location=2) in vec2 aTexCoord;
+//layout(location=3) in vec3 aTangent;
+//layout(location=4) in vec3 aBiTangent;
+
+out vec2 vTexCoord;
+
+// Rendered sub-rect of the pooled render targets
+uniform vec2 uvScale;
+
+void main()
+{
+    vTexCoord = aTexCoord * uvScale;
+    gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+struct Light
+{
+    int type;
+    vec3 color;
+    vec3 direction;
+    vec3 position;
+    float radius;
+    int shadowSlot;
+};
+
+struct Reservoir
+{
+    float lightIdx;
+    float wSum;
+    float M;
+    float W;
+};
+
+in vec2 vTexCoord;
+
+layout(location = 0) uniform sampler2D normals;
+layout(location = 1) uniform sampler2D colors;
+layout(location = 3) uniform sampler2D reservoirs;
+layout(location = 4) uniform sampler2D depth;
+
+uniform uint frameIndex;
+uniform mat4 inverseViewProjection;
+uniform vec2 uvScale;
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+    vec3 uCameraPosition;
+    unsigned int uLightCount;
+    Light uLights[16];
+};
+
+layout(binding = 2, std430) readonly buffer LightList
+{
+    unsigned int uLightListCount;
+    Light uLightList[];
+};
+
+vec3 DecodeNormal(vec2 f)
+{
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+// World position from the depth buffer
+vec3 ReconstructPosition(vec2 uv, float depthValue)
+{
+    vec4 world = inverseViewProjection * vec4(vec3(uv / uvScale, depthValue) * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+
+uint InitSeed(uvec2 pixel, uint frame)
+{
+    uint seed = pixel.x * 1973u + pixel.y * 9277u + frame * 26699u;
+    return seed | 1u;
+}
+
+float Random(inout uint seed)
+{
+    // PCG hash
+    seed = seed * 747796405u + 2891336453u;
+    uint word = ((seed >> ((seed >> 28u) + 4u)) ^ seed) * 277803737u;
+    word = (word >> 22u) ^ word;
+    return float(word) / 4294967296.0;
+}
+
+vec3 CalcDirectionalLight(Light dirLight, vec3 normal, vec3 viewDirection)
+{
+	vec3 lightDir = normalize(dirLight.direction);
+
+	float diff = max(dot(normal, lightDir), 0.0);
+	vec3 diffuse = diff * dirLight.color;
+
+	float ambientStrength = 0.1;
+	vec3 ambient = ambientStrength * dirLight.color;
+
+    vec3 specularStrength = vec3(0.5);
+	vec3 reflectDir = reflect(lightDir, normal);
+	float spec = pow(max(dot(viewDirection, reflectDir), 0.0), 128.0);
+	vec3 specular = spec * dirLight.color * specularStrength;
+
+	return diffuse + ambient + specular;
+}
+
+vec3 CalcPointLight(Light pointLight, vec3 normal, vec3 viewDirection, vec3 fragPos)
+{
+	vec3 ambient = vec3(0.1);
+
+	vec3 lightDir = normalize(pointLight.position - fragPos);
+	vec3 halfwayDir = normalize(lightDir + viewDirection);
+	vec3 diffuse = max(dot(normal, lightDir), 0.0) * pointLight.color;
+
+    vec3 specularStrength = vec3(0.5);
+	float spec = pow(max(dot(normal, halfwayDir), 0.0), 128.0);
+	vec3 specular = spec * pointLight.color * specularStrength;
+
+	float distance = length(pointLight.position - fragPos);
+	float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * (distance * distance));
+
+	return (diffuse + ambient + specular) * attenuation;
+}
+
+// Same terms as the deferred shading, without the albedo (it is applied after denoising)
+vec3 LightContribution(Light light, vec3 normal, vec3 viewDirection, vec3 fragPos)
+{
+    if (light.type == 0)
+        return CalcDirectionalLight(light, normal, viewDirection);
+    return CalcPointLight(light, normal, viewDirection, fragPos);
+}
+
+float TargetPdf(uint lightIdx, vec3 normal, vec3 viewDirection, vec3 fragPos)
+{
+    vec3 contribution = LightContribution(uLightList[lightIdx], normal, viewDirection, fragPos);
+    return dot(contribution, vec3(0.2126, 0.7152, 0.0722));
+}
+
+Reservoir EmptyReservoir()
+{
+    return Reservoir(-1.0, 0.0, 0.0, 0.0);
+}
+
+Reservoir UnpackReservoir(vec4 data)
+{
+    return Reservoir(data.x, data.y, data.z, data.w);
+}
+
+vec4 PackReservoir(Reservoir r)
+{
+    return vec4(r.lightIdx, r.wSum, r.M, r.W);
+}
+
+bool IsValid(Reservoir r)
+{
+    return r.lightIdx >= 0.0 && uint(r.lightIdx) < uLightListCount;
+}
+
+void UpdateReservoir(inout Reservoir r, float lightIdx, float weight, float M, inout uint seed)
+{
+    r.wSum += weight;
+    r.M += M;
+    if (weight > 0.0 && Random(seed) * r.wSum <= weight)
+        r.lightIdx = lightIdx;
+}
+
+void FinalizeReservoir(inout Reservoir r, vec3 normal, vec3 viewDirection, vec3 fragPos)
+{
+    float pHat = IsValid(r) ? TargetPdf(uint(r.lightIdx), normal, viewDirection, fragPos) : 0.0;
+    r.W = pHat > 0.0 ? r.wSum / (r.M * pHat) : 0.0;
+}
+
+// Merges another pixel's reservoir, re-weighting its sample with this pixel's target function
+void MergeReservoir(inout Reservoir r, Reservoir other, vec3 normal, vec3 viewDirection, vec3 fragPos, inout uint seed)
+{
+    float pHat = IsValid(other) ? TargetPdf(uint(other.lightIdx), normal, viewDirection, fragPos) : 0.0;
+    UpdateReservoir(r, other.lightIdx, pHat * other.W * other.M, other.M, seed);
+}
+
+#if defined(RESTIR_TEMPORAL)
+
+uniform mat4 prevViewProjection;
+uniform int candidateCount;
+uniform int temporalReuse;
+
+layout(location = 0) out vec4 oReservoir;
+
+void main()
+{
+    if (texture(colors, vTexCoord).a < 0.5 || uLightListCount == 0u)
+    {
+        oReservoir = PackReservoir(EmptyReservoir());
+        return;
+    }
+
+    vec3 fragPos = ReconstructPosition(vTexCoord, texture(depth, vTexCoord).r);
+    vec3 normal = DecodeNormal(texture(normals, vTexCoord).rg);
+    vec3 viewDir = normalize(uCameraPosition - fragPos);
+    uint seed = InitSeed(uvec2(gl_FragCoord.xy), frameIndex);
+
+    // Initial candidates, picked uniformly from the light list
+    Reservoir r = EmptyReservoir();
+    float sourcePdf = 1.0 / float(uLightListCount);
+    for (int i = 0; i < candidateCount; ++i)
+    {
+        uint lightIdx = min(uint(Random(seed) * float(uLightListCount)), uLightListCount - 1u);
+        float pHat = TargetPdf(lightIdx, normal, viewDir, fragPos);
+        UpdateReservoir(r, float(lightIdx), pHat / sourcePdf, 1.0, seed);
+    }
+    FinalizeReservoir(r, normal, viewDir, fragPos);
+
+    // Temporal reuse: reproject the previous frame's final reservoir
+    if (temporalReuse != 0)
+    {
+        vec4 prevClip = prevViewProjection * vec4(fragPos, 1.0);
+        vec2 prevUV = (prevClip.xy / prevClip.w) * 0.5 + 0.5;
+        if (prevClip.w > 0.0 && all(greaterThanEqual(prevUV, vec2(0.0))) && all(lessThanEqual(prevUV, vec2(1.0))))
+        {
+            Reservoir prev = UnpackReservoir(texelFetch(reservoirs, ivec2(prevUV * uvScale * vec2(textureSize(reservoirs, 0))), 0));
+            if (IsValid(prev))
+            {
+                // Clamp the history so it can still react to changes
+                prev.M = min(prev.M, 20.0 * float(candidateCount));
+
+                Reservoir merged = EmptyReservoir();
+                MergeReservoir(merged, r, normal, viewDir, fragPos, seed);
+                MergeReservoir(merged, prev, normal, viewDir, fragPos, seed);
+                FinalizeReservoir(merged, normal, viewDir, fragPos);
+                r = merged;
+            }
+        }
+    }
+
+    oReservoir = PackReservoir(r);
+}
+
+#elif defined(RESTIR_SPATIAL)
+
+layout(location = 7) uniform samplerCubeArray shadowMaps;
+
+uniform int spatialSamples;
+uniform float spatialRadius;
+
+layout(location = 0) out vec4 oReservoir;
+layout(location = 1) out vec4 oLighting;
+
+float CalcPointShadow(Light pointLight, vec3 fragPos)
+{
+    if (pointLight.shadowSlot < 0)
+        return 1.0;
+
+    vec3 lightToFrag = fragPos - pointLight.position;
+    float currentDepth = length(lightToFrag) / pointLight.radius;
+    if (currentDepth >= 1.0)
+        return 1.0;
+
+    float closestDepth = texture(shadowMaps, vec4(lightToFrag, float(pointLight.shadowSlot))).r;
+    const float bias = 0.005;
+
+    return currentDepth - bias > closestDepth ? 0.0 : 1.0;
+}
+
+void main()
+{
+    if (texture(colors, vTexCoord).a < 0.5 || uLightListCount == 0u)
+    {
+        oReservoir = PackReservoir(EmptyReservoir());
+        oLighting = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    vec3 fragPos = ReconstructPosition(vTexCoord, texture(depth, vTexCoord).r);
+    vec3 normal = DecodeNormal(texture(normals, vTexCoord).rg);
+    vec3 viewDir = normalize(uCameraPosition - fragPos);
+    float viewDistance = length(uCameraPosition - fragPos);
+    uint seed = InitSeed(uvec2(gl_FragCoord.xy), frameIndex + 7919u);
+
+    vec2 textureExtent = vec2(textureSize(reservoirs, 0));
+    ivec2 size = ivec2(textureExtent * uvScale);
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+    Reservoir r = EmptyReservoir();
+    MergeReservoir(r, UnpackReservoir(texelFetch(reservoirs, pixel, 0)), normal, viewDir, fragPos, seed);
+
+    // Spatial reuse from neighbours lying on a similar surface
+    for (int i = 0; i < spatialSamples; ++i)
+    {
+        vec2 offset = (vec2(Random(seed), Random(seed)) * 2.0 - 1.0) * spatialRadius;
+        ivec2 neighbour = clamp(pixel + ivec2(offset), ivec2(0), size - 1);
+
+        if (texelFetch(colors, neighbour, 0).a < 0.5)
+            continue;
+
+        vec2 neighbourUV = (vec2(neighbour) + 0.5) / textureExtent;
+        vec3 neighbourNormal = DecodeNormal(texelFetch(normals, neighbour, 0).rg);
+        vec3 neighbourPos = ReconstructPosition(neighbourUV, texelFetch(depth, neighbour, 0).r);
+        if (dot(neighbourNormal, normal) < 0.9 || abs(dot(neighbourPos - fragPos, normal)) > 0.05 * viewDistance)
+            continue;
+
+        MergeReservoir(r, UnpackReservoir(texelFetch(reservoirs, neighbour, 0)), normal, viewDir, fragPos, seed);
+    }
+    FinalizeReservoir(r, normal, viewDir, fragPos);
+
+    vec3 lighting = vec3(0.0);
+    if (IsValid(r))
+    {
+        Light light = uLightList[uint(r.lightIdx)];
+        float shadow = light.type == 1 ? CalcPointShadow(light, fragPos) : 1.0;
+        lighting = LightContribution(light, normal, viewDir, fragPos) * shadow * r.W;
+    }
+
+    oReservoir = PackReservoir(r);
+    oLighting = vec4(lighting, 1.0);
+}
+
+#endif
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
@@ -10,6 +10,7 @@ layout(location=1) in vec3 aNormal;
 layout(location=2) in vec2 aTexCoord;
 //layout(location=3) in vec3 aTangent;
 //layout(location=4) in vec3 aBiTangent;
+layout(location=5) in uint aDrawIdx; // the draw's base instance, see BindDrawIndexAttribute
 
 out vec2 vTexCoord;
 out vec3 vPosition;
@@ -22,6 +23,8 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
@@ -31,20 +34,29 @@ layout(binding = 0, std140) uniform GlobalParams
     Light uLights[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
+struct ObjectParams
 {
-    mat4 uWorldMatrix;
-    mat4 uWorldViewProjectionMatrix;
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;     // jittered when TAA is on
+    mat4 currWorldViewProjectionMatrix; // without the jitter, for the velocity
+    mat4 prevWorldViewProjectionMatrix; // last frame's, also without the jitter
+};
+
+layout(binding = 1, std430) readonly buffer Objects
+{
+    ObjectParams uObjects[];
 };
 
 void main()
 {
+    ObjectParams object = uObjects[aDrawIdx];
+
     vTexCoord = aTexCoord;
-    vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-    vNormal = mat3(transpose(inverse(uWorldMatrix))) * aNormal;
+    vPosition = vec3(object.worldMatrix * vec4(aPosition, 1.0));
+    vNormal = mat3(transpose(inverse(object.worldMatrix))) * aNormal;
     vViewDir = uCameraPosition - vPosition;
 
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    gl_Position = object.worldViewProjectionMatrix * vec4(aPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -55,6 +67,8 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float radius;
+    int shadowSlot;
 };
 
 in vec2 vTexCoord;
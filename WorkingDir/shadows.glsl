@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef POINT_SHADOW
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+//layout(location=1) in vec3 aNormal;
+//layout(location=2) in vec2 aTexCoord;
+//layout(location=3) in vec3 aTangent;
+//layout(location=4) in vec3 aBiTangent;
+layout(location=5) in uint aDrawIdx; // the draw's base instance, see BindDrawIndexAttribute
+
+struct ObjectParams
+{
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;     // jittered when TAA is on
+    mat4 currWorldViewProjectionMatrix; // without the jitter, for the velocity
+    mat4 prevWorldViewProjectionMatrix; // last frame's, also without the jitter
+};
+
+layout(binding = 1, std430) readonly buffer Objects
+{
+    ObjectParams uObjects[];
+};
+
+void main()
+{
+    gl_Position = uObjects[aDrawIdx].worldMatrix * vec4(aPosition, 1.0);
+}
+
+#elif defined(GEOMETRY) ///////////////////////////////////////////////
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 18) out;
+
+uniform mat4 shadowMatrices[6];
+
+out vec4 gFragPos;
+
+void main()
+{
+    // Render the triangle into the 6 faces of the cube map in a single pass
+    for (int face = 0; face < 6; ++face)
+    {
+        gl_Layer = face;
+        for (int i = 0; i < 3; ++i)
+        {
+            gFragPos = gl_in[i].gl_Position;
+            gl_Position = shadowMatrices[face] * gFragPos;
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec4 gFragPos;
+
+uniform vec3 lightPosition;
+uniform float farPlane;
+
+void main()
+{
+    // Store the linear distance to the light, normalized by its radius
+    gl_FragDepth = length(gFragPos.xyz - lightPosition) / farPlane;
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
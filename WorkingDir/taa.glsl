@@ -0,0 +1,167 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Temporal anti-aliasing resolve. The projection is jittered by a sub-pixel
+// offset every frame, so blending the scene color with the reprojected history
+// accumulates several samples per pixel. The history is clamped to the color
+// range of the current neighbourhood, which rejects it where it's stale.
+#ifdef TAA_RESOLVE
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+//layout(location=1) in vec3 aNormal;
+layout(location=2) in vec2 aTexCoord;
+//layout(location=3) in vec3 aTangent;
+//layout(location=4) in vec3 aBiTangent;
+
+out vec2 vTexCoord;
+
+void main()
+{
+    vTexCoord = aTexCoord;
+    gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec2 vTexCoord;
+
+layout(location = 0) out vec4 oColor;
+
+layout(location = 0) uniform sampler2D sceneColor;
+layout(location = 1) uniform sampler2D history;
+layout(location = 2) uniform sampler2D velocity;
+layout(location = 3) uniform sampler2D depth;
+
+uniform vec2 uvScale;        // rendered sub-rect of this frame's targets
+uniform vec2 historyUVScale; // rendered sub-rect of the history, last frame's render size
+uniform mat4 inverseViewProjection;
+uniform mat4 prevViewProjection;
+uniform float feedback;      // weight of the history
+uniform int historyValid;
+uniform int objectMotion;    // 0 when there's no velocity target, only the camera motion is known
+
+vec3 RGBToYCoCg(vec3 c)
+{
+    return vec3(dot(c, vec3(0.25, 0.5, 0.25)), dot(c, vec3(0.5, 0.0, -0.5)), dot(c, vec3(-0.25, 0.5, -0.25)));
+}
+
+vec3 YCoCgToRGB(vec3 c)
+{
+    return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+// Keeps the bilinear taps inside the rendered sub-rect of the history
+vec3 SampleHistory(vec2 uv, vec2 texelSize)
+{
+    return texture(history, clamp(uv, 0.5 * texelSize, historyUVScale - 0.5 * texelSize)).rgb;
+}
+
+// Catmull-Rom with 9 bilinear taps, bilinear alone blurs the history a bit more every frame
+vec3 SampleHistoryCatmullRom(vec2 uv, vec2 texelSize)
+{
+    vec2 samplePos = uv / texelSize;
+    vec2 texPos1 = floor(samplePos - 0.5) + 0.5;
+    vec2 f = samplePos - texPos1;
+
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+    vec2 w12 = w1 + w2;
+    vec2 offset12 = w2 / w12;
+
+    vec2 texPos0 = (texPos1 - 1.0) * texelSize;
+    vec2 texPos3 = (texPos1 + 2.0) * texelSize;
+    vec2 texPos12 = (texPos1 + offset12) * texelSize;
+
+    vec3 result = vec3(0.0);
+    result += SampleHistory(vec2(texPos0.x, texPos0.y), texelSize) * w0.x * w0.y;
+    result += SampleHistory(vec2(texPos12.x, texPos0.y), texelSize) * w12.x * w0.y;
+    result += SampleHistory(vec2(texPos3.x, texPos0.y), texelSize) * w3.x * w0.y;
+
+    result += SampleHistory(vec2(texPos0.x, texPos12.y), texelSize) * w0.x * w12.y;
+    result += SampleHistory(vec2(texPos12.x, texPos12.y), texelSize) * w12.x * w12.y;
+    result += SampleHistory(vec2(texPos3.x, texPos12.y), texelSize) * w3.x * w12.y;
+
+    result += SampleHistory(vec2(texPos0.x, texPos3.y), texelSize) * w0.x * w3.y;
+    result += SampleHistory(vec2(texPos12.x, texPos3.y), texelSize) * w12.x * w3.y;
+    result += SampleHistory(vec2(texPos3.x, texPos3.y), texelSize) * w3.x * w3.y;
+
+    return max(result, vec3(0.0));
+}
+
+// Motion of a static surface at that depth, from the camera alone. Nothing is drawn
+// on the background (depth 1) so this is exact there.
+vec2 ReprojectCamera(vec2 uv, float depthValue)
+{
+    vec4 worldPos = inverseViewProjection * vec4(vec3(uv, depthValue) * 2.0 - 1.0, 1.0);
+    vec4 prevClip = prevViewProjection * vec4(worldPos.xyz / worldPos.w, 1.0);
+    return uv - (prevClip.xy / prevClip.w * 0.5 + 0.5);
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 maxPixel = ivec2(uvScale * vec2(textureSize(sceneColor, 0))) - 1;
+
+    // Color range of the 3x3 neighbourhood, and the closest surface in it so
+    // edges take the velocity of the foreground
+    vec3 current = vec3(0.0);
+    vec3 minColor = vec3(1e9);
+    vec3 maxColor = vec3(-1e9);
+    float closestDepth = 1.0;
+    ivec2 closestPixel = pixel;
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            ivec2 samplePixel = clamp(pixel + ivec2(x, y), ivec2(0), maxPixel);
+            vec3 color = texelFetch(sceneColor, samplePixel, 0).rgb;
+            // Tone mapped weights keep single bright pixels from dominating
+            color /= 1.0 + max(color.r, max(color.g, color.b));
+            vec3 ycocg = RGBToYCoCg(color);
+            minColor = min(minColor, ycocg);
+            maxColor = max(maxColor, ycocg);
+            if (x == 0 && y == 0)
+                current = color;
+
+            float sampleDepth = texelFetch(depth, samplePixel, 0).r;
+            if (sampleDepth < closestDepth)
+            {
+                closestDepth = sampleDepth;
+                closestPixel = samplePixel;
+            }
+        }
+    }
+
+    vec2 uv = vTexCoord;
+    vec2 motion = objectMotion != 0 && closestDepth < 1.0 ? texelFetch(velocity, closestPixel, 0).rg : ReprojectCamera(uv, closestDepth);
+    vec2 prevUV = uv - motion;
+
+    vec3 result = current;
+    if (historyValid != 0 && all(greaterThanEqual(prevUV, vec2(0.0))) && all(lessThanEqual(prevUV, vec2(1.0))))
+    {
+        vec2 historyTexelSize = 1.0 / vec2(textureSize(history, 0));
+        vec3 prev = SampleHistoryCatmullRom(prevUV * historyUVScale, historyTexelSize);
+        prev /= 1.0 + max(prev.r, max(prev.g, prev.b));
+        prev = YCoCgToRGB(clamp(RGBToYCoCg(prev), minColor, maxColor));
+
+        result = mix(current, prev, feedback);
+    }
+
+    // Back to linear HDR
+    result /= max(1.0 - max(result.r, max(result.g, result.b)), 1e-4);
+    oColor = vec4(max(result, vec3(0.0)), 1.0);
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
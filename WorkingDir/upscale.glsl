@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Spatial upscale of the final image from the dynamic render resolution to
+// the window. Catmull-Rom filtering keeps it sharper than bilinear, and a
+// light sharpen against the neighbours recovers some of what was lost.
+#ifdef UPSCALE
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+//layout(location=1) in vec3 aNormal;
+layout(location=2) in vec2 aTexCoord;
+//layout(location=3) in vec3 aTangent;
+//layout(location=4) in vec3 aBiTangent;
+
+// Normalized over the window
+out vec2 vTexCoord;
+
+void main()
+{
+    vTexCoord = aTexCoord;
+    gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec2 vTexCoord;
+
+layout(location = 0) out vec4 oColor;
+
+layout(location = 0) uniform sampler2D image;
+
+// Rendered sub-rect of the image
+uniform vec2 uvScale;
+uniform float sharpness;
+
+// Keeps the bilinear taps inside the rendered sub-rect
+vec3 SampleImage(vec2 uv, vec2 texelSize)
+{
+    return texture(image, clamp(uv, 0.5 * texelSize, uvScale - 0.5 * texelSize)).rgb;
+}
+
+// Catmull-Rom with 9 bilinear taps instead of 16 point ones
+vec3 SampleCatmullRom(vec2 uv, vec2 texelSize)
+{
+    vec2 samplePos = uv / texelSize;
+    vec2 texPos1 = floor(samplePos - 0.5) + 0.5;
+    vec2 f = samplePos - texPos1;
+
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+    vec2 w12 = w1 + w2;
+    vec2 offset12 = w2 / w12;
+
+    vec2 texPos0 = (texPos1 - 1.0) * texelSize;
+    vec2 texPos3 = (texPos1 + 2.0) * texelSize;
+    vec2 texPos12 = (texPos1 + offset12) * texelSize;
+
+    vec3 result = vec3(0.0);
+    result += SampleImage(vec2(texPos0.x, texPos0.y), texelSize) * w0.x * w0.y;
+    result += SampleImage(vec2(texPos12.x, texPos0.y), texelSize) * w12.x * w0.y;
+    result += SampleImage(vec2(texPos3.x, texPos0.y), texelSize) * w3.x * w0.y;
+
+    result += SampleImage(vec2(texPos0.x, texPos12.y), texelSize) * w0.x * w12.y;
+    result += SampleImage(vec2(texPos12.x, texPos12.y), texelSize) * w12.x * w12.y;
+    result += SampleImage(vec2(texPos3.x, texPos12.y), texelSize) * w3.x * w12.y;
+
+    result += SampleImage(vec2(texPos0.x, texPos3.y), texelSize) * w0.x * w3.y;
+    result += SampleImage(vec2(texPos12.x, texPos3.y), texelSize) * w12.x * w3.y;
+    result += SampleImage(vec2(texPos3.x, texPos3.y), texelSize) * w3.x * w3.y;
+
+    return max(result, vec3(0.0));
+}
+
+void main()
+{
+    vec2 texelSize = 1.0 / vec2(textureSize(image, 0));
+    vec2 uv = vTexCoord * uvScale;
+
+    vec3 color = SampleCatmullRom(uv, texelSize);
+
+    // Unsharp mask against the cross of source texels around the pixel
+    vec3 neighbours = SampleImage(uv + vec2(texelSize.x, 0.0), texelSize) + SampleImage(uv - vec2(texelSize.x, 0.0), texelSize) +
+                      SampleImage(uv + vec2(0.0, texelSize.y), texelSize) + SampleImage(uv - vec2(0.0, texelSize.y), texelSize);
+    color += (color - neighbours * 0.25) * sharpness;
+
+    oColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Visibility buffer: stores which triangle covers each pixel and nothing
+// else, the draw in the high bits and gl_PrimitiveID in the low ones.
+// Reads only the position stream, the attributes are fetched and shaded
+// once per pixel by the resolve (visibilityResolve.glsl).
+#ifdef VISIBILITY
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=5) in uint aDrawIdx; // the draw's base instance, see BindDrawIndexAttribute
+
+struct ObjectParams
+{
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;     // jittered when TAA is on
+    mat4 currWorldViewProjectionMatrix; // without the jitter, for the velocity
+    mat4 prevWorldViewProjectionMatrix; // last frame's, also without the jitter
+};
+
+layout(binding = 1, std430) readonly buffer Objects
+{
+    ObjectParams uObjects[];
+};
+
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = uObjects[aDrawIdx].worldViewProjectionMatrix * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+uniform uint drawId;       // index in the visibility draw buffer
+uniform uint triangleBits; // bits of the ID left for the triangle
+
+layout(location = 0) out uint oVisibility;
+
+void main()
+{
+    oVisibility = (drawId << triangleBits) | uint(gl_PrimitiveID);
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file
@@ -0,0 +1,263 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Visibility buffer resolve. Each pixel reads its triangle ID, fetches the
+// three vertices from the scene wide geometry buffers, rebuilds perspective
+// correct barycentrics (and their screen derivatives for the texture
+// filtering) and shades the pixel forward into the scene color. Only the
+// pixels whose albedo texture is bound in this dispatch are written.
+#ifdef VISIBILITY_RESOLVE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+#define TEXTURE_SLOTS 8 // VISIBILITY_TEXTURE_SLOTS
+#define BACKGROUND_ID 0xFFFFFFFFu
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+struct Light
+{
+    int type;
+    vec3 color;
+    vec3 direction;
+    vec3 position;
+    float radius;
+    int shadowSlot;
+};
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+    vec3 uCameraPosition;
+    unsigned int uLightCount;
+    Light uLights[16];
+};
+
+struct VisibilityVertex
+{
+    vec4 positionU;
+    vec4 normalV;
+};
+
+struct VisibilityDraw
+{
+    mat4 worldMatrix;
+    mat4 normalMatrix;
+    uint firstIndex;
+    uint textureSlot;
+    uint pad0;
+    uint pad1;
+};
+
+layout(binding = 4, std430) readonly buffer VisibilityVertices
+{
+    VisibilityVertex vertices[];
+};
+
+layout(binding = 5, std430) readonly buffer VisibilityIndices
+{
+    uint indices[];
+};
+
+layout(binding = 6, std430) readonly buffer VisibilityDraws
+{
+    VisibilityDraw draws[];
+};
+
+layout(location = 0) uniform usampler2D visibility;
+layout(location = 1) uniform samplerCubeArray shadowMaps;
+layout(location = 2) uniform sampler2D albedoTextures[TEXTURE_SLOTS];
+
+layout(binding = 0, r11f_g11f_b10f) uniform writeonly image2D sceneColor;
+
+uniform mat4 viewProjection;  // jittered like the visibility pass
+uniform vec2 size;            // render size in pixels
+uniform uint triangleBits;
+uniform uint firstTextureSlot; // albedo texture bound to albedoTextures[0]
+
+struct Barycentrics
+{
+    vec3 lambda;
+    vec3 ddx; // change of lambda one pixel to the right
+    vec3 ddy; // and one pixel up
+};
+
+// Perspective correct barycentrics of the pixel in the clip space triangle, from the
+// screen space ones interpolated in 1/w (same as the rasterizer does)
+Barycentrics ComputeBarycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 ndc, vec2 windowSize)
+{
+    Barycentrics result;
+
+    vec3 invW = 1.0 / vec3(clip0.w, clip1.w, clip2.w);
+    vec2 ndc0 = clip0.xy * invW.x;
+    vec2 ndc1 = clip1.xy * invW.y;
+    vec2 ndc2 = clip2.xy * invW.z;
+
+    float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    result.ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    result.ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+    float ddxSum = dot(result.ddx, vec3(1.0));
+    float ddySum = dot(result.ddy, vec3(1.0));
+
+    vec2 delta = ndc - ndc0;
+    float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+    float interpW = 1.0 / interpInvW;
+
+    result.lambda.x = interpW * (invW.x + delta.x * result.ddx.x + delta.y * result.ddy.x);
+    result.lambda.y = interpW * (delta.x * result.ddx.y + delta.y * result.ddy.y);
+    result.lambda.z = interpW * (delta.x * result.ddx.z + delta.y * result.ddy.z);
+
+    // From NDC units to one pixel
+    result.ddx *= 2.0 / windowSize.x;
+    result.ddy *= 2.0 / windowSize.y;
+    ddxSum *= 2.0 / windowSize.x;
+    ddySum *= 2.0 / windowSize.y;
+
+    float interpWdx = 1.0 / (interpInvW + ddxSum);
+    float interpWdy = 1.0 / (interpInvW + ddySum);
+    result.ddx = interpWdx * (result.lambda * interpInvW + result.ddx) - result.lambda;
+    result.ddy = interpWdy * (result.lambda * interpInvW + result.ddy) - result.lambda;
+
+    return result;
+}
+
+vec3 CalcDirectionalLight(vec3 direction, vec3 color, vec3 vPosition, vec3 vNormal)
+{
+    float ambientStrength = 0.1;
+    vec3 ambient = ambientStrength * color;
+
+    vec3 norm = normalize(vNormal);
+    vec3 lightDir = normalize(-direction);
+
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * color;
+
+    float specularStrength = 0.5;
+    vec3 viewDir = normalize(uCameraPosition - vPosition);
+    vec3 reflectDir = reflect(-lightDir, norm);
+
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    vec3 specular = specularStrength * spec * color;
+
+    return (ambient + diffuse + specular);
+}
+
+float CalcPointShadow(Light pointLight, vec3 fragPos)
+{
+    if (pointLight.shadowSlot < 0)
+        return 1.0;
+
+    vec3 lightToFrag = fragPos - pointLight.position;
+    float currentDepth = length(lightToFrag) / pointLight.radius;
+    if (currentDepth >= 1.0)
+        return 1.0;
+
+    float closestDepth = texture(shadowMaps, vec4(lightToFrag, float(pointLight.shadowSlot))).r;
+    const float bias = 0.005;
+
+    return currentDepth - bias > closestDepth ? 0.0 : 1.0;
+}
+
+vec3 CalcPointLight(vec3 position, vec3 color, vec3 fragPosition, vec3 normal, float shadow)
+{
+    float ambientStrength = 0.1;
+    vec3 ambient = ambientStrength * color;
+
+    vec3 norm = normalize(normal);
+    vec3 lightDir = normalize(position - fragPosition);
+
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * color;
+
+    float specularStrength = 0.5;
+    vec3 viewDir = normalize(uCameraPosition - fragPosition);
+    vec3 reflectDir = reflect(-lightDir, norm);
+
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+    vec3 specular = specularStrength * spec * color;
+
+    float distance = length(position - fragPosition);
+    float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * (distance * distance));
+
+    ambient *= attenuation;
+    diffuse *= attenuation * shadow;
+    specular *= attenuation * shadow;
+
+    return (ambient + diffuse + specular);
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(vec2(pixel), size)))
+        return;
+
+    uint id = texelFetch(visibility, pixel, 0).r;
+    if (id == BACKGROUND_ID)
+    {
+        if (firstTextureSlot == 0u)
+            imageStore(sceneColor, pixel, vec4(0.0));
+        return;
+    }
+
+    VisibilityDraw draw = draws[id >> triangleBits];
+    uint slot = draw.textureSlot - firstTextureSlot;
+    if (draw.textureSlot < firstTextureSlot || slot >= uint(TEXTURE_SLOTS))
+        return;
+
+    uint triangle = id & ((1u << triangleBits) - 1u);
+    VisibilityVertex v0 = vertices[indices[draw.firstIndex + triangle * 3u + 0u]];
+    VisibilityVertex v1 = vertices[indices[draw.firstIndex + triangle * 3u + 1u]];
+    VisibilityVertex v2 = vertices[indices[draw.firstIndex + triangle * 3u + 2u]];
+
+    vec3 world0 = vec3(draw.worldMatrix * vec4(v0.positionU.xyz, 1.0));
+    vec3 world1 = vec3(draw.worldMatrix * vec4(v1.positionU.xyz, 1.0));
+    vec3 world2 = vec3(draw.worldMatrix * vec4(v2.positionU.xyz, 1.0));
+
+    vec2 ndc = (vec2(pixel) + 0.5) / size * 2.0 - 1.0;
+    Barycentrics bary = ComputeBarycentrics(viewProjection * vec4(world0, 1.0), viewProjection * vec4(world1, 1.0),
+        viewProjection * vec4(world2, 1.0), ndc, size);
+
+    vec3 position = mat3(world0, world1, world2) * bary.lambda;
+
+    mat3x2 uvs = mat3x2(vec2(v0.positionU.w, v0.normalV.w), vec2(v1.positionU.w, v1.normalV.w), vec2(v2.positionU.w, v2.normalV.w));
+    vec2 uv = uvs * bary.lambda;
+    vec2 uvDx = uvs * bary.ddx;
+    vec2 uvDy = uvs * bary.ddy;
+
+    // Same normal as mesh.glsl gives the forward and deferred paths
+    vec3 vNormal = mat3(draw.normalMatrix) * (mat3(v0.normalV.xyz, v1.normalV.xyz, v2.normalV.xyz) * bary.lambda);
+    vec3 normal = normalize(vNormal * 2.0 - 1.0);
+
+    // Samplers can only be indexed with constants here, hence the loop
+    vec3 albedo = vec3(0.0);
+    for (int i = 0; i < TEXTURE_SLOTS; ++i)
+    {
+        if (uint(i) == slot)
+            albedo = textureGrad(albedoTextures[i], uv, uvDx, uvDy).rgb;
+    }
+
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < uLightCount; ++i)
+    {
+        if (uLights[i].type == 0)
+        {
+            result += CalcDirectionalLight(uLights[i].direction, uLights[i].color, position, normal) * albedo;
+        }
+        else if (uLights[i].type == 1)
+        {
+            float shadow = CalcPointShadow(uLights[i], position);
+            result += CalcPointLight(uLights[i].position, uLights[i].color, position, normal, shadow) * albedo;
+        }
+    }
+
+    imageStore(sceneColor, pixel, vec4(result, 1.0));
+}
+
+#endif
+#endif
+
+
+// NOTE: You can write several shaders in the same file if you want as
+// long as you embrace them within an #ifdef block (as you can see above).
+// The third parameter of the LoadProgram function in engine.cpp allows
+// chosing the shader you want to load by name.
\ No newline at end of file